@@ -0,0 +1,140 @@
+/*
+ * AES encryption with the x86 AES-NI instructions.
+ *
+ * The key schedule is the one computed by rijndaelKeySetupEnc() with
+ * each word stored in byte order (see rijndael_setup_impl()). The
+ * functions in this file are compiled for the AES instruction set
+ * regardless of the compiler flags and must only be called if
+ * rijndael_aesni_supported() returns non-zero.
+ */
+
+#include "rijndael.h"
+
+#ifdef RIJNDAEL_AESNI
+
+#include <string.h>
+#include <wmmintrin.h>
+
+int
+rijndael_aesni_supported(void)
+{
+	static int supported = -1;
+
+	if (supported < 0) {
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("aes") ? 1 : 0;
+	}
+	return supported;
+}
+
+__attribute__((target("aes,sse2")))
+void
+rijndaelEncryptAESNI(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, const aes_u8 pt[16],
+    aes_u8 ct[16])
+{
+	const __m128i *k = (const __m128i *)rk;
+	__m128i s;
+	int r;
+
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt),
+	    _mm_loadu_si128(k));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(k + r));
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(k + Nr));
+	_mm_storeu_si128((__m128i *)ct, s);
+}
+
+/*
+ * Runs two independent blocks through the cipher. The rounds are
+ * interleaved so that the second block uses the AES unit while the
+ * first one waits for the result of its previous round.
+ */
+__attribute__((target("aes,sse2")))
+static inline void
+aesni_encrypt2(const __m128i *k, int Nr, __m128i *a, __m128i *b)
+{
+	__m128i k0 = _mm_loadu_si128(k), x = *a, y = *b;
+	int r;
+
+	x = _mm_xor_si128(x, k0);
+	y = _mm_xor_si128(y, k0);
+	for (r = 1; r < Nr; r++) {
+		__m128i kr = _mm_loadu_si128(k + r);
+		x = _mm_aesenc_si128(x, kr);
+		y = _mm_aesenc_si128(y, kr);
+	}
+	k0 = _mm_loadu_si128(k + Nr);
+	*a = _mm_aesenclast_si128(x, k0);
+	*b = _mm_aesenclast_si128(y, k0);
+}
+
+/*
+ * CCM (RFC 3610) for messages whose additional data fits into a single
+ * block after B0, i.e. l(a) <= 14 bytes as used by DTLS. B holds the
+ * formatted blocks B0 and B1, A is the counter block A0 (counter bytes
+ * zero). The lm bytes at msg are encrypted (enc != 0) or decrypted in
+ * place, and the unencrypted tag X ^ S0 is written to T. The counter is
+ * added to the last four bytes of A, so lm must be less than 2^24.
+ *
+ * CBC-MAC is a chain of dependent block encryptions while the CTR key
+ * stream is not. The key stream for the next block is computed
+ * together with the CBC-MAC of the current one, so both take the time
+ * of a single block encryption.
+ */
+__attribute__((target("aes,sse2")))
+void
+rijndaelCCMAESNI(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, int enc,
+    const aes_u8 B[32], const aes_u8 A[16], aes_u8 *msg, size_t lm,
+    aes_u8 T[16])
+{
+	const __m128i *k = (const __m128i *)rk;
+	__m128i a0 = _mm_loadu_si128((const __m128i *)A);
+	__m128i x = _mm_loadu_si128((const __m128i *)B);
+	__m128i s0 = a0, s, p;
+	aes_u8 last[16];
+	uint32_t ctr = 1;
+	size_t i, n;
+
+#define CCM_COUNTER(c)	_mm_xor_si128(a0,				\
+	    _mm_set_epi32((int)__builtin_bswap32(c), 0, 0, 0))
+
+	/* X_1 = E(B0) and S_0 = E(A_0) */
+	aesni_encrypt2(k, Nr, &x, &s0);
+
+	/* X_2 = E(X_1 ^ B1) and S_1 = E(A_1) */
+	x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)(B + 16)));
+	s = CCM_COUNTER(ctr);
+	aesni_encrypt2(k, Nr, &x, &s);
+
+	for (n = lm / 16; n; n--, msg += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)msg);
+
+		p = enc ? c : _mm_xor_si128(c, s);
+		_mm_storeu_si128((__m128i *)msg, _mm_xor_si128(c, s));
+
+		x = _mm_xor_si128(x, p);
+		s = CCM_COUNTER(++ctr);
+		aesni_encrypt2(k, Nr, &x, &s);
+	}
+
+	if ((n = lm % 16)) {
+		/* the last block is padded with zeroes for the CBC-MAC */
+		_mm_storeu_si128((__m128i *)last, s);
+		memset(T, 0, 16);
+		for (i = 0; i < n; i++) {
+			aes_u8 c = msg[i];
+
+			msg[i] = c ^ last[i];
+			T[i] = enc ? c : msg[i];
+		}
+		x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)T));
+		_mm_storeu_si128((__m128i *)T, x);
+		rijndaelEncryptAESNI(rk, Nr, T, T);
+		x = _mm_loadu_si128((const __m128i *)T);
+	}
+#undef CCM_COUNTER
+
+	_mm_storeu_si128((__m128i *)T, _mm_xor_si128(x, s0));
+}
+
+#endif /* RIJNDAEL_AESNI */
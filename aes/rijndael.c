@@ -1229,6 +1229,75 @@ rijndaelDecrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, const aes_u8 ct[16],
 }
 #endif
 
+#ifdef RIJNDAEL_AESNI
+static int rijndael_impl = -1;		/* not yet selected */
+
+int
+rijndael_set_impl(int impl)
+{
+	switch (impl) {
+	case RIJNDAEL_IMPL_AUTO:
+		rijndael_impl = rijndael_aesni_supported()
+		    ? RIJNDAEL_IMPL_AESNI : RIJNDAEL_IMPL_TABLE;
+		break;
+	case RIJNDAEL_IMPL_AESNI:
+		if (!rijndael_aesni_supported())
+			return -1;
+		/* fall through */
+	case RIJNDAEL_IMPL_TABLE:
+		rijndael_impl = impl;
+		break;
+	default:
+		return -1;
+	}
+	return rijndael_impl;
+}
+
+int
+rijndael_get_impl(void)
+{
+	if (rijndael_impl < 0)
+		rijndael_set_impl(RIJNDAEL_IMPL_AUTO);
+	return rijndael_impl;
+}
+
+/*
+ * AES-NI takes the round keys as byte strings, so the words of the
+ * schedule are stored in byte order instead of host order.
+ */
+static void
+rijndael_setup_impl(rijndael_ctx *ctx)
+{
+	aes_u32 *rk;
+	aes_u8 *p;
+
+	ctx->aesni = rijndael_get_impl() == RIJNDAEL_IMPL_AESNI;
+	if (!ctx->aesni)
+		return;
+
+	for (rk = ctx->ek; rk < ctx->ek + 4 * (ctx->Nr + 1); rk++) {
+		aes_u32 w = *rk;
+		p = (aes_u8 *)rk;
+		PUTU32(p, w);
+	}
+}
+#else /* RIJNDAEL_AESNI */
+int
+rijndael_set_impl(int impl)
+{
+	return impl == RIJNDAEL_IMPL_AUTO || impl == RIJNDAEL_IMPL_TABLE
+	    ? RIJNDAEL_IMPL_TABLE : -1;
+}
+
+int
+rijndael_get_impl(void)
+{
+	return RIJNDAEL_IMPL_TABLE;
+}
+
+#define rijndael_setup_impl(ctx)
+#endif /* RIJNDAEL_AESNI */
+
 /* setup key context for encryption only */
 int
 rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
@@ -1243,6 +1312,7 @@ rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
 #ifdef WITH_AES_DECRYPT
 	ctx->enc_only = 1;
 #endif
+	rijndael_setup_impl(ctx);
 
 	return 0;
 }
@@ -1262,6 +1332,7 @@ rijndael_set_key(rijndael_ctx *ctx, const u_char *key, int bits)
 
 	ctx->Nr = rounds;
 	ctx->enc_only = 0;
+	rijndael_setup_impl(ctx);
 
 	return 0;
 }
@@ -1276,5 +1347,11 @@ rijndael_decrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 void
 rijndael_encrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
+#ifdef RIJNDAEL_AESNI
+	if (ctx->aesni) {
+		rijndaelEncryptAESNI(ctx->ek, ctx->Nr, src, dst);
+		return;
+	}
+#endif
 	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
 }
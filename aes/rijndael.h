@@ -28,6 +28,7 @@
 #ifndef __RIJNDAEL_H
 #define __RIJNDAEL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define AES_MAXKEYBITS	(256)
@@ -42,10 +43,25 @@ typedef uint8_t		aes_u8;
 typedef uint16_t	aes_u16;
 typedef uint32_t	aes_u32;
 
+/* AES-NI is available as alternative implementation on x86 with gcc
+ * or clang. Define RIJNDAEL_NO_AESNI to build the table version only. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(RIJNDAEL_NO_AESNI)
+#define RIJNDAEL_AESNI 1
+#endif
+
+/* implementations that can be selected with rijndael_set_impl() */
+#define RIJNDAEL_IMPL_AUTO	0	/* AES-NI if supported by the CPU */
+#define RIJNDAEL_IMPL_TABLE	1	/* portable T-table implementation */
+#define RIJNDAEL_IMPL_AESNI	2	/* AES-NI instructions */
+
 /*  The structure for key information */
 typedef struct {
 #ifdef WITH_AES_DECRYPT
 	int	enc_only;		/* context contains only encrypt schedule */
+#endif
+#ifdef RIJNDAEL_AESNI
+	int	aesni;			/* ek is in byte order for AES-NI */
 #endif
 	int	Nr;			/* key-length-dependent number of rounds */
 	aes_u32	ek[4*(AES_MAXROUNDS + 1)];	/* encrypt key schedule */
@@ -63,4 +79,26 @@ int	rijndaelKeySetupEnc(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], in
 int	rijndaelKeySetupDec(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
 void	rijndaelEncrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, const aes_u8 pt[16], aes_u8 ct[16]);
 
+/*
+ * Selects the implementation for contexts whose key is set afterwards.
+ * Returns the implementation in effect (RIJNDAEL_IMPL_TABLE or
+ * RIJNDAEL_IMPL_AESNI), or -1 if impl is not supported on this CPU.
+ */
+int	rijndael_set_impl(int impl);
+
+/*
+ * Returns the implementation in effect, selecting it as with
+ * RIJNDAEL_IMPL_AUTO if none has been set. Calling this once before
+ * keys are set from several threads avoids racing on the selection.
+ */
+int	rijndael_get_impl(void);
+
+#ifdef RIJNDAEL_AESNI
+int	rijndael_aesni_supported(void);
+void	rijndaelEncryptAESNI(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, const aes_u8 pt[16], aes_u8 ct[16]);
+void	rijndaelCCMAESNI(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr, int enc,
+	    const aes_u8 B[32], const aes_u8 A[16], aes_u8 *msg, size_t lm,
+	    aes_u8 T[16]);
+#endif
+
 #endif /* __RIJNDAEL_H */
@@ -8,7 +8,6 @@
 #include "dtls-log.h"
 
 static dtls_context_t the_dtls_context;
-static dtls_cipher_context_t cipher_context;
 static uint8_t lock_context = 0;
 /*---------------------------------------------------------------------------*/
 dtls_context_t *
@@ -30,15 +29,20 @@ dtls_context_release(dtls_context_t *context)
 }
 /*---------------------------------------------------------------------------*/
 /* In Contiki we know that there should be no threads accessing the
-   functions at the same time which means there is no need for locking */
-dtls_cipher_context_t *
-dtls_cipher_context_acquire(void)
+   key pools at the same time, they are refilled from the
+   application's idle loop */
+void
+dtls_pool_lock(void)
+{
+}
+/*---------------------------------------------------------------------------*/
+void
+dtls_pool_unlock(void)
 {
-  return &cipher_context;
 }
 /*---------------------------------------------------------------------------*/
 void
-dtls_cipher_context_release(dtls_cipher_context_t *c)
+dtls_pool_wakeup(void)
 {
 }
 /*---------------------------------------------------------------------------*/
@@ -55,6 +59,23 @@ dtls_session_equals(const session_t *a, const session_t *b)
     && uip_ipaddr_cmp(&((a)->addr),&(b->addr));
 }
 /*---------------------------------------------------------------------------*/
+uint32_t
+dtls_session_hash(const session_t *a)
+{
+  uint32_t h = 2166136261UL;
+  const uint8_t *p;
+  int i;
+
+  /* FNV-1a over address and port */
+  p = (const uint8_t *)&a->addr;
+  for(i = 0; i < sizeof(a->addr); i++) {
+    h = (h ^ p[i]) * 16777619UL;
+  }
+  h = (h ^ (a->port & 0xff)) * 16777619UL;
+  h = (h ^ (a->port >> 8)) * 16777619UL;
+  return h;
+}
+/*---------------------------------------------------------------------------*/
 void *
 dtls_session_get_address(const session_t *a)
 {
@@ -128,8 +128,7 @@ encrypt(rijndael_ctx *ctx, size_t L, unsigned long counter,
 	unsigned char *msg, size_t len,
 	unsigned char A[DTLS_CCM_BLOCKSIZE],
 	unsigned char S[DTLS_CCM_BLOCKSIZE]) {
-
-  static unsigned long counter_tmp;
+  unsigned long counter_tmp;
 
   SET_COUNTER(A, L, counter, counter_tmp);    
   rijndael_encrypt(ctx, A, S);
@@ -150,6 +149,41 @@ mac(rijndael_ctx *ctx,
 
 }
 
+#ifdef RIJNDAEL_AESNI
+/*
+ * DTLS uses CCM with M=8, L=3 and 13 bytes of additional data, so B0
+ * and the additional data always make up two blocks. For these
+ * parameters the AES-NI kernel computes the key stream for the next
+ * block while the CBC-MAC of the current block is computed.
+ */
+#define CCM_FAST_PATH(ctx,M,L,la) \
+  ((ctx)->aesni && (M) == 8 && (L) == 3 && (la) == 13)
+
+static void
+ccm_fast_path(rijndael_ctx *ctx, int enc,
+	      unsigned char nonce[DTLS_CCM_BLOCKSIZE],
+	      unsigned char *msg, size_t lm,
+	      const unsigned char *aad,
+	      unsigned char T[DTLS_CCM_BLOCKSIZE]) {
+  unsigned char A[DTLS_CCM_BLOCKSIZE];
+  unsigned char B[2 * DTLS_CCM_BLOCKSIZE];
+
+  block0(8, 3, 13, lm, nonce, B);
+  dtls_int_to_uint16(B + DTLS_CCM_BLOCKSIZE, 13);
+  memcpy(B + DTLS_CCM_BLOCKSIZE + 2, aad, 13);
+  B[2 * DTLS_CCM_BLOCKSIZE - 1] = 0;
+
+  A[0] = 3 - 1;
+  memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - 3 - 1);
+  memset(A + DTLS_CCM_BLOCKSIZE - 3, 0, 3);
+
+  rijndaelCCMAESNI(ctx->ek, ctx->Nr, enc, B, A, msg, lm, T);
+}
+#else /* RIJNDAEL_AESNI */
+#define CCM_FAST_PATH(ctx,M,L,la) 0
+#define ccm_fast_path(ctx,enc,nonce,msg,lm,aad,T)
+#endif /* RIJNDAEL_AESNI */
+
 long int
 dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L, 
 			 unsigned char nonce[DTLS_CCM_BLOCKSIZE], 
@@ -164,6 +198,12 @@ dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
   unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
 
+  if (CCM_FAST_PATH(ctx, M, L, la) && lm < (1 << 24)) {
+    ccm_fast_path(ctx, 1, nonce, msg, lm, aad, X);
+    memcpy(msg + lm, X, M);
+    return lm + M;
+  }
+
   len = lm;			/* save original length */
   /* create the initial authentication block B0 */
   block0(M, L, la, lm, nonce, B);
@@ -235,6 +275,11 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   len = lm;	      /* save original length */
   lm -= M;	      /* detract MAC size*/
 
+  if (CCM_FAST_PATH(ctx, M, L, la) && lm < (1 << 24)) {
+    ccm_fast_path(ctx, 0, nonce, msg, lm, aad, X);
+    return dtls_equals(X, msg + lm, M) ? (long int)lm : -1;
+  }
+
   /* create the initial authentication block B0 */
   block0(M, L, la, lm, nonce, B);
   add_auth_data(ctx, aad, la, B, X);
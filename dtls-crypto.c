@@ -43,12 +43,21 @@
 
 MEMB(handshake_storage, dtls_handshake_parameters_t, DTLS_HANDSHAKE_MAX);
 MEMB(security_storage, dtls_security_parameters_t, DTLS_SECURITY_MAX);
+#ifdef DTLS_ECC
+MEMB(crypto_job_storage, dtls_crypto_job_t, DTLS_CRYPTO_JOB_MAX);
+#endif /* DTLS_ECC */
 
 void
 dtls_crypto_init(void)
 {
+  /* choose the AES implementation before any thread sets a key */
+  rijndael_get_impl();
+
   memb_init(&handshake_storage);
   memb_init(&security_storage);
+#ifdef DTLS_ECC
+  memb_init(&crypto_job_storage);
+#endif /* DTLS_ECC */
 }
 
 static dtls_handshake_parameters_t *dtls_handshake_malloc() {
@@ -96,6 +105,21 @@ void dtls_handshake_free(dtls_handshake_parameters_t *handshake)
     return;
 
   netq_delete_all(&handshake->reorder_queue);
+#ifdef DTLS_ECC
+  if (handshake->crypto_job) {
+    if (handshake->crypto_job->done) {
+      dtls_crypto_job_free(handshake->crypto_job);
+    } else {
+      /* still running, dtls_crypto_job_complete() releases it */
+      handshake->crypto_job->handshake = NULL;
+    }
+  }
+  if (handshake->resume_msg)
+    netq_node_free(handshake->resume_msg);
+  netq_delete_all(&handshake->deferred);
+#endif /* DTLS_ECC */
+  memset(&handshake->keyx, 0, sizeof(handshake->keyx));
+  memset(&handshake->resumption, 0, sizeof(handshake->resumption));
   dtls_handshake_dealloc(handshake);
 }
 
@@ -134,13 +158,18 @@ dtls_p_hash(dtls_hashfunc_t h,
 	    const unsigned char *random2, size_t random2len,
 	    unsigned char *buf, size_t buflen) {
   dtls_hmac_context_t *hmac_a, *hmac_p;
+  dtls_hmac_key_t hmac_key;
 
   unsigned char A[DTLS_HMAC_DIGEST_SIZE];
   unsigned char tmp[DTLS_HMAC_DIGEST_SIZE];
   size_t dlen;			/* digest length */
   size_t len = 0;			/* result length */
 
-  hmac_a = dtls_hmac_new(key, keylen);
+  /* The key is hashed only once, each HMAC below starts from a copy
+   * of the keyed hash states. */
+  dtls_hmac_key_init(&hmac_key, key, keylen);
+
+  hmac_a = dtls_hmac_new_key(&hmac_key);
   if (!hmac_a)
     return 0;
 
@@ -151,14 +180,13 @@ dtls_p_hash(dtls_hashfunc_t h,
 
   dlen = dtls_hmac_finalize(hmac_a, A);
 
-  hmac_p = dtls_hmac_new(key, keylen);
+  hmac_p = dtls_hmac_new_key(&hmac_key);
   if (!hmac_p)
     goto error;
 
   while (len + dlen < buflen) {
 
-    /* FIXME: rewrite loop to avoid superflous call to dtls_hmac_init() */
-    dtls_hmac_init(hmac_p, key, keylen);
+    dtls_hmac_init_key(hmac_p, &hmac_key);
     dtls_hmac_update(hmac_p, A, dlen);
 
     HMAC_UPDATE_SEED(hmac_p, label, labellen);
@@ -170,12 +198,12 @@ dtls_p_hash(dtls_hashfunc_t h,
     buf += dlen;
 
     /* calculate A(i+1) */
-    dtls_hmac_init(hmac_a, key, keylen);
+    dtls_hmac_init_key(hmac_a, &hmac_key);
     dtls_hmac_update(hmac_a, A, dlen);
     dtls_hmac_finalize(hmac_a, A);
   }
 
-  dtls_hmac_init(hmac_p, key, keylen);
+  dtls_hmac_init_key(hmac_p, &hmac_key);
   dtls_hmac_update(hmac_p, A, dlen);
   
   HMAC_UPDATE_SEED(hmac_p, label, labellen);
@@ -188,6 +216,7 @@ dtls_p_hash(dtls_hashfunc_t h,
  error:
   dtls_hmac_free(hmac_a);
   dtls_hmac_free(hmac_p);
+  memset(&hmac_key, 0, sizeof(hmac_key));
 
   return buflen;
 }
@@ -388,6 +417,261 @@ dtls_ecdsa_generate_key(unsigned char *priv_key,
   dtls_ec_key_from_uint32(pub_y, key_size, pub_key_y);
 }
 
+/*
+ * A bounded pool of precomputed key material. Entries are generated by
+ * dtls_*_pool_refill() outside the lock and handed out exactly once.
+ * Refilling starts when the pool drops below the low watermark or a
+ * request found it empty, and stops at the high watermark.
+ */
+typedef struct {
+  unsigned char *entries;
+  size_t entry_size;
+  unsigned int size;		/**< capacity in entries */
+  unsigned int count;
+  unsigned int low, high;
+  int refilling;
+  unsigned long hits, misses;
+} dtls_pool_t;
+
+#define DTLS_POOL_INIT(Entries, Type, Size)				\
+  { (unsigned char *)(Entries), sizeof(Type), (Size), 0,		\
+    (Size) / 4, (Size), (Size) > 0, 0, 0 }
+
+static int
+pool_configure(dtls_pool_t *pool, unsigned int low, unsigned int high) {
+  int wakeup;
+
+  if (low > high || high > pool->size)
+    return -1;
+
+  dtls_pool_lock();
+  pool->low = low;
+  pool->high = high;
+  wakeup = pool->refilling = pool->count < pool->high;
+  dtls_pool_unlock();
+
+  if (wakeup)
+    dtls_pool_wakeup();
+  return 0;
+}
+
+static int
+pool_needs_refill(dtls_pool_t *pool) {
+  int result;
+
+  dtls_pool_lock();
+  result = pool->refilling;
+  dtls_pool_unlock();
+  return result;
+}
+
+/* Adds entry to the pool, returns 1 if it was stored. */
+static int
+pool_push(dtls_pool_t *pool, const void *entry) {
+  int stored = 0;
+
+  dtls_pool_lock();
+  if (pool->count < pool->high) {
+    memcpy(pool->entries + pool->count++ * pool->entry_size, entry,
+	   pool->entry_size);
+    stored = 1;
+  }
+  if (pool->count >= pool->high)
+    pool->refilling = 0;
+  dtls_pool_unlock();
+  return stored;
+}
+
+/* Takes an entry from the pool, returns 0 if the pool was empty. */
+static int
+pool_pop(dtls_pool_t *pool, void *entry) {
+  unsigned char *p;
+  int hit = 0, wakeup = 0;
+
+  dtls_pool_lock();
+  if (pool->count > 0) {
+    p = pool->entries + --pool->count * pool->entry_size;
+    memcpy(entry, p, pool->entry_size);
+    memset(p, 0, pool->entry_size);
+    pool->hits++;
+    hit = 1;
+
+    if (!pool->refilling && pool->count < pool->low)
+      wakeup = pool->refilling = 1;
+  } else {
+    pool->misses++;
+    if (!pool->refilling && pool->high > 0)
+      wakeup = pool->refilling = 1;
+  }
+  dtls_pool_unlock();
+
+  if (wakeup)
+    dtls_pool_wakeup();
+  return hit;
+}
+
+static void
+pool_get_stats(dtls_pool_t *pool, dtls_pool_stats_t *stats) {
+  dtls_pool_lock();
+  stats->available = pool->count;
+  stats->hits = pool->hits;
+  stats->misses = pool->misses;
+  dtls_pool_unlock();
+}
+
+static void
+pool_flush(dtls_pool_t *pool) {
+  dtls_pool_lock();
+  if (pool->entries)
+    memset(pool->entries, 0, pool->size * pool->entry_size);
+  pool->count = 0;
+  pool->refilling = pool->high > 0;
+  dtls_pool_unlock();
+}
+
+typedef struct {
+  unsigned char priv_key[DTLS_EC_KEY_SIZE];
+  unsigned char pub_key_x[DTLS_EC_KEY_SIZE];
+  unsigned char pub_key_y[DTLS_EC_KEY_SIZE];
+} dtls_ecdh_pool_entry_t;
+
+#if DTLS_ECDH_POOL_SIZE > 0
+static dtls_ecdh_pool_entry_t ecdh_pool_entries[DTLS_ECDH_POOL_SIZE];
+#define ECDH_POOL_ENTRIES ecdh_pool_entries
+#else /* DTLS_ECDH_POOL_SIZE > 0 */
+#define ECDH_POOL_ENTRIES NULL
+#endif /* DTLS_ECDH_POOL_SIZE > 0 */
+
+static dtls_pool_t ecdh_pool =
+  DTLS_POOL_INIT(ECDH_POOL_ENTRIES, dtls_ecdh_pool_entry_t, DTLS_ECDH_POOL_SIZE);
+
+int
+dtls_ecdh_pool_configure(unsigned int low_watermark,
+			 unsigned int high_watermark) {
+  return pool_configure(&ecdh_pool, low_watermark, high_watermark);
+}
+
+int
+dtls_ecdh_pool_needs_refill(void) {
+  return pool_needs_refill(&ecdh_pool);
+}
+
+int
+dtls_ecdh_pool_refill(unsigned int max) {
+  dtls_ecdh_pool_entry_t entry;
+  int generated = 0;
+
+  while (max-- && pool_needs_refill(&ecdh_pool)) {
+    dtls_ecdsa_generate_key(entry.priv_key, entry.pub_key_x, entry.pub_key_y,
+			    DTLS_EC_KEY_SIZE);
+    generated += pool_push(&ecdh_pool, &entry);
+  }
+  memset(&entry, 0, sizeof(entry));
+  return generated;
+}
+
+void
+dtls_ecdh_pool_get_stats(dtls_pool_stats_t *stats) {
+  pool_get_stats(&ecdh_pool, stats);
+}
+
+void
+dtls_ecdh_generate_ephemeral_key(unsigned char *priv_key,
+				 unsigned char *pub_key_x,
+				 unsigned char *pub_key_y,
+				 size_t key_size) {
+  dtls_ecdh_pool_entry_t entry;
+
+  if (key_size == DTLS_EC_KEY_SIZE && pool_pop(&ecdh_pool, &entry)) {
+    memcpy(priv_key, entry.priv_key, key_size);
+    memcpy(pub_key_x, entry.pub_key_x, key_size);
+    memcpy(pub_key_y, entry.pub_key_y, key_size);
+    memset(&entry, 0, sizeof(entry));
+    return;
+  }
+
+  dtls_ecdsa_generate_key(priv_key, pub_key_x, pub_key_y, key_size);
+}
+
+/* k^{-1} and r of an ECDSA signature, see ecc_ecdsa_presign() */
+typedef struct {
+  uint32_t k_inv[8];
+  uint32_t r[9];
+} dtls_ecdsa_presig_t;
+
+#if DTLS_ECDSA_PRESIG_POOL_SIZE > 0
+static dtls_ecdsa_presig_t presig_pool_entries[DTLS_ECDSA_PRESIG_POOL_SIZE];
+#define PRESIG_POOL_ENTRIES presig_pool_entries
+#else /* DTLS_ECDSA_PRESIG_POOL_SIZE > 0 */
+#define PRESIG_POOL_ENTRIES NULL
+#endif /* DTLS_ECDSA_PRESIG_POOL_SIZE > 0 */
+
+static dtls_pool_t presig_pool =
+  DTLS_POOL_INIT(PRESIG_POOL_ENTRIES, dtls_ecdsa_presig_t,
+		 DTLS_ECDSA_PRESIG_POOL_SIZE);
+
+static void
+dtls_ecdsa_presign(dtls_ecdsa_presig_t *presig) {
+  uint32_t k[8];
+
+  do {
+    do {
+      dtls_fill_random((uint8_t *)k, sizeof(k));
+    } while (!ecc_is_valid_key(k));
+  } while (ecc_ecdsa_presign(k, presig->k_inv, presig->r));
+
+  memset(k, 0, sizeof(k));
+}
+
+int
+dtls_ecdsa_presig_pool_configure(unsigned int low_watermark,
+				 unsigned int high_watermark) {
+  return pool_configure(&presig_pool, low_watermark, high_watermark);
+}
+
+int
+dtls_ecdsa_presig_pool_needs_refill(void) {
+  return pool_needs_refill(&presig_pool);
+}
+
+int
+dtls_ecdsa_presig_pool_refill(unsigned int max) {
+  dtls_ecdsa_presig_t presig;
+  int generated = 0;
+
+  while (max-- && pool_needs_refill(&presig_pool)) {
+    dtls_ecdsa_presign(&presig);
+    generated += pool_push(&presig_pool, &presig);
+  }
+  memset(&presig, 0, sizeof(presig));
+  return generated;
+}
+
+void
+dtls_ecdsa_presig_pool_get_stats(dtls_pool_stats_t *stats) {
+  pool_get_stats(&presig_pool, stats);
+}
+
+void
+dtls_crypto_pool_flush(void) {
+  pool_flush(&ecdh_pool);
+  pool_flush(&presig_pool);
+}
+
+void
+dtls_ecdsa_keyx_hash(const unsigned char *client_random, size_t client_random_size,
+		     const unsigned char *server_random, size_t server_random_size,
+		     const unsigned char *keyx_params, size_t keyx_params_size,
+		     unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE]) {
+  dtls_hash_ctx data;
+
+  dtls_hash_init(&data);
+  dtls_hash_update(&data, client_random, client_random_size);
+  dtls_hash_update(&data, server_random, server_random_size);
+  dtls_hash_update(&data, keyx_params, keyx_params_size);
+  dtls_hash_finalize(sha256hash, &data);
+}
+
 /* rfc4492#section-5.4 */
 void
 dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
@@ -396,14 +680,20 @@ dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
   int ret;
   uint32_t priv[8];
   uint32_t hash[8];
-  uint32_t rand[8];
-  
+  dtls_ecdsa_presig_t presig;
+
   dtls_ec_key_to_uint32(priv_key, key_size, priv);
   dtls_ec_key_to_uint32(sign_hash, sign_hash_size, hash);
   do {
-    dtls_fill_random((uint8_t *)rand, key_size);
-    ret = ecc_ecdsa_sign_hash(priv, hash, rand, point_r, point_s);
+    /* k * G is the expensive part, take it from the pool if possible */
+    if (!pool_pop(&presig_pool, &presig))
+      dtls_ecdsa_presign(&presig);
+    memcpy(point_r, presig.r, sizeof(presig.r));
+    ret = ecc_ecdsa_sign_presigned(priv, hash, presig.k_inv, presig.r, point_s);
   } while (ret);
+
+  memset(&presig, 0, sizeof(presig));
+  memset(priv, 0, sizeof(priv));
 }
 
 void
@@ -412,15 +702,11 @@ dtls_ecdsa_create_sig(const unsigned char *priv_key, size_t key_size,
 		      const unsigned char *server_random, size_t server_random_size,
 		      const unsigned char *keyx_params, size_t keyx_params_size,
 		      uint32_t point_r[9], uint32_t point_s[9]) {
-  dtls_hash_ctx data;
   unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
 
-  dtls_hash_init(&data);
-  dtls_hash_update(&data, client_random, client_random_size);
-  dtls_hash_update(&data, server_random, server_random_size);
-  dtls_hash_update(&data, keyx_params, keyx_params_size);
-  dtls_hash_finalize(sha256hash, &data);
-  
+  dtls_ecdsa_keyx_hash(client_random, client_random_size,
+		       server_random, server_random_size,
+		       keyx_params, keyx_params_size, sha256hash);
   dtls_ecdsa_create_sig_hash(priv_key, key_size, sha256hash,
 			     sizeof(sha256hash), point_r, point_s);
 }
@@ -453,18 +739,73 @@ dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
 		      const unsigned char *server_random, size_t server_random_size,
 		      const unsigned char *keyx_params, size_t keyx_params_size,
 		      unsigned char *result_r, unsigned char *result_s) {
-  dtls_hash_ctx data;
   unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
-  
-  dtls_hash_init(&data);
-  dtls_hash_update(&data, client_random, client_random_size);
-  dtls_hash_update(&data, server_random, server_random_size);
-  dtls_hash_update(&data, keyx_params, keyx_params_size);
-  dtls_hash_finalize(sha256hash, &data);
 
+  dtls_ecdsa_keyx_hash(client_random, client_random_size,
+		       server_random, server_random_size,
+		       keyx_params, keyx_params_size, sha256hash);
   return dtls_ecdsa_verify_sig_hash(pub_key_x, pub_key_y, key_size, sha256hash,
 				    sizeof(sha256hash), result_r, result_s);
 }
+
+dtls_crypto_job_t *
+dtls_crypto_job_new(dtls_crypto_job_type_t type) {
+  dtls_crypto_job_t *job;
+
+  job = memb_alloc(&crypto_job_storage);
+  if (!job) {
+    dtls_debug("no crypto job available\n");
+    return NULL;
+  }
+  memset(job, 0, sizeof(*job));
+  job->type = type;
+  return job;
+}
+
+void
+dtls_crypto_job_free(dtls_crypto_job_t *job) {
+  if (job) {
+    memset(job, 0, sizeof(*job));
+    memb_free(&crypto_job_storage, job);
+  }
+}
+
+void
+dtls_crypto_job_run(dtls_crypto_job_t *job) {
+  switch (job->type) {
+  case DTLS_CRYPTO_JOB_VERIFY:
+    job->result = dtls_ecdsa_verify_sig_hash(job->u.verify.pub_x,
+					     job->u.verify.pub_y,
+					     DTLS_EC_KEY_SIZE,
+					     job->u.verify.hash,
+					     sizeof(job->u.verify.hash),
+					     job->u.verify.r, job->u.verify.s);
+    break;
+  case DTLS_CRYPTO_JOB_SIGN:
+    dtls_ecdsa_create_sig_hash(job->u.sign.priv_key, DTLS_EC_KEY_SIZE,
+			       job->u.sign.hash, sizeof(job->u.sign.hash),
+			       job->u.sign.point_r, job->u.sign.point_s);
+    memset(job->u.sign.priv_key, 0, sizeof(job->u.sign.priv_key));
+    job->result = 0;
+    break;
+  case DTLS_CRYPTO_JOB_ECDH:
+    if (job->u.ecdh.generate)
+      dtls_ecdh_generate_ephemeral_key(job->u.ecdh.own_priv,
+				       job->u.ecdh.own_pub_x,
+				       job->u.ecdh.own_pub_y,
+				       DTLS_EC_KEY_SIZE);
+    job->result =
+      dtls_ecdh_pre_master_secret(job->u.ecdh.own_priv,
+				  job->u.ecdh.other_pub_x,
+				  job->u.ecdh.other_pub_y,
+				  DTLS_EC_KEY_SIZE,
+				  job->u.ecdh.pre_master_secret,
+				  sizeof(job->u.ecdh.pre_master_secret));
+    break;
+  default:
+    job->result = -1;
+  }
+}
 #endif /* DTLS_ECC */
 
 int 
@@ -475,9 +816,9 @@ dtls_encrypt(const unsigned char *src, size_t length,
 	     const unsigned char *aad, size_t la)
 {
   int ret;
-  dtls_cipher_context_t *ctx = dtls_cipher_context_acquire();
+  aes128_ccm_t ctx;
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
+  ret = rijndael_set_key_enc_only(&ctx.ctx, key, 8 * keylen);
   if (ret < 0) {
     /* cleanup everything in case the key has the wrong size */
     dtls_warn("cannot set rijndael key\n");
@@ -486,10 +827,10 @@ dtls_encrypt(const unsigned char *src, size_t length,
 
   if (src != buf)
     memmove(buf, src, length);
-  ret = dtls_ccm_encrypt(&ctx->data, src, length, buf, nounce, aad, la);
+  ret = dtls_ccm_encrypt(&ctx, src, length, buf, nounce, aad, la);
 
 error:
-  dtls_cipher_context_release(ctx);
+  memset(&ctx, 0, sizeof(ctx));
   return ret;
 }
 
@@ -501,9 +842,9 @@ dtls_decrypt(const unsigned char *src, size_t length,
 	     const unsigned char *aad, size_t la)
 {
   int ret;
-  dtls_cipher_context_t *ctx = dtls_cipher_context_acquire();
+  aes128_ccm_t ctx;
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
+  ret = rijndael_set_key_enc_only(&ctx.ctx, key, 8 * keylen);
   if (ret < 0) {
     /* cleanup everything in case the key has the wrong size */
     dtls_warn("cannot set rijndael key\n");
@@ -512,9 +853,67 @@ dtls_decrypt(const unsigned char *src, size_t length,
 
   if (src != buf)
     memmove(buf, src, length);
-  ret = dtls_ccm_decrypt(&ctx->data, src, length, buf, nounce, aad, la);
+  ret = dtls_ccm_decrypt(&ctx, src, length, buf, nounce, aad, la);
 
 error:
-  dtls_cipher_context_release(ctx);
+  memset(&ctx, 0, sizeof(ctx));
   return ret;
 }
+
+int
+dtls_security_init_ciphers(dtls_security_parameters_t *security, int role)
+{
+  if (rijndael_set_key_enc_only(&security->write_cipher.ctx,
+				dtls_kb_local_write_key(security, role),
+				8 * dtls_kb_key_size(security, role)) < 0 ||
+      rijndael_set_key_enc_only(&security->read_cipher.ctx,
+				dtls_kb_remote_write_key(security, role),
+				8 * dtls_kb_key_size(security, role)) < 0) {
+    dtls_warn("cannot set rijndael key\n");
+    return -1;
+  }
+
+  memset(security->write_nonce, 0, DTLS_CCM_BLOCKSIZE);
+  memcpy(security->write_nonce, dtls_kb_local_iv(security, role),
+	 dtls_kb_iv_size(security, role));
+  memset(security->read_nonce, 0, DTLS_CCM_BLOCKSIZE);
+  memcpy(security->read_nonce, dtls_kb_remote_iv(security, role),
+	 dtls_kb_iv_size(security, role));
+  return 0;
+}
+
+int
+dtls_encrypt_params(dtls_security_parameters_t *security,
+		    const unsigned char *src, size_t length,
+		    unsigned char *buf,
+		    const unsigned char *nonce_explicit,
+		    const unsigned char *aad, size_t la)
+{
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+
+  memcpy(nonce, security->write_nonce, DTLS_CCM_BLOCKSIZE);
+  memcpy(nonce + DTLS_IV_LENGTH, nonce_explicit, 8);
+
+  if (src != buf)
+    memmove(buf, src, length);
+  return dtls_ccm_encrypt(&security->write_cipher, src, length, buf,
+			  nonce, aad, la);
+}
+
+int
+dtls_decrypt_params(dtls_security_parameters_t *security,
+		    const unsigned char *src, size_t length,
+		    unsigned char *buf,
+		    const unsigned char *nonce_explicit,
+		    const unsigned char *aad, size_t la)
+{
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+
+  memcpy(nonce, security->read_nonce, DTLS_CCM_BLOCKSIZE);
+  memcpy(nonce + DTLS_IV_LENGTH, nonce_explicit, 8);
+
+  if (src != buf)
+    memmove(buf, src, length);
+  return dtls_ccm_decrypt(&security->read_cipher, src, length, buf,
+			  nonce, aad, la);
+}
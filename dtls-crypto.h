@@ -61,17 +61,13 @@ typedef struct {
   rijndael_ctx ctx;		       /**< AES-128 encryption context */
 } aes128_ccm_t;
 
-typedef struct dtls_cipher_context_t {
-  /** numeric identifier of this cipher suite in host byte order. */
-  aes128_ccm_t data;		/**< The crypto context */
-} dtls_cipher_context_t;
-
 typedef struct {
   uint8_t own_eph_priv[32];
   uint8_t other_eph_pub_x[32];
   uint8_t other_eph_pub_y[32];
   uint8_t other_pub_x[32];
   uint8_t other_pub_y[32];
+  uint8_t pre_master_secret[32]; /**< set if computed by a crypto job */
 } dtls_handshake_parameters_ecdsa_t;
 
 /* This is the maximal supported length of the psk client identity and psk
@@ -100,9 +96,49 @@ typedef struct {
    * access the components of the key block.
    */
   uint8_t key_block[MAX_KEYBLOCK_LENGTH];
+
+  /**
+   * Expanded AES key schedules for both directions of the record
+   * layer. These are set up once by dtls_security_init_ciphers() when
+   * the key block has been derived, so that encrypting or decrypting
+   * a record does not need any key setup.
+   */
+  aes128_ccm_t write_cipher;	/**< local write key */
+  aes128_ccm_t read_cipher;	/**< remote write key */
+
+  /**
+   * CCM nonce templates with the implicit part (the salt taken from
+   * the client or server write IV) already in place. Only the
+   * explicit nonce (epoch and sequence number) needs to be filled in
+   * for each record.
+   */
+  uint8_t write_nonce[DTLS_CCM_BLOCKSIZE];
+  uint8_t read_nonce[DTLS_CCM_BLOCKSIZE];
 } dtls_security_parameters_t;
 
+/** Length of the session IDs issued by a server. */
+#define DTLS_SESSION_ID_LENGTH 32
+
+/**
+ * The state that a session can be resumed from with an abbreviated
+ * handshake (RFC 5246, Section 7.3).
+ */
+typedef struct {
+  uint8_t id_length;		/**< length of id, 0 if not resumable */
+  uint8_t id[DTLS_SESSION_ID_LENGTH]; /**< the session ID */
+  dtls_cipher_t cipher;		/**< the session's cipher suite */
+  /** the session's master secret */
+  uint8_t master_secret[DTLS_MASTER_SECRET_LENGTH];
+#if DTLS_SESSION_TICKETS
+  uint32_t ticket_lifetime;	/**< lifetime hint of ticket in seconds */
+  uint16_t ticket_length;	/**< length of ticket, 0 if none */
+  /** the session ticket issued by the server (RFC 5077) */
+  uint8_t ticket[DTLS_SESSION_TICKET_MAX_LENGTH];
+#endif /* DTLS_SESSION_TICKETS */
+} dtls_resumption_t;
+
 struct netq_t;
+struct dtls_crypto_job_t;
 
 typedef struct {
   union {
@@ -119,6 +155,23 @@ typedef struct {
   dtls_compression_t compression;		/**< compression method */
   dtls_cipher_t cipher;		/**< cipher type */
   unsigned int do_client_auth:1;
+  unsigned int have_pre_master_secret:1; /**< keyx.ecdsa.pre_master_secret is set */
+  unsigned int abbreviated:1;	/**< the session in resumption is resumed */
+  /** server: send a NewSessionTicket, client: the server announced one */
+  unsigned int send_ticket:1;
+  unsigned int new_ticket:1;	/**< client: a NewSessionTicket was received */
+  /** The session that is offered (client) or issued (server) for
+   * resumption. */
+  dtls_resumption_t resumption;
+#ifdef DTLS_ECC
+  /** The crypto job the handshake waits for, or whose result is to
+   * be picked up. */
+  struct dtls_crypto_job_t *crypto_job;
+  /** The handshake message to handle again once crypto_job is done. */
+  struct netq_t *resume_msg;
+  /** Records received while crypto_job was running. */
+  struct netq_t *deferred;
+#endif /* DTLS_ECC */
   union {
 #ifdef DTLS_ECC
     dtls_handshake_parameters_ecdsa_t ecdsa;
@@ -283,6 +336,57 @@ int dtls_decrypt(const unsigned char *src, size_t length,
 		 unsigned char *key, size_t keylen,
 		 const unsigned char *a_data, size_t a_data_length);
 
+/**
+ * Expands the local and remote write keys from the key block of
+ * \p security into the record layer cipher contexts and prepares the
+ * nonce templates. This must be called whenever the key block of
+ * \p security has been (re-)computed.
+ *
+ * \param security The security parameters with a valid key block.
+ * \param role     The local role, i.e. \c DTLS_CLIENT or \c DTLS_SERVER.
+ * \return \c 0 on success, less than zero otherwise.
+ */
+int dtls_security_init_ciphers(dtls_security_parameters_t *security,
+			       int role);
+
+/**
+ * Encrypts a record payload with the write key of \p security that
+ * has been expanded by dtls_security_init_ciphers(). The CCM nonce is
+ * the write nonce template of \p security completed with the 8 bytes
+ * of \p nonce_explicit. \p src and \p buf may be identical. The
+ * caller must ensure that \p buf provides room for \p length plus
+ * the 8 bytes MAC.
+ *
+ * \param security       The security parameters to use.
+ * \param src            The data to encrypt.
+ * \param length         The actual size of of \p src.
+ * \param buf            The result buffer.
+ * \param nonce_explicit The explicit nonce (epoch and sequence number).
+ * \param aad            additional data for AEAD ciphers
+ * \param aad_length     actual size of @p aad
+ * \return The number of encrypted bytes on success, less than zero
+ *         otherwise.
+ */
+int dtls_encrypt_params(dtls_security_parameters_t *security,
+			const unsigned char *src, size_t length,
+			unsigned char *buf,
+			const unsigned char *nonce_explicit,
+			const unsigned char *aad, size_t aad_length);
+
+/**
+ * Decrypts and verifies a record payload with the read key of
+ * \p security. See dtls_encrypt_params() for the meaning of the
+ * parameters. \p src and \p buf may overlap.
+ *
+ * \return Less than zero on error, the number of decrypted bytes
+ *         otherwise.
+ */
+int dtls_decrypt_params(dtls_security_parameters_t *security,
+			const unsigned char *src, size_t length,
+			unsigned char *buf,
+			const unsigned char *nonce_explicit,
+			const unsigned char *aad, size_t aad_length);
+
 /* helper functions */
 
 /** 
@@ -312,6 +416,92 @@ void dtls_ecdsa_generate_key(unsigned char *priv_key,
 			     unsigned char *pub_key_y,
 			     size_t key_size);
 
+/** Counters of a pool of precomputed key material. */
+typedef struct {
+  unsigned int available;	/**< entries ready in the pool */
+  unsigned long hits;		/**< entries taken from the pool */
+  unsigned long misses;		/**< entries computed on demand */
+} dtls_pool_stats_t;
+
+/**
+ * Returns an ephemeral ECDH key pair for a handshake. The pair is
+ * taken from the pool of precomputed pairs if there is one, otherwise
+ * it is generated with dtls_ecdsa_generate_key(). Each pair is handed
+ * out only once.
+ */
+void dtls_ecdh_generate_ephemeral_key(unsigned char *priv_key,
+				      unsigned char *pub_key_x,
+				      unsigned char *pub_key_y,
+				      size_t key_size);
+
+/**
+ * Sets the watermarks of the ephemeral ECDH key pool. Refilling
+ * starts when fewer than @p low_watermark pairs are left (or a
+ * handshake found the pool empty) and stops at @p high_watermark
+ * pairs. The pool holds at most DTLS_ECDH_POOL_SIZE pairs, a high
+ * watermark of 0 disables it.
+ *
+ * @return 0 on success, -1 if the watermarks are out of range.
+ */
+int dtls_ecdh_pool_configure(unsigned int low_watermark,
+			     unsigned int high_watermark);
+
+/**
+ * Generates up to @p max key pairs for the ephemeral ECDH key pool
+ * while it needs refilling. This is meant to be called from an idle
+ * loop or a background thread, see dtls_pool_wakeup().
+ *
+ * @return The number of key pairs added to the pool.
+ */
+int dtls_ecdh_pool_refill(unsigned int max);
+
+/** Returns 1 if the ephemeral ECDH key pool should be refilled. */
+int dtls_ecdh_pool_needs_refill(void);
+
+/** Copies the counters of the ephemeral ECDH key pool to @p stats. */
+void dtls_ecdh_pool_get_stats(dtls_pool_stats_t *stats);
+
+/**
+ * Sets the watermarks of the ECDSA presignature pool, see
+ * dtls_ecdh_pool_configure(). The pool holds k^-1 and r = (k * G).x
+ * for random k, so that dtls_ecdsa_create_sig_hash() only has to do a
+ * few multiplications mod n. It holds at most DTLS_ECDSA_PRESIG_POOL_SIZE
+ * entries.
+ *
+ * @return 0 on success, -1 if the watermarks are out of range.
+ */
+int dtls_ecdsa_presig_pool_configure(unsigned int low_watermark,
+				     unsigned int high_watermark);
+
+/**
+ * Computes up to @p max presignatures for the ECDSA presignature pool
+ * while it needs refilling.
+ *
+ * @return The number of presignatures added to the pool.
+ */
+int dtls_ecdsa_presig_pool_refill(unsigned int max);
+
+/** Returns 1 if the ECDSA presignature pool should be refilled. */
+int dtls_ecdsa_presig_pool_needs_refill(void);
+
+/** Copies the counters of the ECDSA presignature pool to @p stats. */
+void dtls_ecdsa_presig_pool_get_stats(dtls_pool_stats_t *stats);
+
+/**
+ * Wipes all precomputed key material. A process that forks must call
+ * this in the child, the entries would be used twice otherwise.
+ */
+void dtls_crypto_pool_flush(void);
+
+/**
+ * Computes the hash that is signed in a ServerKeyExchange message,
+ * i.e. SHA-256 over both randoms and the key exchange parameters.
+ */
+void dtls_ecdsa_keyx_hash(const unsigned char *client_random, size_t client_random_size,
+			  const unsigned char *server_random, size_t server_random_size,
+			  const unsigned char *keyx_params, size_t keyx_params_size,
+			  unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE]);
+
 void dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
 				const unsigned char *sign_hash, size_t sign_hash_size,
 				uint32_t point_r[9], uint32_t point_s[9]);
@@ -337,6 +527,72 @@ int dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
 int dtls_ec_key_from_uint32_asn1(const uint32_t *key, size_t key_size,
 				 unsigned char *buf);
 
+#ifdef DTLS_ECC
+/** The operation carried out by a dtls_crypto_job_t. */
+typedef enum {
+  DTLS_CRYPTO_JOB_VERIFY,	/**< check an ECDSA signature */
+  DTLS_CRYPTO_JOB_SIGN,		/**< create an ephemeral key and sign it */
+  DTLS_CRYPTO_JOB_ECDH		/**< compute the ECDH pre master secret */
+} dtls_crypto_job_type_t;
+
+/**
+ * An expensive ECC operation of a handshake that may be run outside
+ * of dtls_handle_message(), see the submit_crypto_job() callback. A
+ * job holds copies of all its inputs, so dtls_crypto_job_run() may be
+ * called on any thread.
+ */
+typedef struct dtls_crypto_job_t {
+  dtls_crypto_job_type_t type;
+  int result;			/**< less than zero if the operation failed */
+  unsigned int done:1;		/**< the result is available */
+  dtls_handshake_parameters_t *handshake; /**< NULL if the handshake is gone */
+  struct dtls_peer_t *peer;	/**< the peer that owns handshake */
+  union {
+    struct {
+      uint8_t pub_x[DTLS_EC_KEY_SIZE];	/**< the signer's public key */
+      uint8_t pub_y[DTLS_EC_KEY_SIZE];
+      uint8_t hash[DTLS_HMAC_DIGEST_SIZE];
+      uint8_t r[DTLS_EC_KEY_SIZE];
+      uint8_t s[DTLS_EC_KEY_SIZE];
+    } verify;
+    struct {
+      uint8_t priv_key[DTLS_EC_KEY_SIZE]; /**< the long-term key */
+      uint8_t hash[DTLS_HMAC_DIGEST_SIZE];
+      uint8_t eph_pub_x[DTLS_EC_KEY_SIZE]; /**< the signed ephemeral key */
+      uint8_t eph_pub_y[DTLS_EC_KEY_SIZE];
+      uint32_t point_r[9];		  /**< the signature */
+      uint32_t point_s[9];
+    } sign;
+    struct {
+      unsigned int generate:1;	/**< create own ephemeral key pair first */
+      uint8_t own_priv[DTLS_EC_KEY_SIZE];
+      uint8_t own_pub_x[DTLS_EC_KEY_SIZE];
+      uint8_t own_pub_y[DTLS_EC_KEY_SIZE];
+      uint8_t other_pub_x[DTLS_EC_KEY_SIZE];
+      uint8_t other_pub_y[DTLS_EC_KEY_SIZE];
+      uint8_t pre_master_secret[DTLS_EC_KEY_SIZE];
+    } ecdh;
+  } u;
+} dtls_crypto_job_t;
+
+/**
+ * Allocates a crypto job of the given @p type, or returns NULL if
+ * all DTLS_CRYPTO_JOB_MAX jobs are in use.
+ */
+dtls_crypto_job_t *dtls_crypto_job_new(dtls_crypto_job_type_t type);
+
+/** Wipes and releases @p job. */
+void dtls_crypto_job_free(dtls_crypto_job_t *job);
+
+/**
+ * Carries out the operation of @p job and sets its result. This
+ * touches neither the DTLS context nor the peer and may be called from
+ * any thread. Afterwards, the job must be passed back with
+ * dtls_crypto_job_complete().
+ */
+void dtls_crypto_job_run(dtls_crypto_job_t *job);
+#endif /* DTLS_ECC */
+
 
 dtls_handshake_parameters_t *dtls_handshake_new(void);
 
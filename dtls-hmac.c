@@ -71,31 +71,73 @@ dtls_hmac_new(const unsigned char *key, size_t klen) {
   return ctx;
 }
 
-void
-dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen) {
-  int i;
+dtls_hmac_context_t *
+dtls_hmac_new_key(const dtls_hmac_key_t *key) {
+  dtls_hmac_context_t *ctx;
 
-  assert(ctx);
+  ctx = dtls_hmac_context_new();
+  if (ctx) 
+    dtls_hmac_init_key(ctx, key);
 
-  memset(ctx, 0, sizeof(dtls_hmac_context_t));
+  return ctx;
+}
+
+/* Hashes the padded key with ipad into @p inner and with opad into
+ * @p outer. */
+static void
+dtls_hmac_setup(dtls_hash_ctx *inner, dtls_hash_ctx *outer,
+		const unsigned char *key, size_t klen) {
+  unsigned char pad[DTLS_HMAC_BLOCKSIZE];
+  int i;
+
+  memset(pad, 0, sizeof(pad));
 
   if (klen > DTLS_HMAC_BLOCKSIZE) {
-    dtls_hash_init(&ctx->data);
-    dtls_hash_update(&ctx->data, key, klen);
-    dtls_hash_finalize(ctx->pad, &ctx->data);
+    dtls_hash_init(inner);
+    dtls_hash_update(inner, key, klen);
+    dtls_hash_finalize(pad, inner);
   } else
-    memcpy(ctx->pad, key, klen);
+    memcpy(pad, key, klen);
 
   /* create ipad: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x36;
+    pad[i] ^= 0x36;
 
-  dtls_hash_init(&ctx->data);
-  dtls_hmac_update(ctx, ctx->pad, DTLS_HMAC_BLOCKSIZE);
+  dtls_hash_init(inner);
+  dtls_hash_update(inner, pad, DTLS_HMAC_BLOCKSIZE);
 
   /* create opad by xor-ing pad[i] with 0x36 ^ 0x5C: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x6A;
+    pad[i] ^= 0x6A;
+
+  dtls_hash_init(outer);
+  dtls_hash_update(outer, pad, DTLS_HMAC_BLOCKSIZE);
+
+  memset(pad, 0, sizeof(pad));
+}
+
+void
+dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen) {
+  assert(ctx);
+
+  dtls_hmac_setup(&ctx->data, &ctx->outer, key, klen);
+}
+
+void
+dtls_hmac_key_init(dtls_hmac_key_t *key,
+		   const unsigned char *secret, size_t klen) {
+  assert(key);
+
+  dtls_hmac_setup(&key->inner, &key->outer, secret, klen);
+}
+
+void
+dtls_hmac_init_key(dtls_hmac_context_t *ctx, const dtls_hmac_key_t *key) {
+  assert(ctx);
+  assert(key);
+
+  ctx->data = key->inner;
+  ctx->outer = key->outer;
 }
 
 void
@@ -114,8 +156,7 @@ dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result) {
   
   len = dtls_hash_finalize(buf, &ctx->data);
 
-  dtls_hash_init(&ctx->data);
-  dtls_hash_update(&ctx->data, ctx->pad, DTLS_HMAC_BLOCKSIZE);
+  ctx->data = ctx->outer;
   dtls_hash_update(&ctx->data, buf, len);
 
   len = dtls_hash_finalize(result, &ctx->data);
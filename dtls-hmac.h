@@ -70,18 +70,49 @@ typedef enum {
   HASH_SHA256=4, HASH_SHA384=5, HASH_SHA512=6
 } dtls_hashfunc_t;
 
+/**
+ * A keyed HMAC snapshot: the hash states after the padded key has
+ * been hashed with ipad and opad. It is created once per key with
+ * dtls_hmac_key_init() and copied into an HMAC context with
+ * dtls_hmac_init_key(), which saves hashing the two key blocks for
+ * every MAC that is computed with the same key.
+ */
+typedef struct {
+  dtls_hash_ctx inner;		/**< hash state after key ^ ipad */
+  dtls_hash_ctx outer;		/**< hash state after key ^ opad */
+} dtls_hmac_key_t;
+
 /**
  * Context for HMAC generation. This object is initialized with
- * dtls_hmac_init() and must be passed to dtls_hmac_update() and
- * dtls_hmac_finalize(). Once, finalized, the component \c H is
- * invalid and must be initialized again with dtls_hmac_init() before
+ * dtls_hmac_init() or dtls_hmac_init_key() and must be passed to
+ * dtls_hmac_update() and dtls_hmac_finalize(). Once, finalized, the
+ * component \c data is invalid and must be initialized again before
  * the structure can be used again. 
  */
 typedef struct {
-  unsigned char pad[DTLS_HMAC_BLOCKSIZE]; /**< ipad and opad storage */
-  dtls_hash_ctx data;		          /**< context for hash function */
+  dtls_hash_ctx data;		/**< context for hash function */
+  dtls_hash_ctx outer;		/**< hash state after key ^ opad */
 } dtls_hmac_context_t;
 
+/**
+ * Creates the keyed snapshot @p key for the secret @p secret.
+ *
+ * @param key    The snapshot to initialize.
+ * @param secret The secret key.
+ * @param klen   The length of @p secret.
+ */
+void dtls_hmac_key_init(dtls_hmac_key_t *key,
+			const unsigned char *secret, size_t klen);
+
+/**
+ * Initializes an existing HMAC context from the keyed snapshot @p key.
+ * This is a copy of the hash states only, @p key can be used again.
+ *
+ * @param ctx The HMAC context to initialize.
+ * @param key The snapshot created by dtls_hmac_key_init().
+ */
+void dtls_hmac_init_key(dtls_hmac_context_t *ctx, const dtls_hmac_key_t *key);
+
 /**
  * Initializes an existing HMAC context. 
  *
@@ -103,9 +134,19 @@ void dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t k
  */
 dtls_hmac_context_t *dtls_hmac_new(const unsigned char *key, size_t klen);
 
+/**
+ * Allocates a new HMAC context that is initialized from the keyed
+ * snapshot @p key. Note that this function allocates new storage
+ * that must be released by dtls_hmac_free().
+ *
+ * @param key The snapshot created by dtls_hmac_key_init().
+ * @return A new dtls_hmac_context_t object or @c NULL on error
+ */
+dtls_hmac_context_t *dtls_hmac_new_key(const dtls_hmac_key_t *key);
+
 /**
  * Releases the storage for @p ctx that has been allocated by
- * dtls_hmac_new().
+ * dtls_hmac_new() or dtls_hmac_new_key().
  *
  * @param ctx The dtls_hmac_context_t to free. 
  */
@@ -17,8 +17,13 @@
 
 #include "tinydtls.h"
 #include "dtls-peer.h"
+#include "netq.h"
 #include "lib/memb.h"
 
+#ifndef DTLS_PEERS_NOHASH
+#include <stdlib.h>
+#endif /* DTLS_PEERS_NOHASH */
+
 /* Log configuration */
 #define LOG_MODULE "dtls-peer"
 #define LOG_LEVEL  LOG_LEVEL_DTLS
@@ -39,6 +44,14 @@ dtls_malloc_peer() {
 
 void
 dtls_free_peer(dtls_peer_t *peer) {
+  netq_t *node;
+
+  /* the retransmissions of a peer that has been detached from its
+   * context, see dtls_detach_peer() */
+  while ((node = peer->sendqueue)) {
+    peer->sendqueue = node->peer_next;
+    netq_node_free(node);
+  }
   dtls_handshake_free(peer->handshake_params);
   dtls_security_free(peer->security_params[0]);
   dtls_security_free(peer->security_params[1]);
@@ -53,6 +66,9 @@ dtls_new_peer(const session_t *session) {
   if (peer) {
     memset(peer, 0, sizeof(dtls_peer_t));
     memcpy(&peer->session, session, sizeof(session_t));
+#ifndef DTLS_PEERS_NOHASH
+    peer->hash = dtls_session_hash(session);
+#endif /* DTLS_PEERS_NOHASH */
     peer->security_params[0] = dtls_security_new();
 
     if (!peer->security_params[0]) {
@@ -65,3 +81,106 @@ dtls_new_peer(const session_t *session) {
 
   return peer;
 }
+
+#ifndef DTLS_PEERS_NOHASH
+/* Puts peer into the first free slot of its probe sequence. The table
+ * must have at least one free slot. */
+static void
+peer_table_put(dtls_peer_t **slots, size_t size, dtls_peer_t *peer) {
+  size_t i = peer->hash & (size - 1);
+
+  while (slots[i])
+    i = (i + 1) & (size - 1);
+  slots[i] = peer;
+}
+
+static int
+peer_table_resize(dtls_peer_table_t *table, size_t size) {
+  dtls_peer_t **slots;
+  size_t i;
+
+  slots = calloc(size, sizeof(dtls_peer_t *));
+  if (!slots) {
+    dtls_crit("cannot resize peer table to %zu slots\n", size);
+    return -1;
+  }
+
+  for (i = 0; i < table->size; i++) {
+    if (table->slots[i])
+      peer_table_put(slots, size, table->slots[i]);
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->size = size;
+  return 0;
+}
+
+dtls_peer_t *
+dtls_peer_table_find(const dtls_peer_table_t *table, const session_t *session) {
+  uint32_t hash;
+  size_t i;
+
+  if (!table->count)
+    return NULL;
+
+  hash = dtls_session_hash(session);
+  for (i = hash & (table->size - 1); table->slots[i];
+       i = (i + 1) & (table->size - 1)) {
+    if (table->slots[i]->hash == hash &&
+	dtls_session_equals(&table->slots[i]->session, session))
+      return table->slots[i];
+  }
+  return NULL;
+}
+
+int
+dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  /* keep the load factor below 3/4 */
+  if (4 * (table->count + 1) > 3 * table->size &&
+      peer_table_resize(table, table->size
+			? 2 * table->size : DTLS_PEER_TABLE_MIN_SIZE) < 0)
+    return -1;
+
+  peer_table_put(table->slots, table->size, peer);
+  table->count++;
+  return 0;
+}
+
+void
+dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  size_t mask = table->size - 1;
+  size_t i, j, k;
+
+  if (!table->count)
+    return;
+
+  for (i = peer->hash & mask; table->slots[i] != peer; i = (i + 1) & mask) {
+    if (!table->slots[i])
+      return;
+  }
+
+  /* Shift back the following entries of the probe sequence that
+   * would otherwise become unreachable. An entry at j may fill the
+   * gap at i unless its home slot k lies cyclically in (i, j]. */
+  for (j = (i + 1) & mask; table->slots[j]; j = (j + 1) & mask) {
+    k = table->slots[j]->hash & mask;
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+    table->slots[i] = table->slots[j];
+    i = j;
+  }
+  table->slots[i] = NULL;
+  table->count--;
+
+  /* shrink when less than 1/8 of the slots are in use */
+  if (table->size > DTLS_PEER_TABLE_MIN_SIZE && 8 * table->count < table->size)
+    peer_table_resize(table, table->size / 2);
+}
+
+void
+dtls_peer_table_free(dtls_peer_table_t *table) {
+  free(table->slots);
+  memset(table, 0, sizeof(dtls_peer_table_t));
+}
+#endif /* DTLS_PEERS_NOHASH */
@@ -29,6 +29,8 @@
 
 typedef enum { DTLS_CLIENT=0, DTLS_SERVER } dtls_peer_type;
 
+struct netq_t;
+
 /** 
  * Holds security parameters, local state and the transport address
  * for each peer. */
@@ -36,14 +38,55 @@ typedef struct dtls_peer_t {
   struct dtls_peer_t *next;
 
   session_t session;	     /**< peer address and local interface */
+#ifndef DTLS_PEERS_NOHASH
+  uint32_t hash;	     /**< dtls_session_hash() of session */
+#endif /* DTLS_PEERS_NOHASH */
 
   dtls_peer_type role;       /**< denotes if this host is DTLS_CLIENT or DTLS_SERVER */
   dtls_state_t state;        /**< DTLS engine state */
+  uint8_t abbreviated;       /**< the last handshake has resumed a session */
 
   dtls_security_parameters_t *security_params[2];
   dtls_handshake_parameters_t *handshake_params;
+
+  struct netq_t *sendqueue;  /**< this peer's packets in the retransmission queue */
 } dtls_peer_t;
 
+#ifndef DTLS_PEERS_NOHASH
+/**
+ * Hash-indexed table of peers with open addressing and linear
+ * probing. The number of slots is always a power of two and adjusted
+ * to the number of peers when entries are added or removed.
+ */
+typedef struct {
+  dtls_peer_t **slots;	     /**< NULL for an empty slot */
+  size_t size;		     /**< number of slots */
+  size_t count;		     /**< number of peers in the table */
+} dtls_peer_table_t;
+
+/**
+ * Returns the peer for @p session from @p table or NULL if there is
+ * no such peer.
+ */
+dtls_peer_t *dtls_peer_table_find(const dtls_peer_table_t *table,
+				  const session_t *session);
+
+/**
+ * Adds @p peer to @p table. This function returns @c 0 on success,
+ * or a negative value if the table could not be grown.
+ */
+int dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer);
+
+/** Removes @p peer from @p table if present. */
+void dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer);
+
+/**
+ * Releases the slots of @p table. The peers in the table are not
+ * freed.
+ */
+void dtls_peer_table_free(dtls_peer_table_t *table);
+#endif /* DTLS_PEERS_NOHASH */
+
 static inline dtls_security_parameters_t *dtls_security_params_epoch(dtls_peer_t *peer, uint16_t epoch)
 {
   if (peer->security_params[0] && peer->security_params[0]->epoch == epoch) {
@@ -124,4 +167,13 @@ static inline int dtls_peer_is_connected(const dtls_peer_t *peer) {
   return peer->state == DTLS_STATE_CONNECTED;
 }
 
+/**
+ * Checks if the last handshake with @p peer has been an abbreviated
+ * one that resumed a session. This function returns @c 1 if so, or
+ * @c 0 after a full handshake.
+ */
+static inline int dtls_peer_is_resumed(const dtls_peer_t *peer) {
+  return peer->abbreviated;
+}
+
 #endif /* _DTLS_PEER_H_ */
@@ -13,8 +13,16 @@ int dtls_fill_random(uint8_t *buffer, size_t len);
 void dtls_set_retransmit_timer(dtls_context_t *context, unsigned int);
 void dtls_support_init(void);
 
-dtls_cipher_context_t *dtls_cipher_context_acquire(void);
-void dtls_cipher_context_release(dtls_cipher_context_t *ctx);
+/**
+ * Protect the pools of precomputed key material in dtls-crypto.c.
+ * dtls_pool_wakeup() is called without the lock held when a pool
+ * needs to be refilled, e.g. to wake up a thread that calls
+ * dtls_ecdh_pool_refill(). All three may be no-ops on platforms
+ * without threads.
+ */
+void dtls_pool_lock(void);
+void dtls_pool_unlock(void);
+void dtls_pool_wakeup(void);
 
 /**
  * Resets the given session_t object @p sess to its default
@@ -31,6 +39,14 @@ void dtls_session_init(session_t *sess);
  */
 int dtls_session_equals(const session_t *a, const session_t *b);
 
+/**
+ * Computes a hash value over the addressing information of @p a.
+ * Sessions that are equal according to dtls_session_equals() must
+ * yield the same hash value. As the value indexes the peer table,
+ * remote peers should not be able to predict it.
+ */
+uint32_t dtls_session_hash(const session_t *a);
+
 /**
  * Get the address information for this session as an opaque (void *)
  */
@@ -52,6 +52,7 @@
 #define dtls_get_sequence_number(H) dtls_uint48_to_ulong((H)->sequence_number)
 #define dtls_get_fragment_length(H) dtls_uint24_to_int((H)->fragment_length)
 
+#ifdef DTLS_PEERS_NOHASH
 static void
 delete_peer(dtls_peer_t **peers, dtls_peer_t *peer)
 {
@@ -82,12 +83,18 @@ add_peer(dtls_peer_t **peers, dtls_peer_t *peer)
   peer->next = *peers;
   *peers = peer;
 }
+#endif /* DTLS_PEERS_NOHASH */
 
 #define DTLS_RH_LENGTH sizeof(dtls_record_header_t)
 #define DTLS_HS_LENGTH sizeof(dtls_handshake_header_t)
 #define DTLS_CH_LENGTH sizeof(dtls_client_hello_t) /* no variable length fields! */
 #define DTLS_COOKIE_LENGTH_MAX 32
-#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_COOKIE_LENGTH_MAX + 12 + 26
+#if DTLS_SESSION_TICKETS
+#define DTLS_CH_TICKET_LENGTH_MAX (4 + DTLS_SESSION_TICKET_MAX_LENGTH)
+#else /* DTLS_SESSION_TICKETS */
+#define DTLS_CH_TICKET_LENGTH_MAX 0
+#endif /* DTLS_SESSION_TICKETS */
+#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_SESSION_ID_LENGTH + DTLS_COOKIE_LENGTH_MAX + 12 + 26 + DTLS_CH_TICKET_LENGTH_MAX
 #define DTLS_HV_LENGTH sizeof(dtls_hello_verify_t)
 #define DTLS_SH_LENGTH (2 + DTLS_RANDOM_LENGTH + 1 + 2 + 1)
 #define DTLS_CE_LENGTH (3 + 3 + 27 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE)
@@ -202,6 +209,7 @@ dtls_peer_t *
 dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
   dtls_peer_t *p;
   if(ctx && session) {
+#ifdef DTLS_PEERS_NOHASH
     p = ctx->peers;
     while(p) {
       if (dtls_session_equals(&(p->session), session)) {
@@ -209,6 +217,12 @@ dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
       }
       p = p->next;
     }
+#else /* DTLS_PEERS_NOHASH */
+    p = dtls_peer_table_find(&ctx->peers, session);
+    if (p) {
+      return p;
+    }
+#endif /* DTLS_PEERS_NOHASH */
   }
   return NULL;
 }
@@ -221,11 +235,27 @@ dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
 static int
 dtls_add_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
   if(peer) {
+#ifdef DTLS_PEERS_NOHASH
     add_peer(&ctx->peers, peer);
+#else /* DTLS_PEERS_NOHASH */
+    return dtls_peer_table_add(&ctx->peers, peer);
+#endif /* DTLS_PEERS_NOHASH */
   }
   return 0;
 }
 
+/** Removes @p peer from the list of peers in @p ctx. */
+static void
+dtls_remove_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+#ifdef DTLS_PEERS_NOHASH
+  delete_peer(&ctx->peers, peer);
+#else /* DTLS_PEERS_NOHASH */
+  if(peer) {
+    dtls_peer_table_remove(&ctx->peers, peer);
+  }
+#endif /* DTLS_PEERS_NOHASH */
+}
+
 int
 dtls_write(struct dtls_context_t *ctx, 
 	   session_t *dst, uint8_t *buf, size_t len) {
@@ -252,7 +282,7 @@ dtls_write(struct dtls_context_t *ctx,
 }
 
 static int
-dtls_get_cookie(uint8_t *msg, size_t msglen, uint8_t **cookie) {
+dtls_get_cookie(const uint8_t *msg, size_t msglen, const uint8_t **cookie) {
   /* To access the cookie, we have to determine the session id's
    * length and skip the whole thing. */
   if (msglen < DTLS_HS_LENGTH + DTLS_CH_LENGTH + sizeof(uint8_t))
@@ -276,13 +306,126 @@ dtls_get_cookie(uint8_t *msg, size_t msglen, uint8_t **cookie) {
   return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
 }
 
+/* The tags of the cookie keys are read by dtls_cookie_check() on
+ * other threads while the thread that uses the context replaces the
+ * keys. Like a sequence lock, a tag is cleared before its key is
+ * written and set with release semantics afterwards, and a reader
+ * checks the tag again after it has copied the key. Without the
+ * atomic builtins, tinydtls is expected to run on a single thread. */
+#if defined(__GNUC__) || defined(__clang__)
+#define dtls_tag_load(P)     __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define dtls_tag_store(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+#define dtls_tag_recheck(P) \
+  (__atomic_thread_fence(__ATOMIC_ACQUIRE), \
+   __atomic_load_n((P), __ATOMIC_RELAXED))
+#define dtls_tag_clear(P) \
+  do { \
+    __atomic_store_n((P), 0, __ATOMIC_RELAXED); \
+    __atomic_thread_fence(__ATOMIC_RELEASE); \
+  } while (0)
+#else /* __GNUC__ */
+#define dtls_tag_load(P)     (*(P))
+#define dtls_tag_store(P, V) (*(P) = (V))
+#define dtls_tag_recheck(P)  (*(P))
+#define dtls_tag_clear(P)    (*(P) = 0)
+#endif /* __GNUC__ */
+
+/* Returns the cookie secret generation at time @p now. */
+static inline unsigned long
+dtls_cookie_generation(dtls_tick_t now) {
+#if DTLS_COOKIE_SECRET_LIFETIME > 0
+  return now / (DTLS_COOKIE_SECRET_LIFETIME * (dtls_tick_t)DTLS_TICKS_PER_SECOND);
+#else /* DTLS_COOKIE_SECRET_LIFETIME > 0 */
+  (void)now;
+  return 0;
+#endif /* DTLS_COOKIE_SECRET_LIFETIME > 0 */
+}
+
+/* Derives the secret of @p generation from the cookie secret of @p ctx
+ * and stores the keyed HMAC state in @p key. */
+static void
+dtls_cookie_key_init(const dtls_context_t *ctx, unsigned long generation,
+		     dtls_hmac_key_t *key) {
+  dtls_hmac_context_t hmac_context;
+  unsigned char buf[DTLS_HMAC_MAX];
+  uint8_t g[sizeof(uint32_t)];
+  size_t len;
+
+  dtls_int_to_uint32(g, generation);
+  dtls_hmac_init(&hmac_context, ctx->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_hmac_update(&hmac_context, g, sizeof(g));
+  len = dtls_hmac_finalize(&hmac_context, buf);
+
+  dtls_hmac_key_init(key, buf, len);
+  memset(buf, 0, sizeof(buf));
+}
+
+/* Prepares the keys of the previous, the current and the next cookie
+ * secret generation if the generation has changed or @p force is
+ * set. Only the thread that uses @p ctx may call this, while
+ * dtls_cookie_check() reads the keys at the same time. */
+static void
+dtls_update_cookie_keys(dtls_context_t *ctx, int force) {
+  dtls_cookie_key_t *slot;
+  unsigned long generation, g;
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  generation = dtls_cookie_generation(now);
+  if (!force && generation == ctx->cookie_generation)
+    return;
+
+  for (g = generation ? generation - 1 : 0; g <= generation + 1; g++) {
+    slot = &ctx->cookie_keys[g % DTLS_COOKIE_KEYS];
+    if (force || slot->tag != g + 1) {
+      dtls_tag_clear(&slot->tag);
+      dtls_cookie_key_init(ctx, g, &slot->key);
+      dtls_tag_store(&slot->tag, g + 1);
+    }
+  }
+  ctx->cookie_generation = generation;
+}
+
+#if DTLS_SESSION_TICKETS
+static void dtls_update_ticket_key(dtls_context_t *ctx);
+#endif /* DTLS_SESSION_TICKETS */
+
+/* Updates the time-dependent keys of @p ctx before datagrams are
+ * handled. */
+static void
+dtls_update_keys(dtls_context_t *ctx) {
+  dtls_update_cookie_keys(ctx, 0);
+#if DTLS_SESSION_TICKETS
+  dtls_update_ticket_key(ctx);
+#endif /* DTLS_SESSION_TICKETS */
+}
+
+/* Copies the key of cookie secret @p generation to @p tmp. If the
+ * thread that uses @p ctx has not prepared it yet, or replaces it
+ * meanwhile, the key is derived instead. */
+static const dtls_hmac_key_t *
+dtls_cookie_key(const dtls_context_t *ctx, unsigned long generation,
+		dtls_hmac_key_t *tmp) {
+  const dtls_cookie_key_t *slot;
+
+  slot = &ctx->cookie_keys[generation % DTLS_COOKIE_KEYS];
+  if (dtls_tag_load(&slot->tag) == generation + 1) {
+    memcpy(tmp, &slot->key, sizeof(dtls_hmac_key_t));
+    if (dtls_tag_recheck(&slot->tag) == generation + 1)
+      return tmp;
+  }
+
+  dtls_cookie_key_init(ctx, generation, tmp);
+  return tmp;
+}
+
 static int
-dtls_create_cookie(dtls_context_t *ctx, 
-		   session_t *session,
-		   uint8_t *msg, size_t msglen,
+dtls_create_cookie(const dtls_hmac_key_t *key,
+		   const session_t *session,
+		   const uint8_t *msg, size_t msglen,
 		   uint8_t *cookie, int *clen) {
   unsigned char buf[DTLS_HMAC_MAX];
-  size_t len, e;
+  size_t len, e, fraglen;
 
   /* create cookie with HMAC-SHA256 over:
    * - SECRET
@@ -298,10 +441,19 @@ dtls_create_cookie(dtls_context_t *ctx,
    * created by dtls_hmac_new() to separate storage space for cookie
    * creation from storage that is used in real sessions. Note that
    * the buffer size must fit with the default hash algorithm (see
-   * implementation of dtls_hmac_context_new()). */
+   * implementation of dtls_hmac_context_new()). The context starts
+   * from the snapshot keyed with the generation's secret, so that
+   * the secret is not hashed again for every ClientHello. */
 
   dtls_hmac_context_t hmac_context;
-  dtls_hmac_init(&hmac_context, ctx->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+
+  fraglen = dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg));
+  if (msglen < DTLS_HS_LENGTH + sizeof(dtls_client_hello_t) + sizeof(uint8_t)
+      || fraglen + DTLS_HS_LENGTH > msglen)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  msglen = fraglen + DTLS_HS_LENGTH;
+
+  dtls_hmac_init_key(&hmac_context, key);
 
   dtls_hmac_update(&hmac_context,
 		   (unsigned char *)dtls_session_get_address(session),
@@ -323,8 +475,7 @@ dtls_create_cookie(dtls_context_t *ctx,
     return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
 
   dtls_hmac_update(&hmac_context, 
-		   msg + DTLS_HS_LENGTH + e,
-		   dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg)) - e);
+		   msg + DTLS_HS_LENGTH + e, fraglen - e);
 
   len = dtls_hmac_finalize(&hmac_context, buf);
 
@@ -353,7 +504,7 @@ static char const content_types[] = {
  * 
  */
 static unsigned int
-is_record(uint8_t *msg, size_t msglen) {
+is_record(const uint8_t *msg, size_t msglen) {
   unsigned int rlen = 0;
 
   if (msglen >= DTLS_RH_LENGTH	/* FIXME allow empty records? */
@@ -448,7 +599,7 @@ dtls_set_handshake_header(uint8_t type, dtls_peer_t *peer,
 }
 
 /** only one compression method is currently defined */
-static uint8_t compression_methods[] = {
+static const uint8_t compression_methods[] = {
   TLS_COMPRESSION_NULL
 };
 
@@ -617,11 +768,68 @@ static char *dtls_handshake_type_to_name(int type)
     return "client_key_exchange";
   case DTLS_HT_FINISHED:
     return "finished";
+  case DTLS_HT_NEW_SESSION_TICKET:
+    return "new_session_ticket";
   default:
     return "unknown";
   }
 }
 
+/**
+ * Creates the key block of @p security from @p master_secret and the
+ * randoms of @p handshake. The randoms are replaced by the master
+ * secret, which is needed for the Finished messages.
+ */
+static int
+derive_key_block(dtls_handshake_parameters_t *handshake,
+		 dtls_peer_t *peer,
+		 dtls_security_parameters_t *security,
+		 const uint8_t *master_secret,
+		 dtls_peer_type role) {
+  /* create key_block from master_secret
+   * key_block = PRF(master_secret,
+                    "key expansion" + tmp.random.server + tmp.random.client) */
+
+  dtls_prf(master_secret,
+	   DTLS_MASTER_SECRET_LENGTH,
+	   PRF_LABEL(key), PRF_LABEL_SIZE(key),
+	   handshake->tmp.random.server, DTLS_RANDOM_LENGTH,
+	   handshake->tmp.random.client, DTLS_RANDOM_LENGTH,
+	   security->key_block,
+	   dtls_kb_size(security, role));
+
+  memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
+  dtls_debug_keyblock(security, peer);
+
+  if (dtls_security_init_ciphers(security, peer->role) < 0)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  security->cipher = handshake->cipher;
+  security->compression = handshake->compression;
+  security->rseq = 0;
+
+  return 0;
+}
+
+/**
+ * Calculate the key block of an abbreviated handshake from the master
+ * secret of the resumed session.
+ */
+static int
+calculate_resumed_key_block(dtls_handshake_parameters_t *handshake,
+			    dtls_peer_t *peer,
+			    dtls_peer_type role) {
+  dtls_security_parameters_t *security;
+
+  security = dtls_security_params_next(peer);
+  if (!security) {
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+
+  return derive_key_block(handshake, peer, security,
+			  handshake->resumption.master_secret, role);
+}
+
 /**
  * Calculate the pre master secret and after that calculate the master-secret.
  */
@@ -678,6 +886,13 @@ calculate_key_block(dtls_context_t *ctx,
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
   case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8: {
+    if (handshake->have_pre_master_secret) {
+      /* already computed by a crypto job */
+      pre_master_len = sizeof(handshake->keyx.ecdsa.pre_master_secret);
+      memcpy(pre_master_secret, handshake->keyx.ecdsa.pre_master_secret,
+	     pre_master_len);
+      break;
+    }
     pre_master_len = dtls_ecdh_pre_master_secret(handshake->keyx.ecdsa.own_eph_priv,
 						 handshake->keyx.ecdsa.other_eph_pub_x,
 						 handshake->keyx.ecdsa.other_eph_pub_y,
@@ -709,26 +924,7 @@ calculate_key_block(dtls_context_t *ctx,
 
   dtls_debug_dump("master_secret", master_secret, DTLS_MASTER_SECRET_LENGTH);
 
-  /* create key_block from master_secret
-   * key_block = PRF(master_secret,
-                    "key expansion" + tmp.random.server + tmp.random.client) */
-
-  dtls_prf(master_secret,
-	   DTLS_MASTER_SECRET_LENGTH,
-	   PRF_LABEL(key), PRF_LABEL_SIZE(key),
-	   handshake->tmp.random.server, DTLS_RANDOM_LENGTH,
-	   handshake->tmp.random.client, DTLS_RANDOM_LENGTH,
-	   security->key_block,
-	   dtls_kb_size(security, role));
-
-  memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
-  dtls_debug_keyblock(security, peer);
-
-  security->cipher = handshake->cipher;
-  security->compression = handshake->compression;
-  security->rseq = 0;
-
-  return 0;
+  return derive_key_block(handshake, peer, security, master_secret, role);
 }
 
 /* TODO: add a generic method which iterates over a list and searches for a specific key */
@@ -895,6 +1091,13 @@ dtls_check_tls_extension(dtls_peer_t *peer,
 	 */
 	dtls_info("skipped encrypt-then-mac extension\n");
 	break;
+      case TLS_EXT_SESSION_TICKET:
+	/* The ticket of a ClientHello is handled by
+	 * dtls_update_parameters(). In a ServerHello, the extension
+	 * announces a NewSessionTicket (RFC 5077, Section 3.2). */
+	if (!client_hello)
+	  handshake->send_ticket = 1;
+	break;
       default:
         dtls_warn("unsupported tls extension: %i\n", i);
         break;
@@ -924,6 +1127,238 @@ error:
   }
 }
 
+#if DTLS_SESSION_CACHE_SIZE > 0
+static inline size_t
+dtls_session_cache_index(const uint8_t *id) {
+  /* the session IDs are random, so any of their bytes make a hash */
+  return dtls_uint32_to_int(id) & (DTLS_SESSION_CACHE_SIZE - 1);
+}
+
+/**
+ * Returns the session in the cache of @p ctx with the given ID, or
+ * NULL if there is none or it has expired.
+ */
+static const dtls_resumption_t *
+dtls_session_cache_find(const dtls_context_t *ctx,
+			const uint8_t *id, size_t id_length) {
+  const dtls_session_cache_entry_t *entry;
+  dtls_tick_t now;
+  size_t index, n;
+
+  if (id_length != DTLS_SESSION_ID_LENGTH)
+    return NULL;
+
+  dtls_ticks(&now);
+  index = dtls_session_cache_index(id);
+  for (n = 0; n < DTLS_SESSION_CACHE_PROBES; n++) {
+    entry = &ctx->session_cache[(index + n) & (DTLS_SESSION_CACHE_SIZE - 1)];
+    if (entry->expires > now &&
+	memcmp(entry->state.id, id, DTLS_SESSION_ID_LENGTH) == 0)
+      return &entry->state;
+  }
+  return NULL;
+}
+
+/**
+ * Adds @p state to the cache of @p ctx. Of the slots that are searched
+ * for its ID, the session replaces the one that expires first, i.e.
+ * an unused or expired entry or else the oldest session.
+ */
+static void
+dtls_session_cache_add(dtls_context_t *ctx, const dtls_resumption_t *state) {
+  dtls_session_cache_entry_t *entry, *victim = NULL;
+  dtls_tick_t now;
+  size_t index, n;
+
+  dtls_ticks(&now);
+  index = dtls_session_cache_index(state->id);
+  for (n = 0; n < DTLS_SESSION_CACHE_PROBES; n++) {
+    entry = &ctx->session_cache[(index + n) & (DTLS_SESSION_CACHE_SIZE - 1)];
+    if (!victim || entry->expires < victim->expires)
+      victim = entry;
+  }
+
+  victim->state = *state;
+  victim->expires = now + (dtls_tick_t)DTLS_SESSION_CACHE_LIFETIME * DTLS_TICKS_PER_SECOND;
+}
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+#if DTLS_SESSION_TICKETS
+/* The session tickets issued by this server consist of a random CCM
+ * nonce, the encrypted cipher suite and master secret, and the MAC. */
+#define DTLS_TICKET_STATE_LENGTH (sizeof(uint16_t) + DTLS_MASTER_SECRET_LENGTH)
+#define DTLS_TICKET_LENGTH \
+  (DTLS_CCM_NONCE_SIZE + DTLS_TICKET_STATE_LENGTH + 8)
+
+/* Derives the key that follows the ticket key @p key into @p next. */
+static void
+dtls_ticket_key_next(const unsigned char *key, unsigned char *next) {
+  static const unsigned char label[] = "ticket key";
+  dtls_hmac_context_t hmac_context;
+  unsigned char buf[DTLS_HMAC_MAX];
+
+  dtls_hmac_init(&hmac_context, key, DTLS_TICKET_KEY_LENGTH);
+  dtls_hmac_update(&hmac_context, label, sizeof(label) - 1);
+  dtls_hmac_finalize(&hmac_context, buf);
+
+  memcpy(next, buf, DTLS_TICKET_KEY_LENGTH);
+  memset(buf, 0, sizeof(buf));
+}
+
+/* Replaces the ticket key of @p ctx for each lifetime that has passed
+ * since it has been set. A new random key is used, so that a leaked
+ * key does not reveal the tickets issued later. Only a key that has
+ * been set with dtls_set_ticket_key() is replaced by its successor,
+ * so that the contexts that share it keep accepting each other's
+ * tickets. */
+static void
+dtls_update_ticket_key(dtls_context_t *ctx) {
+#if DTLS_SESSION_TICKET_LIFETIME > 0
+  const dtls_tick_t lifetime =
+    DTLS_SESSION_TICKET_LIFETIME * (dtls_tick_t)DTLS_TICKS_PER_SECOND;
+  unsigned char *next;
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  while (now - ctx->ticket_key_age >= lifetime) {
+    next = ctx->ticket_keys[ctx->ticket_key ^ 1];
+    if (ctx->ticket_key_shared)
+      dtls_ticket_key_next(ctx->ticket_keys[ctx->ticket_key], next);
+    else if (!dtls_fill_random(next, DTLS_TICKET_KEY_LENGTH))
+      return;
+    ctx->ticket_key ^= 1;
+    ctx->ticket_key_age += lifetime;
+  }
+#else /* DTLS_SESSION_TICKET_LIFETIME > 0 */
+  (void)ctx;
+#endif /* DTLS_SESSION_TICKET_LIFETIME > 0 */
+}
+
+/**
+ * Encrypts @p cipher and @p master_secret with the current ticket key
+ * of @p ctx into @p ticket, which must have space for
+ * DTLS_TICKET_LENGTH bytes.
+ *
+ * @return The length of the ticket, or a value less than zero on error.
+ */
+static int
+dtls_seal_ticket(dtls_context_t *ctx, dtls_cipher_t cipher,
+		 const uint8_t *master_secret, uint8_t *ticket) {
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  uint8_t *state = ticket + DTLS_CCM_NONCE_SIZE;
+  int res;
+
+  if (!dtls_fill_random(ticket, DTLS_CCM_NONCE_SIZE))
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  memset(nonce, 0, sizeof(nonce));
+  memcpy(nonce, ticket, DTLS_CCM_NONCE_SIZE);
+
+  dtls_int_to_uint16(state, cipher);
+  memcpy(state + sizeof(uint16_t), master_secret, DTLS_MASTER_SECRET_LENGTH);
+
+  res = dtls_encrypt(state, DTLS_TICKET_STATE_LENGTH, state, nonce,
+		     ctx->ticket_keys[ctx->ticket_key], DTLS_TICKET_KEY_LENGTH,
+		     NULL, 0);
+  if (res < 0) {
+    memset(state, 0, DTLS_TICKET_STATE_LENGTH);
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+  return DTLS_CCM_NONCE_SIZE + res;
+}
+
+/**
+ * Decrypts the cipher suite and the master secret from @p ticket into
+ * @p state. Besides the current and the previous ticket key of @p ctx,
+ * the successor of a shared key is tried, in case that the ticket
+ * comes from a context that has replaced the same key a bit earlier.
+ *
+ * @return @c 0 on success, or a value less than zero if the ticket is
+ *  not valid.
+ */
+static int
+dtls_open_ticket(dtls_context_t *ctx, const uint8_t *ticket, size_t length,
+		 dtls_resumption_t *state) {
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  unsigned char next[DTLS_TICKET_KEY_LENGTH];
+  uint8_t buf[DTLS_TICKET_LENGTH];
+  unsigned char *key;
+  int i, res = -1;
+
+  if (length != DTLS_TICKET_LENGTH)
+    return -1;
+
+  memset(nonce, 0, sizeof(nonce));
+  memcpy(nonce, ticket, DTLS_CCM_NONCE_SIZE);
+
+  for (i = 0; i < (ctx->ticket_key_shared ? 3 : 2) && res < 0; i++) {
+    if (i < 2) {
+      key = ctx->ticket_keys[ctx->ticket_key ^ i];
+    } else {
+      dtls_ticket_key_next(ctx->ticket_keys[ctx->ticket_key], next);
+      key = next;
+    }
+    res = dtls_decrypt(ticket + DTLS_CCM_NONCE_SIZE,
+		       length - DTLS_CCM_NONCE_SIZE, buf, nonce,
+		       key, DTLS_TICKET_KEY_LENGTH, NULL, 0);
+  }
+  memset(next, 0, sizeof(next));
+
+  if (res == DTLS_TICKET_STATE_LENGTH) {
+    state->cipher = dtls_uint16_to_int(buf);
+    memcpy(state->master_secret, buf + sizeof(uint16_t),
+	   DTLS_MASTER_SECRET_LENGTH);
+  }
+  memset(buf, 0, sizeof(buf));
+  return res == DTLS_TICKET_STATE_LENGTH ? 0 : -1;
+}
+
+/**
+ * Returns the extension of the given @p type from the list of
+ * extensions in @p data, or NULL if there is none. The length of the
+ * extension is stored in @p length.
+ */
+static const uint8_t *
+dtls_find_extension(const uint8_t *data, size_t data_length,
+		    uint16_t type, size_t *length) {
+  size_t len;
+
+  if (data_length < sizeof(uint16_t))
+    return NULL;
+
+  len = dtls_uint16_to_int(data);
+  data += sizeof(uint16_t);
+  data_length -= sizeof(uint16_t);
+  if (len < data_length)
+    data_length = len;
+
+  while (data_length >= 2 * sizeof(uint16_t)) {
+    len = dtls_uint16_to_int(data + sizeof(uint16_t));
+    if (data_length - 2 * sizeof(uint16_t) < len)
+      return NULL;
+
+    if (dtls_uint16_to_int(data) == type) {
+      *length = len;
+      return data + 2 * sizeof(uint16_t);
+    }
+    data += 2 * sizeof(uint16_t) + len;
+    data_length -= 2 * sizeof(uint16_t) + len;
+  }
+  return NULL;
+}
+
+/* Returns 1 if the list of cipher suites in @p data contains @p cipher. */
+static int
+dtls_offers_cipher(const uint8_t *data, size_t data_length,
+		   dtls_cipher_t cipher) {
+  for (; data_length >= sizeof(uint16_t); data_length -= sizeof(uint16_t)) {
+    if (dtls_uint16_to_int(data) == cipher)
+      return 1;
+    data += sizeof(uint16_t);
+  }
+  return 0;
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 /**
  * Parses the ClientHello from the client and updates the internal handshake
  * parameters with the new data for the given \p peer. When the ClientHello
@@ -942,8 +1377,14 @@ dtls_update_parameters(dtls_context_t *ctx,
 		       uint8_t *data, size_t data_length) {
   int i, j;
   int ok;
+  dtls_cipher_t cipher;
   dtls_handshake_parameters_t *config;
   dtls_security_parameters_t *security;
+  const dtls_resumption_t *cached = NULL;
+#if DTLS_SESSION_TICKETS
+  const uint8_t *session_id, *ciphers, *ticket;
+  size_t ciphers_length, ticket_length;
+#endif /* DTLS_SESSION_TICKETS */
 
   if (!peer) {
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
@@ -966,6 +1407,17 @@ dtls_update_parameters(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
+#if DTLS_SESSION_CACHE_SIZE > 0
+  /* look up the session that the client offers for resumption */
+  if (data_length > dtls_uint8_to_int(data))
+    cached = dtls_session_cache_find(ctx, data + sizeof(uint8_t),
+				     dtls_uint8_to_int(data));
+#endif /* DTLS_SESSION_CACHE_SIZE */
+  config->abbreviated = 0;
+#if DTLS_SESSION_TICKETS
+  session_id = data;		/* checked by SKIP_VAR_FIELD */
+#endif /* DTLS_SESSION_TICKETS */
+
   /* Caution: SKIP_VAR_FIELD may jump to error: */
   SKIP_VAR_FIELD(data, data_length);	/* skip session id */
   SKIP_VAR_FIELD(data, data_length);	/* skip cookie */
@@ -986,13 +1438,27 @@ dtls_update_parameters(dtls_context_t *ctx,
 
   data += sizeof(uint16_t);
   data_length -= sizeof(uint16_t) + i;
+#if DTLS_SESSION_TICKETS
+  ciphers = data;
+  ciphers_length = i;
+#endif /* DTLS_SESSION_TICKETS */
 
+  /* Take the first known cipher, unless the cipher of the cached
+   * session is offered as well. */
   ok = 0;
-  while (i && !ok) {
-    config->cipher = dtls_uint16_to_int(data);
-    ok = known_cipher(ctx, config->cipher, 0);
+  while (i > 1 && !config->abbreviated) {
+    cipher = dtls_uint16_to_int(data);
     i -= sizeof(uint16_t);
     data += sizeof(uint16_t);
+
+    if (!known_cipher(ctx, cipher, 0) || (ok && cipher != cached->cipher))
+      continue;
+
+    config->cipher = cipher;
+    config->abbreviated = cached && cipher == cached->cipher;
+    ok = 1;
+    if (!cached)
+      break;
   }
 
   /* skip remaining ciphers */
@@ -1005,6 +1471,17 @@ dtls_update_parameters(dtls_context_t *ctx,
     goto error;
   }
 
+  if (config->abbreviated) {
+    dtls_debug("resume session\n");
+    config->resumption = *cached;
+  }
+#if DTLS_SESSION_CACHE_SIZE > 0
+  else if (dtls_fill_random(config->resumption.id, DTLS_SESSION_ID_LENGTH)) {
+    /* issue a new session ID */
+    config->resumption.id_length = DTLS_SESSION_ID_LENGTH;
+  }
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
   if (data_length < sizeof(uint8_t)) { 
     /* no compression specified, take the current compression method */
     if (security)
@@ -1036,6 +1513,34 @@ dtls_update_parameters(dtls_context_t *ctx,
     /* reset config cipher to a well-defined value */
     goto error;
   }
+
+#if DTLS_SESSION_TICKETS
+  /* A client that supports session tickets gets a new ticket instead
+   * of a cached session. To accept the ticket that it may offer, the
+   * session ID of the ClientHello is returned. */
+  ticket = ctx->tickets_disabled ? NULL :
+    dtls_find_extension(data, data_length, TLS_EXT_SESSION_TICKET,
+			&ticket_length);
+  if (ticket) {
+    config->send_ticket = 1;
+    if (!config->abbreviated &&
+	dtls_uint8_to_int(session_id) > 0 &&
+	dtls_uint8_to_int(session_id) <= DTLS_SESSION_ID_LENGTH &&
+	dtls_open_ticket(ctx, ticket, ticket_length, &config->resumption) == 0 &&
+	dtls_offers_cipher(ciphers, ciphers_length, config->resumption.cipher) &&
+	known_cipher(ctx, config->resumption.cipher, 0)) {
+      dtls_debug("resume session from ticket\n");
+      config->cipher = config->resumption.cipher;
+      config->abbreviated = 1;
+      config->resumption.id_length = dtls_uint8_to_int(session_id);
+      memcpy(config->resumption.id, session_id + sizeof(uint8_t),
+	     config->resumption.id_length);
+    } else if (!config->abbreviated) {
+      /* the session is not cached */
+      memset(&config->resumption, 0, sizeof(config->resumption));
+    }
+  }
+#endif /* DTLS_SESSION_TICKETS */
   
   return dtls_check_tls_extension(peer, data, data_length, 1);
 error:
@@ -1261,7 +1766,8 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
       }
 
-      memcpy(p, data_array[i], data_len_array[i]);
+      /* the payload may already be in sendbuf, see dtls_write_inplace() */
+      memmove(p, data_array[i], data_len_array[i]);
       p += data_len_array[i];
       res += data_len_array[i];
     }
@@ -1271,7 +1777,6 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
      * seq_num(2+6) + type(1) + version(2) + length(2)
      */
 #define A_DATA_LEN 13
-    unsigned char nonce[DTLS_CCM_BLOCKSIZE];
     unsigned char A_DATA[A_DATA_LEN];
 
     if(!peer) {
@@ -1337,17 +1842,19 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
       }
 
-      memcpy(p, data_array[i], data_len_array[i]);
+      /* the payload is already in place for dtls_write_inplace() */
+      if (p != data_array[i])
+        memcpy(p, data_array[i], data_len_array[i]);
       p += data_len_array[i];
       res += data_len_array[i];
     }
 
-    memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
-    memcpy(nonce, dtls_kb_local_iv(security, peer->role),
-	   dtls_kb_iv_size(security, peer->role));
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), start, 8); /* epoch + seq_num */
+    if (*rlen < res + DTLS_RH_LENGTH + DTLS_WRITE_TAILROOM) {
+      dtls_debug("dtls_prepare_record: send buffer too small for MAC\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
 
-    dtls_debug_dump("nonce:", nonce, DTLS_CCM_BLOCKSIZE);
+    dtls_debug_dump("nonce_explicit:", start, 8);
     dtls_debug_dump("key:", dtls_kb_local_write_key(security, peer->role),
 		    dtls_kb_key_size(security, peer->role));
     
@@ -1360,10 +1867,8 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
     memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(sendbuf)->content_type, 3); /* type and version */
     dtls_int_to_uint16(A_DATA + 11, res - 8); /* length */
     
-    res = dtls_encrypt(start + 8, res - 8, start + 8, nonce,
-		       dtls_kb_local_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+    res = dtls_encrypt_params(security, start + 8, res - 8, start + 8,
+			      start, A_DATA, A_DATA_LEN);
 
     if (res < 0)
       return res;
@@ -1517,7 +2022,7 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
         n->length += buf_len_array[i];
       }
 
-      if (!netq_insert_node(&ctx->sendqueue, n)) {
+      if (!netq_queue_insert(&ctx->sendqueue, n)) {
 	dtls_warn("cannot add packet to retransmit buffer\n");
 	netq_node_free(n);
       } else {
@@ -1538,44 +2043,261 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
   return res <= 0 ? res : overall_len - (len - res);
 }
 
-static inline int
-dtls_send_alert(dtls_context_t *ctx, dtls_peer_t *peer, dtls_alert_level_t level,
-		dtls_alert_t description) {
-  uint8_t msg[] = { level, description };
+int
+dtls_write_inplace(struct dtls_context_t *ctx, session_t *dst,
+		   uint8_t *buf, size_t buflen, size_t len) {
+  dtls_peer_t *peer;
+  uint8_t *data;
+  size_t rlen = buflen;
+  int res;
 
-  dtls_send(ctx, peer, DTLS_CT_ALERT, msg, sizeof(msg));
-  return 0;
+  if (len > DTLS_WRITE_MAX_PAYLOAD) {
+    dtls_warn("dtls_write_inplace: %zu bytes exceed the record size\n", len);
+    return -1;
+  }
+
+  if (buflen < DTLS_WRITE_HEADROOM + len + DTLS_WRITE_TAILROOM) {
+    dtls_warn("dtls_write_inplace: buffer too small\n");
+    return -1;
+  }
+
+  peer = dtls_get_peer(ctx, dst);
+
+  /* Check if peer connection already exists */
+  if (!peer) { /* no ==> create one */
+    res = dtls_connect(ctx, dst);
+
+    return (res >= 0) ? 0 : res;
+  } else if (peer->state != DTLS_STATE_CONNECTED) {
+    return 0;
+  }
+
+  data = buf + DTLS_WRITE_HEADROOM;
+  res = dtls_prepare_record(peer, dtls_security_params(peer),
+			    DTLS_CT_APPLICATION_DATA, &data, &len, 1,
+			    buf, &rlen);
+  if (res < 0)
+    return res;
+
+  res = CALL(ctx, write, &peer->session, buf, rlen);
+
+  /* see dtls_send_multi() */
+  return res <= 0 ? res : len - (rlen - res);
 }
 
-int 
-dtls_close(dtls_context_t *ctx, const session_t *remote) {
-  int res = -1;
-  dtls_peer_t *peer;
+/* Passes the records in out to the transport. */
+static int
+dtls_flush_write_batch(dtls_context_t *ctx, dtls_message_t *out, size_t count) {
+  size_t i;
+  int res;
 
-  peer = dtls_get_peer(ctx, remote);
+  if (!count)
+    return 0;
 
-  if (peer) {
-    res = dtls_send_alert(ctx, peer, DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_CLOSE_NOTIFY);
-    /* indicate tear down */
-    peer->state = DTLS_STATE_CLOSING;
+  if (ctx->h && ctx->h->write_batch)
+    return ctx->h->write_batch(ctx, out, count);
+
+  for (i = 0; i < count; i++) {
+    res = CALL(ctx, write, out[i].session, out[i].data, out[i].length);
+    if (res < 0)
+      return i ? (int)i : res;
   }
+  return count;
+}
+
+/* Passes the records in out to the transport. index[k] is the
+ * element of msgs that out[k] has been created from. If the transport
+ * does not take all records, *next is set to the first element whose
+ * record has not been sent. Returns the result of
+ * dtls_flush_write_batch(). */
+static int
+dtls_flush_write_messages(dtls_context_t *ctx, dtls_message_t *out,
+			  const size_t *index, size_t count, size_t *next) {
+  int res;
+
+  res = dtls_flush_write_batch(ctx, out, count);
+  if (res != (int)count)
+    *next = index[res > 0 ? res : 0];
   return res;
 }
 
-static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink)
-{
-  if (ctx == NULL || peer == NULL) {
-    return;
+int
+dtls_write_batch(struct dtls_context_t *ctx, dtls_message_t *msgs,
+		 size_t count) {
+  uint8_t sendbuf[DTLS_WRITE_BATCH_BUF];
+  dtls_message_t out[DTLS_WRITE_BATCH_MAX];
+  size_t index[DTLS_WRITE_BATCH_MAX];
+  size_t n = 0, used = 0, i;
+  int res = 0;
+
+  for (i = 0; i < count; i++) {
+    dtls_peer_t *peer = dtls_get_peer(ctx, msgs[i].session);
+    size_t rlen;
+
+    if (!peer) {
+      res = dtls_connect(ctx, msgs[i].session);
+      if (res < 0)
+	break;
+      continue;
+    } else if (peer->state != DTLS_STATE_CONNECTED) {
+      continue;
+    }
+
+    if (msgs[i].length > DTLS_WRITE_MAX_PAYLOAD) {
+      dtls_warn("dtls_write_batch: skipped message of %zu bytes\n",
+		msgs[i].length);
+      continue;
+    }
+
+    /* send what we have if this record might not fit */
+    rlen = DTLS_WRITE_HEADROOM + msgs[i].length + DTLS_WRITE_TAILROOM;
+    if (n == DTLS_WRITE_BATCH_MAX || used + rlen > sizeof(sendbuf)) {
+      res = dtls_flush_write_messages(ctx, out, index, n, &i);
+      if (res != (int)n) {
+	/* the transport fails, do not prepare more records */
+	n = 0;
+	break;
+      }
+      n = used = 0;
+    }
+
+    rlen = sizeof(sendbuf) - used;
+    res = dtls_prepare_record(peer, dtls_security_params(peer),
+			      DTLS_CT_APPLICATION_DATA,
+			      &msgs[i].data, &msgs[i].length, 1,
+			      sendbuf + used, &rlen);
+    if (res < 0)
+      break;
+
+    out[n].session = &peer->session;
+    out[n].data = sendbuf + used;
+    out[n].length = rlen;
+    index[n] = i;
+    n++;
+    used += rlen;
+  }
+
+  /* the records prepared so far have used up sequence numbers and
+   * are sent even if the batch has been stopped by an error */
+  if (n) {
+    int err = res;
+
+    res = dtls_flush_write_messages(ctx, out, index, n, &i);
+    if (res == (int)n)
+      res = err;
+  }
+
+  /* all messages before i have been handled */
+  return i ? (int)i : (res < 0 ? res : 0);
+}
+
+static inline int
+dtls_send_alert(dtls_context_t *ctx, dtls_peer_t *peer, dtls_alert_level_t level,
+		dtls_alert_t description) {
+  uint8_t msg[] = { level, description };
+
+  dtls_send(ctx, peer, DTLS_CT_ALERT, msg, sizeof(msg));
+  return 0;
+}
+
+int 
+dtls_close(dtls_context_t *ctx, const session_t *remote) {
+  int res = -1;
+  dtls_peer_t *peer;
+
+  peer = dtls_get_peer(ctx, remote);
+
+  if (peer) {
+    res = dtls_send_alert(ctx, peer, DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_CLOSE_NOTIFY);
+    /* indicate tear down */
+    peer->state = DTLS_STATE_CLOSING;
+  }
+  return res;
+}
+
+static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink)
+{
+  if (ctx == NULL || peer == NULL) {
+    return;
   }
   if (peer->state != DTLS_STATE_CLOSED && peer->state != DTLS_STATE_CLOSING)
     dtls_close(ctx, &peer->session);
   if (unlink) {
-    delete_peer(&ctx->peers, peer);
+    dtls_remove_peer(ctx, peer);
     dtls_debug_session("removed peer", &peer->session);
   }
+  dtls_stop_retransmission(ctx, peer);
   dtls_free_peer(peer);
 }
 
+/**
+ * Computes the cookie for the Client Hello in @p data and compares
+ * it with the cookie that the Client Hello carries. The cookie of the
+ * current secret generation is written to @p mycookie, which must
+ * hold at least DTLS_COOKIE_LENGTH bytes. A cookie of the previous
+ * generation is accepted as well. This function does not modify
+ * @p ctx.
+ *
+ * @return @c 1 if the cookies match, @c 0 if they do not, or a value
+ *  less than zero if the Client Hello is malformed.
+ */
+static int
+dtls_match_cookie(const dtls_context_t *ctx, const session_t *session,
+		  const uint8_t *data, size_t data_length, uint8_t *mycookie)
+{
+  uint8_t oldcookie[DTLS_COOKIE_LENGTH];
+  int len = DTLS_COOKIE_LENGTH;
+  const uint8_t *cookie = NULL;
+  unsigned long generation;
+  dtls_hmac_key_t tmp;
+  dtls_tick_t now;
+  int err;
+
+  dtls_ticks(&now);
+  generation = dtls_cookie_generation(now);
+
+  err = dtls_create_cookie(dtls_cookie_key(ctx, generation, &tmp),
+			   session, data, data_length, mycookie, &len);
+  if (err < 0)
+    return err;
+
+  dtls_debug_dump("create cookie", mycookie, len);
+
+  assert(len == DTLS_COOKIE_LENGTH);
+    
+  /* Perform cookie check. */
+  len = dtls_get_cookie(data, data_length, &cookie);
+  if (len < 0) {
+    dtls_warn("error while fetching the cookie, err: %i\n", len);
+    return len;
+  }
+
+  dtls_debug_dump("compare with cookie", cookie, len);
+
+  /* check if cookies match */
+  if (len == DTLS_COOKIE_LENGTH && memcmp(cookie, mycookie, len) == 0) {
+    dtls_debug("found matching cookie\n");
+    return 1;
+  }
+
+  /* the cookie may have been issued before the last rotation */
+  if (len == DTLS_COOKIE_LENGTH && generation > 0) {
+    err = dtls_create_cookie(dtls_cookie_key(ctx, generation - 1, &tmp),
+			     session, data, data_length, oldcookie, &len);
+    if (err == 0 && memcmp(cookie, oldcookie, len) == 0) {
+      dtls_debug("found matching cookie of previous secret\n");
+      return 1;
+    }
+  }
+
+  if (len > 0) {
+    dtls_debug_dump("invalid cookie", cookie, len);
+  } else {
+    dtls_debug("cookie len is 0!\n");
+  }
+  return 0;
+}
+
 /**
  * Checks a received Client Hello message for a valid cookie. When the
  * Client Hello contains no cookie, the function fails and a Hello
@@ -1601,41 +2323,16 @@ dtls_verify_peer(dtls_context_t *ctx,
 {
   uint8_t buf[DTLS_HV_LENGTH + DTLS_COOKIE_LENGTH];
   uint8_t *p = buf;
-  int len = DTLS_COOKIE_LENGTH;
-  uint8_t *cookie = NULL;
   int err;
 #undef mycookie
 #define mycookie (buf + DTLS_HV_LENGTH)
 
   /* Store cookie where we can reuse it for the HelloVerify request. */
-  err = dtls_create_cookie(ctx, session, data, data_length, mycookie, &len);
+  err = dtls_match_cookie(ctx, session, data, data_length, mycookie);
   if (err < 0)
     return err;
-
-  dtls_debug_dump("create cookie", mycookie, len);
-
-  assert(len == DTLS_COOKIE_LENGTH);
-    
-  /* Perform cookie check. */
-  len = dtls_get_cookie(data, data_length, &cookie);
-  if (len < 0) {
-    dtls_warn("error while fetching the cookie, err: %i\n", err);
-    return err;
-  }
-
-  dtls_debug_dump("compare with cookie", cookie, len);
-
-  /* check if cookies match */
-  if (len == DTLS_COOKIE_LENGTH && memcmp(cookie, mycookie, len) == 0) {
-    dtls_debug("found matching cookie\n");
+  if (err > 0)
     return 0;
-  }
-
-  if (len > 0) {
-    dtls_debug_dump("invalid cookie", cookie, len);
-  } else {
-    dtls_debug("cookie len is 0!\n");
-  }
 
   /* ClientHello did not contain any valid cookie, hence we send a
    * HelloVerify request. */
@@ -1665,6 +2362,294 @@ dtls_verify_peer(dtls_context_t *ctx,
 #undef mycookie
 }
 
+int
+dtls_cookie_check(const dtls_context_t *ctx, const session_t *session,
+		  const uint8_t *msg, size_t msglen,
+		  uint8_t *reply, size_t *reply_length)
+{
+  const uint8_t *data = msg + DTLS_RH_LENGTH;
+  size_t rlen;
+  uint8_t *p = reply;
+  int err;
+
+  assert(ctx);
+  assert(session);
+
+  /* Only the plaintext Client Hello that opens a handshake is
+   * checked here. Everything else needs the peer's state. */
+  rlen = is_record(msg, msglen);
+  if (!rlen || msg[0] != DTLS_CT_HANDSHAKE
+      || dtls_uint16_to_int(DTLS_RECORD_HEADER(msg)->epoch) != 0
+      || rlen < DTLS_RH_LENGTH + DTLS_HS_LENGTH
+      || DTLS_HANDSHAKE_HEADER(data)->msg_type != DTLS_HT_CLIENT_HELLO)
+    return DTLS_COOKIE_PASS;
+
+  /* Fragmented Client Hello messages are not accepted without state,
+   * see handle_handshake_msg(). */
+  if (dtls_uint24_to_int(DTLS_HANDSHAKE_HEADER(data)->fragment_offset) != 0
+      || dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(data))
+         != dtls_uint24_to_int(DTLS_HANDSHAKE_HEADER(data)->length))
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  if (!reply || !reply_length || *reply_length < DTLS_HELLO_VERIFY_LENGTH)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  /* The expected cookie is computed directly where the Hello Verify
+   * Request carries it. */
+  err = dtls_match_cookie(ctx, session, data, rlen - DTLS_RH_LENGTH,
+			  reply + DTLS_HELLO_VERIFY_LENGTH - DTLS_COOKIE_LENGTH);
+  if (err < 0)
+    return err;
+  if (err > 0)
+    return DTLS_COOKIE_VALID;
+
+  p = dtls_set_record_header(DTLS_CT_HANDSHAKE, NULL, p);
+  dtls_int_to_uint16(p - sizeof(uint16_t),
+		     DTLS_HELLO_VERIFY_LENGTH - DTLS_RH_LENGTH);
+
+  /* use the record sequence number of the Client Hello, see section
+   * 4.2.1 of RFC 6347 */
+  memcpy(DTLS_RECORD_HEADER(reply)->sequence_number,
+	 DTLS_RECORD_HEADER(msg)->sequence_number,
+	 sizeof(DTLS_RECORD_HEADER(msg)->sequence_number));
+
+  p = dtls_set_handshake_header(DTLS_HT_HELLO_VERIFY_REQUEST, NULL,
+				DTLS_HV_LENGTH + DTLS_COOKIE_LENGTH,
+				0, DTLS_HV_LENGTH + DTLS_COOKIE_LENGTH, p);
+
+  dtls_int_to_uint16(p, DTLS_VERSION);
+  p += sizeof(uint16_t);
+
+  dtls_int_to_uint8(p, DTLS_COOKIE_LENGTH);
+  p += sizeof(uint8_t);
+
+  assert(p + DTLS_COOKIE_LENGTH == reply + DTLS_HELLO_VERIFY_LENGTH);
+
+  *reply_length = DTLS_HELLO_VERIFY_LENGTH;
+  return DTLS_COOKIE_HELLO_VERIFY;
+}
+
+/** Returns 1 if the handshake with @p peer waits for a crypto job. */
+static inline int
+crypto_job_pending(const dtls_peer_t *peer) {
+#ifdef DTLS_ECC
+  return peer && peer->handshake_params && peer->handshake_params->crypto_job
+    && !peer->handshake_params->crypto_job->done;
+#else /* DTLS_ECC */
+  return 0;
+#endif /* DTLS_ECC */
+}
+
+#ifdef DTLS_ECC
+/**
+ * Returns a new crypto job of type @p type for the handshake with
+ * @p peer, or NULL if no submit_crypto_job() callback is set or no job
+ * is available. The caller does the computation itself in that case.
+ */
+static dtls_crypto_job_t *
+crypto_job_new(dtls_context_t *ctx, dtls_peer_t *peer,
+	       dtls_crypto_job_type_t type) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_crypto_job_t *job;
+
+  if (!handshake || !ctx->h || !ctx->h->submit_crypto_job)
+    return NULL;
+
+  /* drop a result that has not been picked up */
+  if (handshake->crypto_job && handshake->crypto_job->done) {
+    dtls_crypto_job_free(handshake->crypto_job);
+    handshake->crypto_job = NULL;
+  }
+
+  job = dtls_crypto_job_new(type);
+  if (job) {
+    job->handshake = handshake;
+    job->peer = peer;
+  }
+  return job;
+}
+
+/**
+ * Hands @p job to the submit_crypto_job() callback. Returns 1 if the
+ * handshake has to wait for dtls_crypto_job_complete(), or 0 if the
+ * job was not accepted and has been run right away.
+ */
+static int
+crypto_job_submit(dtls_context_t *ctx, dtls_peer_t *peer,
+		  dtls_crypto_job_t *job) {
+  peer->handshake_params->crypto_job = job;
+  if (ctx->h->submit_crypto_job(ctx, job) == 0) {
+    dtls_debug("handshake waits for crypto job\n");
+    return 1;
+  }
+
+  peer->handshake_params->crypto_job = NULL;
+  dtls_crypto_job_run(job);
+  job->done = 1;
+  return 0;
+}
+
+/**
+ * Detaches the finished crypto job of type @p type from @p handshake.
+ * Returns NULL if there is none.
+ */
+static dtls_crypto_job_t *
+crypto_job_take(dtls_handshake_parameters_t *handshake,
+		dtls_crypto_job_type_t type) {
+  dtls_crypto_job_t *job = handshake->crypto_job;
+
+  if (!job || !job->done || job->type != type)
+    return NULL;
+
+  handshake->crypto_job = NULL;
+  return job;
+}
+
+/**
+ * Keeps @p node, which holds the handshake message whose handling
+ * started the crypto job of @p peer. dtls_crypto_job_complete() hands
+ * it to handle_handshake() again. If @p node is NULL, the job is given
+ * up and a fatal internal error is returned. Returns 0 otherwise.
+ */
+static int
+crypto_job_keep_msg(dtls_peer_t *peer, netq_t *node) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+
+  if (!node) {
+    dtls_warn("cannot keep handshake message for crypto job\n");
+    /* dtls_crypto_job_complete() releases the job */
+    handshake->crypto_job->handshake = NULL;
+    handshake->crypto_job = NULL;
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+  handshake->resume_msg = node;
+  return 0;
+}
+
+/**
+ * Keeps the records @p msg received from @p peer while its handshake
+ * waits for a crypto job. They are handled by
+ * dtls_crypto_job_complete() in the order of arrival.
+ */
+static void
+crypto_job_defer(dtls_peer_t *peer, uint8_t *msg, size_t msglen) {
+  netq_t *node;
+  int count = 0;
+
+  node = netq_head(&peer->handshake_params->deferred);
+  for (; node; node = netq_next(node))
+    count++;
+
+  if (count >= DTLS_CRYPTO_JOB_DEFER_MAX ||
+      !(node = netq_node_new(msglen))) {
+    dtls_warn("no space to defer records, dropped\n");
+    return;
+  }
+
+  node->peer = peer;
+  node->length = msglen;
+  memcpy(node->data, msg, msglen);
+  /* all nodes have t == 0, so this appends */
+  netq_insert_node(&peer->handshake_params->deferred, node);
+}
+
+/**
+ * Checks the signature @p result_r, @p result_s of @p hash with the
+ * peer's public key, by means of a crypto job if possible. Returns
+ * 0 if the signature is valid, 1 if the handshake has to wait for the
+ * crypto job, and a value less than zero otherwise.
+ */
+static int
+dtls_verify_signature(dtls_context_t *ctx, dtls_peer_t *peer,
+		      unsigned char *hash,
+		      unsigned char *result_r, unsigned char *result_s) {
+  dtls_handshake_parameters_t *config = peer->handshake_params;
+  dtls_crypto_job_t *job;
+  int ret;
+
+  job = crypto_job_take(config, DTLS_CRYPTO_JOB_VERIFY);
+  if (!job && (job = crypto_job_new(ctx, peer, DTLS_CRYPTO_JOB_VERIFY))) {
+    memcpy(job->u.verify.pub_x, config->keyx.ecdsa.other_pub_x, DTLS_EC_KEY_SIZE);
+    memcpy(job->u.verify.pub_y, config->keyx.ecdsa.other_pub_y, DTLS_EC_KEY_SIZE);
+    memcpy(job->u.verify.hash, hash, DTLS_HMAC_DIGEST_SIZE);
+    memcpy(job->u.verify.r, result_r, DTLS_EC_KEY_SIZE);
+    memcpy(job->u.verify.s, result_s, DTLS_EC_KEY_SIZE);
+
+    if (crypto_job_submit(ctx, peer, job))
+      return 1;
+  }
+
+  if (job) {
+    ret = job->result;
+    dtls_crypto_job_free(job);
+  } else {
+    ret = dtls_ecdsa_verify_sig_hash(config->keyx.ecdsa.other_pub_x,
+				     config->keyx.ecdsa.other_pub_y,
+				     sizeof(config->keyx.ecdsa.other_pub_x),
+				     hash, DTLS_HMAC_DIGEST_SIZE,
+				     result_r, result_s);
+  }
+  return ret < 0 ? ret : 0;
+}
+
+/**
+ * Computes the ECDH pre master secret for the handshake with @p peer
+ * by means of a crypto job. If @p own_pub_x is not NULL, the job also
+ * creates the own ephemeral key pair and the public key is returned in
+ * @p own_pub_x and @p own_pub_y. Returns 1 if the handshake has to
+ * wait for the crypto job, a value less than zero on error and 0
+ * otherwise. The pre master secret is left to calculate_key_block()
+ * when there is no crypto job.
+ */
+static int
+dtls_compute_pre_master_secret(dtls_context_t *ctx, dtls_peer_t *peer,
+			       uint8_t *own_pub_x, uint8_t *own_pub_y) {
+  dtls_handshake_parameters_t *config = peer->handshake_params;
+  dtls_crypto_job_t *job;
+  int ret;
+
+  job = crypto_job_take(config, DTLS_CRYPTO_JOB_ECDH);
+  if (!job) {
+    job = crypto_job_new(ctx, peer, DTLS_CRYPTO_JOB_ECDH);
+    if (!job)
+      return 0;
+
+    if (own_pub_x)
+      job->u.ecdh.generate = 1;
+    else
+      memcpy(job->u.ecdh.own_priv, config->keyx.ecdsa.own_eph_priv,
+	     DTLS_EC_KEY_SIZE);
+    memcpy(job->u.ecdh.other_pub_x, config->keyx.ecdsa.other_eph_pub_x,
+	   DTLS_EC_KEY_SIZE);
+    memcpy(job->u.ecdh.other_pub_y, config->keyx.ecdsa.other_eph_pub_y,
+	   DTLS_EC_KEY_SIZE);
+
+    if (crypto_job_submit(ctx, peer, job))
+      return 1;
+  }
+
+  ret = job->result;
+  if (ret >= 0) {
+    if (own_pub_x) {
+      memcpy(config->keyx.ecdsa.own_eph_priv, job->u.ecdh.own_priv,
+	     DTLS_EC_KEY_SIZE);
+      memcpy(own_pub_x, job->u.ecdh.own_pub_x, DTLS_EC_KEY_SIZE);
+      memcpy(own_pub_y, job->u.ecdh.own_pub_y, DTLS_EC_KEY_SIZE);
+    }
+    memcpy(config->keyx.ecdsa.pre_master_secret,
+	   job->u.ecdh.pre_master_secret, DTLS_EC_KEY_SIZE);
+    config->have_pre_master_secret = 1;
+  }
+  dtls_crypto_job_free(job);
+
+  if (ret < 0) {
+    dtls_crit("cannot compute the pre master secret\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+  return 0;
+}
+#endif /* DTLS_ECC */
+
 #ifdef DTLS_ECC
 static int
 dtls_check_ecdsa_signature_elem(uint8_t *data, size_t data_length,
@@ -1783,10 +2768,11 @@ check_client_certificate_verify(dtls_context_t *ctx,
 
   dtls_hash_finalize(sha256hash, &hs_hash);
 
-  ret = dtls_ecdsa_verify_sig_hash(config->keyx.ecdsa.other_pub_x, config->keyx.ecdsa.other_pub_y,
-			    sizeof(config->keyx.ecdsa.other_pub_x),
-			    sha256hash, sizeof(sha256hash),
-			    result_r, result_s);
+  ret = dtls_verify_signature(ctx, peer, sha256hash, result_r, result_s);
+  if (ret > 0) {
+    /* handled again when the crypto job is done */
+    return 0;
+  }
 
   if (ret < 0) {
     dtls_alert("wrong signature err: %i\n", ret);
@@ -1796,17 +2782,30 @@ check_client_certificate_verify(dtls_context_t *ctx,
 }
 #endif /* DTLS_ECC */
 
+/**
+ * Sets the server random: First 4 bytes are the server's Unix
+ * timestamp, followed by 28 bytes of generate random data.
+ */
+static void
+dtls_new_server_random(dtls_handshake_parameters_t *handshake)
+{
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  dtls_int_to_uint32(handshake->tmp.random.server, now / DTLS_TICKS_PER_SECOND);
+  dtls_fill_random(handshake->tmp.random.server + 4, 28);
+}
+
 static int
 dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
 {
   /* Ensure that the largest message to create fits in our source
    * buffer. (The size of the destination buffer is checked by the
    * encoding function, so we do not need to guess.) */
-  uint8_t buf[DTLS_SH_LENGTH + 2 + 5 + 5 + 8 + 6];
+  uint8_t buf[DTLS_SH_LENGTH + DTLS_SESSION_ID_LENGTH + 2 + 5 + 5 + 8 + 6 + 4];
   uint8_t *p;
   int ecdsa;
   uint8_t extension_size;
-  dtls_tick_t now;
   dtls_handshake_parameters_t *handshake;
 
   if(!peer || !peer->handshake_params) {
@@ -1817,7 +2816,11 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
 
   ecdsa = is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher);
 
-  extension_size = (ecdsa) ? 2 + 5 + 5 + 6 : 0;
+  extension_size = (ecdsa) ? 5 + 5 + 6 : 0;
+  if (handshake->send_ticket)
+    extension_size += 4;
+  if (extension_size)
+    extension_size += 2;
 
   /* Handshake header */
   p = buf;
@@ -1826,16 +2829,15 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
   dtls_int_to_uint16(p, DTLS_VERSION);
   p += sizeof(uint16_t);
 
-  /* Set server random: First 4 bytes are the server's Unix timestamp,
-   * followed by 28 bytes of generate random data. */
-  dtls_ticks(&now);
-  dtls_int_to_uint32(handshake->tmp.random.server, now / DTLS_TICKS_PER_SECOND);
-  dtls_fill_random(handshake->tmp.random.server + 4, 28);
-
+  /* the server random has been set by dtls_new_server_random() */
   memcpy(p, handshake->tmp.random.server, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  *p++ = 0;			/* no session id */
+  /* the new session ID, or the client's if the session is resumed */
+  dtls_int_to_uint8(p, handshake->resumption.id_length);
+  p += sizeof(uint8_t);
+  memcpy(p, handshake->resumption.id, handshake->resumption.id_length);
+  p += handshake->resumption.id_length;
 
   if (handshake->cipher != TLS_NULL_WITH_NULL_NULL) {
     /* selected cipher suite */
@@ -1891,6 +2893,16 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
     p += sizeof(uint8_t);
   }
 
+  if (handshake->send_ticket) {
+    /* session ticket extension, announces the NewSessionTicket */
+    dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+    p += sizeof(uint16_t);
+
+    /* length of this extension type */
+    dtls_int_to_uint16(p, 0);
+    p += sizeof(uint16_t);
+  }
+
   assert(p - buf <= sizeof(buf));
 
   /* TODO use the same record sequence number as in the ClientHello,
@@ -1990,6 +3002,80 @@ dtls_add_ecdsa_signature_elem(uint8_t *p, uint32_t *point_r, uint32_t *point_s)
   return p;
 }
 
+/**
+ * Writes the curve parameters of a ServerKeyExchange message for an
+ * uncompressed secp256r1 public point to @p p. The point follows.
+ */
+static uint8_t *
+dtls_add_ecdh_params(uint8_t *p)
+{
+  /* ECCurveType curve_type: named_curve */
+  dtls_int_to_uint8(p, 3);
+  p += sizeof(uint8_t);
+
+  /* NamedCurve namedcurve: secp256r1 */
+  dtls_int_to_uint16(p, TLS_EXT_ELLIPTIC_CURVES_SECP256R1);
+  p += sizeof(uint16_t);
+
+  dtls_int_to_uint8(p, 1 + 2 * DTLS_EC_KEY_SIZE);
+  p += sizeof(uint8_t);
+
+  /* This should be an uncompressed point, but I do not have access to the spec. */
+  dtls_int_to_uint8(p, 4);
+  p += sizeof(uint8_t);
+
+  return p;
+}
+
+/**
+ * Starts a crypto job that signs a new ephemeral ECDH key for the
+ * ServerKeyExchange message, which dtls_send_server_key_exchange_ecdh()
+ * picks up. Nothing is done if there is no submit_crypto_job()
+ * callback. The server random must have been set.
+ */
+static int
+dtls_prepare_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  uint8_t key_params[1 + 2 + 1 + 1 + 2 * DTLS_EC_KEY_SIZE];
+  uint8_t *p;
+  const dtls_ecdsa_key_t *ecdsa_key;
+  dtls_handshake_parameters_t *config = peer->handshake_params;
+  dtls_crypto_job_t *job;
+  int res;
+
+  job = crypto_job_new(ctx, peer, DTLS_CRYPTO_JOB_SIGN);
+  if (!job)
+    return 0;
+
+  res = CALL(ctx, get_ecdsa_key, &peer->session, &ecdsa_key);
+  if (res < 0) {
+    dtls_crit("no ecdsa certificate to send in certificate\n");
+    dtls_crypto_job_free(job);
+    return res;
+  }
+
+  dtls_ecdh_generate_ephemeral_key(config->keyx.ecdsa.own_eph_priv,
+				   job->u.sign.eph_pub_x, job->u.sign.eph_pub_y,
+				   DTLS_EC_KEY_SIZE);
+
+  p = dtls_add_ecdh_params(key_params);
+  memcpy(p, job->u.sign.eph_pub_x, DTLS_EC_KEY_SIZE);
+  p += DTLS_EC_KEY_SIZE;
+  memcpy(p, job->u.sign.eph_pub_y, DTLS_EC_KEY_SIZE);
+  p += DTLS_EC_KEY_SIZE;
+
+  dtls_ecdsa_keyx_hash(config->tmp.random.client, DTLS_RANDOM_LENGTH,
+		       config->tmp.random.server, DTLS_RANDOM_LENGTH,
+		       key_params, p - key_params, job->u.sign.hash);
+  memcpy(job->u.sign.priv_key, ecdsa_key->priv_key, DTLS_EC_KEY_SIZE);
+
+  if (!crypto_job_submit(ctx, peer, job)) {
+    /* done already, keep it for dtls_send_server_key_exchange_ecdh() */
+    config->crypto_job = job;
+  }
+  return 0;
+}
+
 static int
 dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
 				   const dtls_ecdsa_key_t *key)
@@ -2004,6 +3090,7 @@ dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
   uint32_t point_r[9];
   uint32_t point_s[9];
   dtls_handshake_parameters_t *config;
+  dtls_crypto_job_t *job;
 
   if(!peer || !peer->handshake_params) {
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
@@ -2016,20 +3103,7 @@ dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
   p = buf;
 
   key_params = p;
-  /* ECCurveType curve_type: named_curve */
-  dtls_int_to_uint8(p, 3);
-  p += sizeof(uint8_t);
-
-  /* NamedCurve namedcurve: secp256r1 */
-  dtls_int_to_uint16(p, TLS_EXT_ELLIPTIC_CURVES_SECP256R1);
-  p += sizeof(uint16_t);
-
-  dtls_int_to_uint8(p, 1 + 2 * DTLS_EC_KEY_SIZE);
-  p += sizeof(uint8_t);
-
-  /* This should be an uncompressed point, but I do not have access to the spec. */
-  dtls_int_to_uint8(p, 4);
-  p += sizeof(uint8_t);
+  p = dtls_add_ecdh_params(p);
 
   /* store the pointer to the x component of the pub key and make space */
   ephemeral_pub_x = p;
@@ -2039,16 +3113,26 @@ dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
   ephemeral_pub_y = p;
   p += DTLS_EC_KEY_SIZE;
 
-  dtls_ecdsa_generate_key(config->keyx.ecdsa.own_eph_priv,
-			  ephemeral_pub_x, ephemeral_pub_y,
-			  DTLS_EC_KEY_SIZE);
+  job = crypto_job_take(config, DTLS_CRYPTO_JOB_SIGN);
+  if (job) {
+    /* created by dtls_prepare_server_key_exchange_ecdh() */
+    memcpy(ephemeral_pub_x, job->u.sign.eph_pub_x, DTLS_EC_KEY_SIZE);
+    memcpy(ephemeral_pub_y, job->u.sign.eph_pub_y, DTLS_EC_KEY_SIZE);
+    memcpy(point_r, job->u.sign.point_r, sizeof(point_r));
+    memcpy(point_s, job->u.sign.point_s, sizeof(point_s));
+    dtls_crypto_job_free(job);
+  } else {
+    dtls_ecdh_generate_ephemeral_key(config->keyx.ecdsa.own_eph_priv,
+				     ephemeral_pub_x, ephemeral_pub_y,
+				     DTLS_EC_KEY_SIZE);
 
-  /* sign the ephemeral and its paramaters */
-  dtls_ecdsa_create_sig(key->priv_key, DTLS_EC_KEY_SIZE,
-		       config->tmp.random.client, DTLS_RANDOM_LENGTH,
-		       config->tmp.random.server, DTLS_RANDOM_LENGTH,
-		       key_params, p - key_params,
-		       point_r, point_s);
+    /* sign the ephemeral and its paramaters */
+    dtls_ecdsa_create_sig(key->priv_key, DTLS_EC_KEY_SIZE,
+			  config->tmp.random.client, DTLS_RANDOM_LENGTH,
+			  config->tmp.random.server, DTLS_RANDOM_LENGTH,
+			  key_params, p - key_params,
+			  point_r, point_s);
+  }
 
   p = dtls_add_ecdsa_signature_elem(p, point_r, point_s);
 
@@ -2231,6 +3315,32 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
   return 0;
 }
 
+/**
+ * Sends the reply to a ClientHello and sets the state for the next
+ * flight of the client.
+ */
+static int
+dtls_send_server_flight(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  int err;
+
+  err = dtls_send_server_hello_msgs(ctx, peer);
+  if (err < 0) {
+    return err;
+  }
+  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+      is_ecdsa_client_auth_supported(ctx))
+    peer->state = DTLS_STATE_WAIT_CLIENTCERTIFICATE;
+  else
+    peer->state = DTLS_STATE_WAIT_CLIENTKEYEXCHANGE;
+
+  /* after sending the ServerHelloDone, we expect the
+   * ClientKeyExchange (possibly containing the PSK id),
+   * followed by a ChangeCipherSpec and an encrypted Finished.
+   */
+  return 0;
+}
+
 static inline int 
 dtls_send_ccs(dtls_context_t *ctx, dtls_peer_t *peer) {
   uint8_t buf[1] = {1};
@@ -2238,9 +3348,106 @@ dtls_send_ccs(dtls_context_t *ctx, dtls_peer_t *peer) {
   return dtls_send(ctx, peer, DTLS_CT_CHANGE_CIPHER_SPEC, buf, 1);
 }
 
+static int dtls_send_finished(dtls_context_t *ctx, dtls_peer_t *peer,
+			      const unsigned char *label, size_t labellen);
+
+/**
+ * Sends a NewSessionTicket with the session's master secret if the
+ * client supports session tickets. The key block must have been
+ * calculated before.
+ */
+static int
+dtls_send_new_session_ticket(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+#if DTLS_SESSION_TICKETS
+  uint8_t buf[sizeof(uint32_t) + sizeof(uint16_t) + DTLS_TICKET_LENGTH];
+  uint8_t *p = buf;
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  int res;
+
+  if (!handshake->send_ticket)
+    return 0;
+
+  /* ticket_lifetime_hint */
+  dtls_int_to_uint32(p, DTLS_SESSION_TICKET_LIFETIME);
+  p += sizeof(uint32_t);
+
+  dtls_int_to_uint16(p, DTLS_TICKET_LENGTH);
+  p += sizeof(uint16_t);
+
+  res = dtls_seal_ticket(ctx, handshake->cipher,
+			 handshake->tmp.master_secret, p);
+  if (res < 0) {
+    return res;
+  }
+  p += res;
+
+  assert(p - buf <= sizeof(buf));
+
+  res = dtls_send_handshake_msg(ctx, peer, DTLS_HT_NEW_SESSION_TICKET,
+				buf, p - buf);
+  memset(buf, 0, sizeof(buf));
+  return res;
+#else /* DTLS_SESSION_TICKETS */
+  (void)ctx;
+  (void)peer;
+  return 0;
+#endif /* DTLS_SESSION_TICKETS */
+}
+
+/**
+ * Sends the reply to a ClientHello that resumes a cached session,
+ * i.e. the ServerHello followed by ChangeCipherSpec and the server's
+ * Finished, and waits for the client's ChangeCipherSpec.
+ */
+static int
+dtls_send_server_flight_abbreviated(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  int err;
+
+  err = dtls_send_server_hello(ctx, peer);
+  if (err < 0) {
+    dtls_warn("dtls_server_hello: cannot prepare ServerHello record\n");
+    return err;
+  }
+
+  err = calculate_resumed_key_block(peer->handshake_params, peer, peer->role);
+  if (err < 0) {
+    return err;
+  }
+
+  err = dtls_send_new_session_ticket(ctx, peer);
+  if (err < 0) {
+    dtls_warn("cannot send NewSessionTicket\n");
+    return err;
+  }
+
+  err = dtls_send_ccs(ctx, peer);
+  if (err < 0) {
+    dtls_warn("cannot send CCS message\n");
+    return err;
+  }
+
+  dtls_security_params_switch(peer);
+
+  err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+  if (err < 0) {
+    dtls_warn("sending server Finished failed\n");
+    return err;
+  }
+
+  peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+  return 0;
+}
+
     
+/**
+ * Sends the ClientKeyExchange message. For ECDHE, a new ephemeral key
+ * pair is created unless @p eph_pub_x and @p eph_pub_y are given.
+ */
 static int
-dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
+dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer,
+			      const uint8_t *eph_pub_x, const uint8_t *eph_pub_y)
 {
   uint8_t buf[DTLS_CKXEC_LENGTH];
   uint8_t *p;
@@ -2302,9 +3509,14 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
     ephemeral_pub_y = p;
     p += DTLS_EC_KEY_SIZE;
 
-    dtls_ecdsa_generate_key(peer->handshake_params->keyx.ecdsa.own_eph_priv,
-    			    ephemeral_pub_x, ephemeral_pub_y,
-    			    DTLS_EC_KEY_SIZE);
+    if (eph_pub_x) {
+      memcpy(ephemeral_pub_x, eph_pub_x, DTLS_EC_KEY_SIZE);
+      memcpy(ephemeral_pub_y, eph_pub_y, DTLS_EC_KEY_SIZE);
+    } else {
+      dtls_ecdh_generate_ephemeral_key(peer->handshake_params->keyx.ecdsa.own_eph_priv,
+				       ephemeral_pub_x, ephemeral_pub_y,
+				       DTLS_EC_KEY_SIZE);
+    }
 
     break;
   }
@@ -2402,7 +3614,7 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   uint8_t buf[DTLS_CH_LENGTH_MAX];
   uint8_t *p = buf;
   uint8_t cipher_size;
-  uint8_t extension_size;
+  uint16_t extension_size;
   int psk;
   int ecdsa;
   dtls_tick_t now;
@@ -2417,7 +3629,15 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   ecdsa = is_ecdsa_supported(ctx, 1);
 
   cipher_size = 2 + ((ecdsa) ? 2 : 0) + ((psk) ? 2 : 0);
-  extension_size = (ecdsa) ? 2 + 6 + 6 + 8 + 6: 0;
+  extension_size = (ecdsa) ? 6 + 6 + 8 + 6 : 0;
+#if DTLS_SESSION_TICKETS
+  /* unless disabled, the session ticket extension is always sent,
+   * empty if there is no ticket to resume */
+  if (!ctx->tickets_disabled)
+    extension_size += 4 + handshake->resumption.ticket_length;
+#endif /* DTLS_SESSION_TICKETS */
+  if (extension_size)
+    extension_size += 2;
 
   if (cipher_size == 0) {
     dtls_crit("no cipher callbacks implemented\n");
@@ -2443,9 +3663,11 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   memcpy(p, handshake->tmp.random.client, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  /* session id (length 0) */
-  dtls_int_to_uint8(p, 0);
+  /* the session ID to resume, if any */
+  dtls_int_to_uint8(p, handshake->resumption.id_length);
   p += sizeof(uint8_t);
+  memcpy(p, handshake->resumption.id, handshake->resumption.id_length);
+  p += handshake->resumption.id_length;
 
   /* cookie */
   dtls_int_to_uint8(p, cookie_length);
@@ -2539,9 +3761,25 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
     dtls_int_to_uint8(p, 1);
     p += sizeof(uint8_t);
 
-    dtls_int_to_uint8(p, TLS_EXT_EC_POINT_FORMATS_UNCOMPRESSED);
-    p += sizeof(uint8_t);
+    dtls_int_to_uint8(p, TLS_EXT_EC_POINT_FORMATS_UNCOMPRESSED);
+    p += sizeof(uint8_t);
+  }
+
+#if DTLS_SESSION_TICKETS
+  if (!ctx->tickets_disabled) {
+    /* session ticket extension */
+    dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+    p += sizeof(uint16_t);
+
+    /* length of this extension type */
+    dtls_int_to_uint16(p, handshake->resumption.ticket_length);
+    p += sizeof(uint16_t);
+
+    memcpy(p, handshake->resumption.ticket,
+	   handshake->resumption.ticket_length);
+    p += handshake->resumption.ticket_length;
   }
+#endif /* DTLS_SESSION_TICKETS */
 
   assert(p - buf <= sizeof(buf));
 
@@ -2559,6 +3797,7 @@ check_server_hello(dtls_context_t *ctx,
 		      uint8_t *data, size_t data_length)
 {
   dtls_handshake_parameters_t *handshake;
+  size_t session_id_length;
 
   /* This function is called when we expect a ServerHello (i.e. we
    * have sent a ClientHello).  We might instead receive a HelloVerify
@@ -2601,6 +3840,25 @@ check_server_hello(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
+  /* The server resumes the session if it returns the offered
+   * session ID. Otherwise, the ID is kept for the new session. */
+  session_id_length = dtls_uint8_to_int(data);
+  if (session_id_length > DTLS_SESSION_ID_LENGTH ||
+      data_length < session_id_length + sizeof(uint8_t) + sizeof(uint16_t))
+    goto error;
+  handshake->abbreviated = session_id_length &&
+    session_id_length == handshake->resumption.id_length &&
+    memcmp(data + sizeof(uint8_t), handshake->resumption.id,
+	   session_id_length) == 0;
+  if (!handshake->abbreviated) {
+    handshake->resumption.id_length = session_id_length;
+    memcpy(handshake->resumption.id, data + sizeof(uint8_t),
+	   session_id_length);
+#if DTLS_SESSION_TICKETS
+    /* the ticket has been rejected, a new one may follow */
+    handshake->resumption.ticket_length = 0;
+#endif /* DTLS_SESSION_TICKETS */
+  }
   SKIP_VAR_FIELD(data, data_length); /* skip session id */
     
   /* Check cipher suite. As we offer all we have, it is sufficient
@@ -2612,6 +3870,11 @@ check_server_hello(dtls_context_t *ctx,
 	     data[0], data[1]);
     return dtls_alert_fatal_create(DTLS_ALERT_INSUFFICIENT_SECURITY);
   }
+  if (handshake->abbreviated &&
+      handshake->cipher != handshake->resumption.cipher) {
+    dtls_alert("resumed session with a different cipher\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_ILLEGAL_PARAMETER);
+  }
   data += sizeof(uint16_t);
   data_length -= sizeof(uint16_t);
 
@@ -2629,6 +3892,47 @@ error:
   return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
 }
 
+#if DTLS_SESSION_TICKETS
+static int
+check_new_session_ticket(dtls_peer_t *peer, uint8_t *data, size_t data_length)
+{
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  size_t ticket_length;
+
+  update_hs_hash(peer, data, data_length);
+
+  if (data_length < DTLS_HS_LENGTH + sizeof(uint32_t) + sizeof(uint16_t)) {
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+  data += DTLS_HS_LENGTH;
+  data_length -= DTLS_HS_LENGTH;
+
+  handshake->resumption.ticket_lifetime = dtls_uint32_to_int(data);
+  data += sizeof(uint32_t);
+  data_length -= sizeof(uint32_t);
+
+  ticket_length = dtls_uint16_to_int(data);
+  data += sizeof(uint16_t);
+  data_length -= sizeof(uint16_t);
+  if (data_length < ticket_length) {
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+
+  /* An empty ticket means that the server has not issued one. A
+   * ticket that does not fit is ignored, the session is just not
+   * resumable then. */
+  if (ticket_length == 0 || ticket_length > DTLS_SESSION_TICKET_MAX_LENGTH) {
+    dtls_debug("ignore session ticket of %zu bytes\n", ticket_length);
+    return 0;
+  }
+
+  handshake->resumption.ticket_length = ticket_length;
+  memcpy(handshake->resumption.ticket, data, ticket_length);
+  handshake->new_ticket = 1;
+  return 0;
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 static int
 check_server_hello_verify_request(dtls_context_t *ctx,
 				  dtls_peer_t *peer,
@@ -2712,6 +4016,9 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
   unsigned char *result_r;
   unsigned char *result_s;
   unsigned char *key_params;
+  unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
+  uint8_t *msg = data;
+  size_t msg_length = data_length;
   dtls_handshake_parameters_t *config;
 
   if (!peer || !peer->handshake_params) {
@@ -2719,8 +4026,6 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
   }
   config = peer->handshake_params;
 
-  update_hs_hash(peer, data, data_length);
-
   assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
 
   data += DTLS_HS_LENGTH;
@@ -2774,18 +4079,25 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
   data += ret;
   data_length -= ret;
 
-  ret = dtls_ecdsa_verify_sig(config->keyx.ecdsa.other_pub_x, config->keyx.ecdsa.other_pub_y,
-			    sizeof(config->keyx.ecdsa.other_pub_x),
-			    config->tmp.random.client, DTLS_RANDOM_LENGTH,
-			    config->tmp.random.server, DTLS_RANDOM_LENGTH,
-			    key_params,
-			    1 + 2 + 1 + 1 + (2 * DTLS_EC_KEY_SIZE),
-			    result_r, result_s);
+  dtls_ecdsa_keyx_hash(config->tmp.random.client, DTLS_RANDOM_LENGTH,
+		       config->tmp.random.server, DTLS_RANDOM_LENGTH,
+		       key_params, 1 + 2 + 1 + 1 + (2 * DTLS_EC_KEY_SIZE),
+		       sha256hash);
+
+  ret = dtls_verify_signature(ctx, peer, sha256hash, result_r, result_s);
+  if (ret > 0) {
+    /* handled again when the crypto job is done */
+    return 0;
+  }
 
   if (ret < 0) {
     dtls_alert("wrong signature\n");
     return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
   }
+
+  /* not before the message has been accepted, it may be handled
+   * again after a crypto job */
+  update_hs_hash(peer, msg, msg_length);
   return 0;
 }
 #endif /* DTLS_ECC */
@@ -2924,8 +4236,11 @@ check_server_hellodone(dtls_context_t *ctx,
 {
   dtls_handshake_parameters_t *handshake;
   int res;
+  uint8_t *eph_pub_x = NULL;
+  uint8_t *eph_pub_y = NULL;
 #ifdef DTLS_ECC
   const dtls_ecdsa_key_t *ecdsa_key;
+  uint8_t eph_pub[2][DTLS_EC_KEY_SIZE];
 #endif /* DTLS_ECC */
 
   if (!peer || !peer->handshake_params) {
@@ -2933,6 +4248,21 @@ check_server_hellodone(dtls_context_t *ctx,
   }
   handshake = peer->handshake_params;
 
+#ifdef DTLS_ECC
+  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher)) {
+    /* own key pair and pre master secret in one crypto job */
+    res = dtls_compute_pre_master_secret(ctx, peer, eph_pub[0], eph_pub[1]);
+    if (res != 0) {
+      /* error, or handled again when the crypto job is done */
+      return res < 0 ? res : 0;
+    }
+    if (handshake->have_pre_master_secret) {
+      eph_pub_x = eph_pub[0];
+      eph_pub_y = eph_pub[1];
+    }
+  }
+#endif /* DTLS_ECC */
+
   /* calculate master key, send CCS */
 
   update_hs_hash(peer, data, data_length);
@@ -2956,7 +4286,7 @@ check_server_hellodone(dtls_context_t *ctx,
 #endif /* DTLS_ECC */
 
   /* send ClientKeyExchange */
-  res = dtls_send_client_key_exchange(ctx, peer);
+  res = dtls_send_client_key_exchange(ctx, peer, eph_pub_x, eph_pub_y);
 
   if (res < 0) {
     dtls_debug("cannot send KeyExchange message\n");
@@ -3024,22 +4354,18 @@ decrypt_verify(dtls_peer_t *peer, uint8_t *packet, size_t length,
      * seq_num(2+6) + type(1) + version(2) + length(2)
      */
 #define A_DATA_LEN 13
-    unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+    const unsigned char *nonce_explicit;
     unsigned char A_DATA[A_DATA_LEN];
 
     if (clen < 16)		/* need at least IV and MAC */
       return -1;
 
-    memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
-    memcpy(nonce, dtls_kb_remote_iv(security, peer->role),
-	   dtls_kb_iv_size(security, peer->role));
-
-    /* read epoch and seq_num from message */
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), *cleartext, 8);
+    /* epoch and seq_num from message form the explicit nonce */
+    nonce_explicit = *cleartext;
     *cleartext += 8;
     clen -= 8;
 
-    dtls_debug_dump("nonce", nonce, DTLS_CCM_BLOCKSIZE);
+    dtls_debug_dump("nonce_explicit", nonce_explicit, 8);
     dtls_debug_dump("key", dtls_kb_remote_write_key(security, peer->role),
 		    dtls_kb_key_size(security, peer->role));
     dtls_debug_dump("ciphertext", *cleartext, clen);
@@ -3053,15 +4379,16 @@ decrypt_verify(dtls_peer_t *peer, uint8_t *packet, size_t length,
     memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(packet)->content_type, 3); /* type and version */
     dtls_int_to_uint16(A_DATA + 11, clen - 8); /* length without nonce_explicit */
 
-    clen = dtls_decrypt(*cleartext, clen, *cleartext, nonce,
-		       dtls_kb_remote_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+    clen = dtls_decrypt_params(security, *cleartext, clen, *cleartext,
+			       nonce_explicit, A_DATA, A_DATA_LEN);
     if (clen < 0)
       dtls_warn("decryption failed\n");
     else {
       dtls_debug("decrypt_verify(): found %i bytes cleartext\n", clen);
-      dtls_security_params_free_other(peer);
+      /* a NewSessionTicket may still arrive in the previous epoch
+       * after the client has switched to the next one */
+      if (security == dtls_security_params(peer))
+        dtls_security_params_free_other(peer);
       dtls_debug_dump("cleartext", *cleartext, clen);
     }
   }
@@ -3115,6 +4442,39 @@ dtls_renegotiate(dtls_context_t *ctx, const session_t *dst)
   return -1;
 }
 
+/**
+ * Makes the session that has just been established resumable. A
+ * server adds it to its session cache, a client passes it to the
+ * store_resumption() callback. Nothing is done for a resumed session
+ * or if the server has issued neither a session ID nor a ticket.
+ */
+static void
+dtls_keep_session(dtls_context_t *ctx, dtls_peer_t *peer,
+		  const dtls_peer_type role) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  int keep = !handshake->abbreviated && handshake->resumption.id_length;
+
+  if (!handshake->abbreviated) {
+    handshake->resumption.cipher = handshake->cipher;
+    memcpy(handshake->resumption.master_secret, handshake->tmp.master_secret,
+	   DTLS_MASTER_SECRET_LENGTH);
+  }
+
+  if (role == DTLS_CLIENT) {
+#if DTLS_SESSION_TICKETS
+    /* a resumed session is passed again with its new ticket */
+    keep |= handshake->new_ticket;
+#endif /* DTLS_SESSION_TICKETS */
+    if (keep)
+      CALL(ctx, store_resumption, &peer->session, &handshake->resumption);
+  }
+#if DTLS_SESSION_CACHE_SIZE > 0
+  else if (keep) {
+    dtls_session_cache_add(ctx, &handshake->resumption);
+  }
+#endif /* DTLS_SESSION_CACHE_SIZE */
+}
+
 static int
 handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 		 const dtls_peer_type role, const dtls_state_t state,
@@ -3170,7 +4530,15 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_hello err: %i\n", err);
       return err;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher))
+    if (peer->handshake_params->abbreviated) {
+      /* the server continues with ChangeCipherSpec and Finished */
+      dtls_debug("server resumes the session\n");
+      err = calculate_resumed_key_block(peer->handshake_params, peer, role);
+      if (err < 0) {
+        return err;
+      }
+      peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+    } else if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher))
       peer->state = DTLS_STATE_WAIT_SERVERCERTIFICATE;
     else
       peer->state = DTLS_STATE_WAIT_SERVERHELLODONE;
@@ -3232,6 +4600,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_key_exchange err: %i\n", err);
       return err;
     }
+    if (crypto_job_pending(peer)) {
+      return 0;
+    }
     peer->state = DTLS_STATE_WAIT_SERVERHELLODONE;
     /* update_hs_hash(peer, data, data_length); */
 
@@ -3252,6 +4623,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_hellodone err: %i\n", err);
       return err;
     }
+    if (crypto_job_pending(peer)) {
+      return 0;
+    }
     peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
     /* update_hs_hash(peer, data, data_length); */
 
@@ -3271,6 +4645,33 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
     break;
 
+#if DTLS_SESSION_TICKETS
+  case DTLS_HT_NEW_SESSION_TICKET:
+    /* the server sends the ticket right before its ChangeCipherSpec */
+
+    if (role != DTLS_CLIENT || state != DTLS_STATE_WAIT_CHANGECIPHERSPEC) {
+      return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
+    }
+
+    if(!peer || !peer->handshake_params) {
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
+
+    /* only allowed if announced in the ServerHello (RFC 5077, 3.3) */
+    if (!peer->handshake_params->send_ticket) {
+      dtls_warn("NewSessionTicket without SessionTicket extension\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
+    }
+
+    err = check_new_session_ticket(peer, data, data_length);
+    if (err < 0) {
+      dtls_warn("error in check_new_session_ticket err: %i\n", err);
+      return err;
+    }
+
+    break;
+#endif /* DTLS_SESSION_TICKETS */
+
   case DTLS_HT_FINISHED:
     /* expect a Finished message from server */
 
@@ -3287,10 +4688,19 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_finished err: %i\n", err);
       return err;
     }
-    if (role == DTLS_SERVER) {
-      /* send ServerFinished */
+    /* The server sends its Finished last in a full handshake, the
+     * client in an abbreviated handshake. */
+    if ((role == DTLS_SERVER) != peer->handshake_params->abbreviated) {
       update_hs_hash(peer, data, data_length);
 
+      if (role == DTLS_SERVER) {
+        err = dtls_send_new_session_ticket(ctx, peer);
+        if (err < 0) {
+          dtls_warn("cannot send NewSessionTicket\n");
+          return err;
+        }
+      }
+
       /* send change cipher spec message and switch to new configuration */
       err = dtls_send_ccs(ctx, peer);
       if (err < 0) {
@@ -3300,12 +4710,18 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
       dtls_security_params_switch(peer);
 
-      err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      if (role == DTLS_SERVER)
+        err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      else
+        err = dtls_send_finished(ctx, peer, PRF_LABEL(client), PRF_LABEL_SIZE(client));
       if (err < 0) {
-        dtls_warn("sending server Finished failed\n");
+        dtls_warn("sending %s Finished failed\n",
+                  role == DTLS_SERVER ? "server" : "client");
         return err;
       }
     }
+    dtls_keep_session(ctx, peer, role);
+    peer->abbreviated = peer->handshake_params->abbreviated;
     dtls_handshake_free(peer->handshake_params);
     peer->handshake_params = NULL;
     dtls_debug("Handshake complete\n");
@@ -3334,6 +4750,17 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_client_keyexchange err: %i\n", err);
       return err;
     }
+#ifdef DTLS_ECC
+    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+      err = dtls_compute_pre_master_secret(ctx, peer, NULL, NULL);
+      if (err < 0) {
+        return err;
+      }
+      if (err > 0) {
+        return 0;
+      }
+    }
+#endif /* DTLS_ECC */
     update_hs_hash(peer, data, data_length);
 
     if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
@@ -3359,6 +4786,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_client_certificate_verify err: %i\n", err);
       return err;
     }
+    if (crypto_job_pending(peer)) {
+      return 0;
+    }
 
     update_hs_hash(peer, data, data_length);
     peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
@@ -3400,8 +4830,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       * the cookie exchange */
     if (peer && state == DTLS_STATE_WAIT_CLIENTHELLO) {
        dtls_debug("removing the peer\n");
-       delete_peer(&ctx->peers, peer);
+       dtls_remove_peer(ctx, peer);
 
+       dtls_stop_retransmission(ctx, peer);
        dtls_free_peer(peer);
        peer = NULL;
     }
@@ -3459,21 +4890,33 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     /* update finish MAC */
     update_hs_hash(peer, data, data_length);
 
-    err = dtls_send_server_hello_msgs(ctx, peer);
-    if (err < 0) {
-      return err;
+    dtls_new_server_random(peer->handshake_params);
+
+    if (peer->handshake_params->abbreviated) {
+      err = dtls_send_server_flight_abbreviated(ctx, peer);
+      if (err < 0) {
+        return err;
+      }
+      break;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
-	is_ecdsa_client_auth_supported(ctx))
-      peer->state = DTLS_STATE_WAIT_CLIENTCERTIFICATE;
-    else
-      peer->state = DTLS_STATE_WAIT_CLIENTKEYEXCHANGE;
 
-    /* after sending the ServerHelloDone, we expect the
-     * ClientKeyExchange (possibly containing the PSK id),
-     * followed by a ChangeCipherSpec and an encrypted Finished.
-     */
+#ifdef DTLS_ECC
+    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+      err = dtls_prepare_server_key_exchange_ecdh(ctx, peer);
+      if (err < 0) {
+        return err;
+      }
+      if (crypto_job_pending(peer)) {
+        /* dtls_crypto_job_complete() sends the reply */
+        return 0;
+      }
+    }
+#endif /* DTLS_ECC */
 
+    err = dtls_send_server_flight(ctx, peer);
+    if (err < 0) {
+      return err;
+    }
     break;
 
   case DTLS_HT_HELLO_REQUEST:
@@ -3600,6 +5043,21 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     if (res < 0)
       return res;
 
+#ifdef DTLS_ECC
+    if (crypto_job_pending(peer)) {
+      netq_t *n = netq_node_new(data_length);
+      int err;
+
+      if (n) {
+        n->peer = peer;
+        n->length = data_length;
+        memcpy(n->data, data, data_length);
+      }
+      err = crypto_job_keep_msg(peer, n);
+      return err < 0 ? err : res;
+    }
+#endif /* DTLS_ECC */
+
     /* We do not know in which order the packet are in the list just search the list for every packet. */
     while (next && peer->handshake_params) {
       next = 0;
@@ -3611,6 +5069,13 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
           netq_remove(&peer->handshake_params->reorder_queue, node);
           next = 1;
           res = handle_handshake_msg(ctx, peer, session, role, peer->state, node->data, node->length);
+#ifdef DTLS_ECC
+          if (res >= 0 && crypto_job_pending(peer)) {
+            crypto_job_keep_msg(peer, node);
+            return res;
+          }
+#endif /* DTLS_ECC */
+          netq_node_free(node);
           if (res < 0) {
             return res;
           }
@@ -3648,7 +5113,7 @@ handle_ccs(dtls_context_t *ctx, dtls_peer_t *peer,
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
 
   /* Just change the cipher when we are on the same epoch */
-  if (peer->role == DTLS_SERVER) {
+  if (peer->role == DTLS_SERVER && !peer->handshake_params->abbreviated) {
     err = calculate_key_block(ctx, peer->handshake_params, peer,
 			      &peer->session, peer->role);
     if (err < 0) {
@@ -3689,7 +5154,7 @@ handle_alert(dtls_context_t *ctx, dtls_peer_t *peer,
   if (data[0] == DTLS_ALERT_LEVEL_FATAL || data[1] == DTLS_ALERT_CLOSE_NOTIFY) {
     dtls_alert("%d invalidate peer\n", data[1]);
 
-    delete_peer(&ctx->peers, peer);
+    dtls_remove_peer(ctx, peer);
 
     dtls_debug_session("removed peer", &peer->session);
 
@@ -3752,19 +5217,34 @@ static int dtls_alert_send_from_err(dtls_context_t *ctx, dtls_peer_t *peer,
 /** 
  * Handles incoming data as DTLS message from given peer.
  */
-int
-dtls_handle_message(dtls_context_t *ctx, 
-		    session_t *session,
-		    uint8_t *msg, int msglen) {
-  dtls_peer_t *peer = NULL;
-  unsigned int rlen;		/* record length */
-  uint8_t *data; 			/* (decrypted) payload */
-  int data_length;		/* length of decrypted payload 
-				   (without MAC and padding) */
-  int err;
+/** Application data collected by dtls_handle_messages(). */
+typedef struct {
+  dtls_message_t records[DTLS_READ_BATCH_MAX];
+  size_t count;
+  int collect;		/**< collect records for the read_batch() callback */
+  /** set when other than application data was handled, or when an
+   * application callback may have closed or reset the peer */
+  int peer_changed;
+} dtls_read_batch_t;
+
+/* Passes the collected records to the read_batch() callback. Returns
+ * 1 if the callback has been called, so that the peer must be looked
+ * up again. */
+static int
+dtls_flush_read_batch(dtls_context_t *ctx, dtls_read_batch_t *batch) {
+  if (batch && batch->count) {
+    CALL(ctx, read_batch, batch->records, batch->count);
+    batch->count = 0;
+    batch->peer_changed = 1;
+    return 1;
+  }
+  return 0;
+}
 
+static dtls_peer_t *
+dtls_lookup_peer(dtls_context_t *ctx, session_t *session) {
   /* check if we have DTLS state for addr/port/ifindex */
-  peer = dtls_get_peer(ctx, session);
+  dtls_peer_t *peer = dtls_get_peer(ctx, session);
 
   if (!peer) {
     dtls_debug("dtls_handle_message: PEER NOT FOUND\n");
@@ -3772,12 +5252,48 @@ dtls_handle_message(dtls_context_t *ctx,
   } else {
     dtls_debug("dtls_handle_message: FOUND PEER\n");
   }
+  return peer;
+}
+
+/**
+ * Handles the records in @p msg from @p peer, which is NULL if
+ * there is no DTLS state for @p session yet. If @p batch is not
+ * NULL, it tracks whether records other than application data were
+ * handled, and if it collects records, application data is added to
+ * @p batch instead of being delivered with the read() callback.
+ */
+static int
+dtls_handle_records(dtls_context_t *ctx, session_t *session,
+		    dtls_peer_t *peer, uint8_t *msg, int msglen,
+		    dtls_read_batch_t *batch) {
+  unsigned int rlen;		/* record length */
+  uint8_t *data; 			/* (decrypted) payload */
+  int data_length;		/* length of decrypted payload 
+				   (without MAC and padding) */
+  int err;
 
   while ((rlen = is_record(msg,msglen))) {
     dtls_peer_type role;
     dtls_state_t state;
 
     dtls_debug("got packet %d (%d bytes)\n", msg[0], rlen);
+
+#ifdef DTLS_ECC
+    if (crypto_job_pending(peer)) {
+      /* keep the remaining records until the handshake is resumed */
+      crypto_job_defer(peer, msg, msglen);
+      return 0;
+    }
+#endif /* DTLS_ECC */
+
+    /* Keep application data and events in order. Other records may
+     * also invalidate peers, so the caller has to look them up
+     * again. */
+    if (batch && msg[0] != DTLS_CT_APPLICATION_DATA) {
+      if (dtls_flush_read_batch(ctx, batch))
+	peer = dtls_get_peer(ctx, session);
+      batch->peer_changed = 1;
+    }
     if (peer) {
       data_length = decrypt_verify(peer, msg, rlen, &data);
       if (data_length < 0) {
@@ -3863,10 +5379,19 @@ dtls_handle_message(dtls_context_t *ctx,
 	/* The new security parameters must be used for all messages
 	 * that are sent after the ChangeCipherSpec message. This
 	 * means that the client's Finished message uses epoch + 1
-	 * while the server is still in the old epoch.
+	 * while the server is still in the old epoch. In an
+	 * abbreviated handshake, the server sends its Finished
+	 * message first. A NewSessionTicket that the server sends
+	 * before its ChangeCipherSpec in a full handshake arrives
+	 * when the client already uses the new epoch.
 	 */
-	if (role == DTLS_SERVER && state == DTLS_STATE_WAIT_FINISHED) {
+	if (state == DTLS_STATE_WAIT_FINISHED && peer->handshake_params &&
+	    (role == DTLS_SERVER) != peer->handshake_params->abbreviated) {
 	  expected_epoch++;
+	} else if (state == DTLS_STATE_WAIT_CHANGECIPHERSPEC &&
+		   role == DTLS_CLIENT && peer->handshake_params &&
+		   !peer->handshake_params->abbreviated && expected_epoch) {
+	  expected_epoch--;
 	}
 
 	if (expected_epoch != msg_epoch) {
@@ -3887,7 +5412,8 @@ dtls_handle_message(dtls_context_t *ctx,
 	dtls_alert_send_from_err(ctx, peer, session, err);
 	return err;
       }
-      if (peer && peer->state == DTLS_STATE_CONNECTED) {
+      if (peer && peer->state == DTLS_STATE_CONNECTED &&
+	  !crypto_job_pending(peer)) {
 	/* stop retransmissions */
 	dtls_stop_retransmission(ctx, peer);
 	CALL(ctx, event, &peer->session, 0, DTLS_EVENT_CONNECTED);
@@ -3902,7 +5428,21 @@ dtls_handle_message(dtls_context_t *ctx,
         return -1;
       }
       dtls_stop_retransmission(ctx, peer);
-      CALL(ctx, read, &peer->session, data, data_length);
+      if (batch && batch->collect) {
+	batch->records[batch->count].session = session;
+	batch->records[batch->count].data = data;
+	batch->records[batch->count].length = data_length;
+	if (++batch->count == DTLS_READ_BATCH_MAX &&
+	    dtls_flush_read_batch(ctx, batch))
+	  peer = dtls_get_peer(ctx, session);
+      } else {
+	CALL(ctx, read, &peer->session, data, data_length);
+	if (batch) {
+	  /* the callback may have closed or reset the peer */
+	  batch->peer_changed = 1;
+	  peer = dtls_get_peer(ctx, session);
+	}
+      }
       break;
     default:
       dtls_info("dropped unknown message of type %d\n",msg[0]);
@@ -3916,6 +5456,115 @@ dtls_handle_message(dtls_context_t *ctx,
   return 0;
 }
 
+int
+dtls_handle_message(dtls_context_t *ctx, 
+		    session_t *session,
+		    uint8_t *msg, int msglen) {
+  dtls_update_keys(ctx);
+  return dtls_handle_records(ctx, session, dtls_lookup_peer(ctx, session),
+			     msg, msglen, NULL);
+}
+
+#ifdef DTLS_ECC
+int
+dtls_crypto_job_complete(dtls_context_t *ctx, dtls_crypto_job_t *job) {
+  dtls_handshake_parameters_t *handshake = job->handshake;
+  dtls_peer_t *peer = job->peer;
+  netq_t *msg, *deferred, *node;
+  session_t session;
+  int err = 0;
+
+  if (!handshake) {
+    /* the handshake has been given up meanwhile */
+    dtls_crypto_job_free(job);
+    return 0;
+  }
+  assert(handshake->crypto_job == job);
+
+  job->done = 1;
+  msg = handshake->resume_msg;
+  handshake->resume_msg = NULL;
+  deferred = handshake->deferred;
+  handshake->deferred = NULL;
+  memcpy(&session, &peer->session, sizeof(session_t));
+
+  if (job->type == DTLS_CRYPTO_JOB_SIGN) {
+    /* continue the reply to the ClientHello */
+    err = dtls_send_server_flight(ctx, peer);
+    if (err >= 0)
+      handshake->hs_state.mseq_r++;
+  } else if (msg) {
+    /* handle the message again, this time it picks up the result */
+    err = handle_handshake(ctx, peer, &peer->session, peer->role,
+			   peer->state, msg->data, msg->length);
+  } else {
+    handshake->crypto_job = NULL;
+    dtls_crypto_job_free(job);
+  }
+
+  if (msg)
+    netq_node_free(msg);
+
+  if (err < 0) {
+    dtls_warn("error while resuming handshake\n");
+    dtls_alert_send_from_err(ctx, peer, &peer->session, err);
+    netq_delete_all(&deferred);
+    return err;
+  }
+  if (peer->state == DTLS_STATE_CONNECTED) {
+    dtls_stop_retransmission(ctx, peer);
+    CALL(ctx, event, &peer->session, 0, DTLS_EVENT_CONNECTED);
+  }
+
+  /* Now the records that have arrived meanwhile. A record may start
+   * another crypto job, the rest is deferred again then, within the
+   * limit of crypto_job_defer(). */
+  while ((node = netq_pop_first(&deferred))) {
+    peer = dtls_get_peer(ctx, &session);
+    if (crypto_job_pending(peer))
+      crypto_job_defer(peer, node->data, node->length);
+    else
+      dtls_handle_records(ctx, &session, peer, node->data, node->length, NULL);
+    netq_node_free(node);
+  }
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+int
+dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+		     size_t count) {
+  dtls_read_batch_t batch;
+  dtls_peer_t *peer = NULL;
+  session_t *last = NULL;
+  int failed = 0;
+  size_t i;
+
+  dtls_update_keys(ctx);
+
+  batch.count = 0;
+  batch.collect = ctx->h && ctx->h->read_batch;
+  for (i = 0; i < count; i++) {
+    /* re-use the peer of the previous datagram if that contained
+     * application data only and no application callback has run */
+    if (!last || !dtls_session_equals(last, msgs[i].session))
+      peer = dtls_lookup_peer(ctx, msgs[i].session);
+    last = msgs[i].session;
+
+    batch.peer_changed = 0;
+    if (dtls_handle_records(ctx, msgs[i].session, peer, msgs[i].data,
+			    msgs[i].length, &batch) < 0) {
+      failed++;
+      last = NULL;
+    } else if (batch.peer_changed) {
+      last = NULL;
+    }
+  }
+  dtls_flush_read_batch(ctx, &batch);
+
+  return failed;
+}
+
 dtls_context_t *
 dtls_new_context(void *app_data) {
   dtls_context_t *c;
@@ -3935,6 +5584,15 @@ dtls_new_context(void *app_data) {
     c->cookie_secret_age = now;
   else 
     goto error;
+  dtls_update_cookie_keys(c, 1);
+
+#if DTLS_SESSION_TICKETS
+  /* both keys are random, so that no ticket is accepted for the
+   * previous key before one has been set */
+  if (!dtls_fill_random(c->ticket_keys[0], sizeof(c->ticket_keys)))
+    goto error;
+  c->ticket_key_age = now;
+#endif /* DTLS_SESSION_TICKETS */
   
   return c;
 
@@ -3951,15 +5609,72 @@ void dtls_reset_peer(dtls_context_t *ctx, dtls_peer_t *peer)
     dtls_destroy_peer(ctx, peer, 1);
 }
 
+dtls_peer_t *
+dtls_detach_peer(dtls_context_t *ctx, const session_t *session) {
+  dtls_peer_t *peer = dtls_get_peer(ctx, session);
+
+  if (!peer || crypto_job_pending(peer)) {
+    return NULL;
+  }
+
+  /* the pending retransmissions go with the peer */
+  netq_queue_detach_peer(&ctx->sendqueue, peer);
+  dtls_remove_peer(ctx, peer);
+  return peer;
+}
+
+int
+dtls_attach_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  netq_t *node;
+  dtls_tick_t now;
+
+  if (dtls_add_peer(ctx, peer) < 0) {
+    dtls_warn("cannot attach peer\n");
+    dtls_free_peer(peer);
+    return -1;
+  }
+
+  if (peer->sendqueue) {
+    netq_queue_attach_peer(&ctx->sendqueue, peer);
+    node = netq_queue_head(&ctx->sendqueue);
+    dtls_ticks(&now);
+    dtls_set_retransmit_timer(ctx, node->t > now ? node->t - now : 0);
+  }
+  return 0;
+}
+
+void
+dtls_set_cookie_secret(dtls_context_t *ctx, const unsigned char *secret) {
+  assert(ctx);
+
+  memcpy(ctx->cookie_secret, secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_ticks(&ctx->cookie_secret_age);
+  dtls_update_cookie_keys(ctx, 1);
+}
+
+#if DTLS_SESSION_TICKETS
+void
+dtls_set_ticket_key(dtls_context_t *ctx, const unsigned char *key) {
+  assert(ctx);
+
+  ctx->ticket_key ^= 1;
+  memcpy(ctx->ticket_keys[ctx->ticket_key], key, DTLS_TICKET_KEY_LENGTH);
+  ctx->ticket_key_shared = 1;
+  dtls_ticks(&ctx->ticket_key_age);
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 void
 dtls_free_context(dtls_context_t *ctx) {
-  dtls_peer_t *p, *tmp;
+  dtls_peer_t *p;
 
   if (!ctx) {
     return;
   }
 
+#ifdef DTLS_PEERS_NOHASH
   if (ctx->peers) {
+    dtls_peer_t *tmp;
     //      LL_FOREACH_SAFE(ctx->peers, p, tmp) {
     p = ctx->peers;
     while(p) {
@@ -3968,12 +5683,39 @@ dtls_free_context(dtls_context_t *ctx) {
       p = tmp;
     }
   }
+#else /* DTLS_PEERS_NOHASH */
+  if (ctx->peers.count) {
+    size_t i;
+
+    /* Removing a peer may shift other entries of the table, so all
+     * peers are notified first and then released with the table. */
+    for (i = 0; i < ctx->peers.size; i++) {
+      p = ctx->peers.slots[i];
+      if (p && p->state != DTLS_STATE_CLOSED && p->state != DTLS_STATE_CLOSING)
+	dtls_close(ctx, &p->session);
+    }
+    for (i = 0; i < ctx->peers.size; i++) {
+      if (ctx->peers.slots[i])
+	dtls_destroy_peer(ctx, ctx->peers.slots[i], 0);
+    }
+  }
+  dtls_peer_table_free(&ctx->peers);
+#endif /* DTLS_PEERS_NOHASH */
 
+  netq_queue_delete_all(&ctx->sendqueue);
+#if DTLS_SESSION_CACHE_SIZE > 0
+  memset(ctx->session_cache, 0, sizeof(ctx->session_cache));
+#endif /* DTLS_SESSION_CACHE_SIZE */
   dtls_context_release(ctx);
 }
 
-int
-dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+/**
+ * Starts the handshake with @p peer as client and offers the session
+ * @p resumption if not NULL.
+ */
+static int
+dtls_connect_peer_resume(dtls_context_t *ctx, dtls_peer_t *peer,
+			 const dtls_resumption_t *resumption) {
   int res;
 
   assert(peer);
@@ -4001,6 +5743,23 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
 
   peer->handshake_params->hs_state.mseq_r = 0;
   peer->handshake_params->hs_state.mseq_s = 0;
+  if (resumption && resumption->id_length <= DTLS_SESSION_ID_LENGTH
+#if DTLS_SESSION_TICKETS
+      && resumption->ticket_length <= DTLS_SESSION_TICKET_MAX_LENGTH
+#endif /* DTLS_SESSION_TICKETS */
+      ) {
+    peer->handshake_params->resumption = *resumption;
+#if DTLS_SESSION_TICKETS
+    /* RFC 5077 recognizes the acceptance of a ticket by the echoed
+     * session ID, so the client needs one */
+    if (resumption->ticket_length && !resumption->id_length) {
+      if (!dtls_fill_random(peer->handshake_params->resumption.id,
+			    DTLS_SESSION_ID_LENGTH))
+        return -1;
+      peer->handshake_params->resumption.id_length = DTLS_SESSION_ID_LENGTH;
+    }
+#endif /* DTLS_SESSION_TICKETS */
+  }
   res = dtls_send_client_hello(ctx, peer, NULL, 0);
   if (res < 0)
     dtls_warn("cannot send ClientHello\n");
@@ -4010,8 +5769,19 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
   return res;
 }
 
+int
+dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  return dtls_connect_peer_resume(ctx, peer, NULL);
+}
+
 int
 dtls_connect(dtls_context_t *ctx, const session_t *dst) {
+  return dtls_connect_resume(ctx, dst, NULL);
+}
+
+int
+dtls_connect_resume(dtls_context_t *ctx, const session_t *dst,
+		    const dtls_resumption_t *state) {
   dtls_peer_t *peer;
   int res;
 
@@ -4025,7 +5795,7 @@ dtls_connect(dtls_context_t *ctx, const session_t *dst) {
     return -1;
   }
 
-  res = dtls_connect_peer(ctx, peer);
+  res = dtls_connect_peer_resume(ctx, peer, state);
 
   /* Invoke event callback to indicate connection attempt or
    * re-negotiation. */
@@ -4056,7 +5826,7 @@ dtls_retransmit(dtls_context_t *context, netq_t *node) {
       dtls_ticks(&now);
       node->retransmit_cnt++;
       node->t = now + (node->timeout << node->retransmit_cnt);
-      netq_insert_node(&context->sendqueue, node);
+      netq_queue_insert(&context->sendqueue, node);
       
       if (node->type == DTLS_CT_HANDSHAKE) {
 	dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
@@ -4091,34 +5861,25 @@ dtls_retransmit(dtls_context_t *context, netq_t *node) {
 
 static void
 dtls_stop_retransmission(dtls_context_t *context, dtls_peer_t *peer) {
-  netq_t *node;
-
   if(peer == NULL) {
     return;
   }
 
-  node = netq_head(&context->sendqueue);
-  while (node) {
-    if (dtls_session_equals(&node->peer->session, &peer->session)) {
-      netq_t *tmp = node;
-      node = netq_next(node);
-      netq_remove(&context->sendqueue, tmp);
-      netq_node_free(tmp);
-    } else
-      node = netq_next(node);    
-  }
+  netq_queue_delete_peer(&context->sendqueue, peer);
 }
 
 void
 dtls_check_retransmit(dtls_context_t *context, dtls_tick_t *next, int all) {
   dtls_tick_t now;
-  netq_t *node = netq_head(&context->sendqueue);
+  netq_t *node = netq_queue_head(&context->sendqueue);
+
+  dtls_update_keys(context);
 
   dtls_ticks(&now);
   while (node && node->t <= now) {
-    netq_pop_first(&context->sendqueue);
+    netq_queue_remove(&context->sendqueue, node);
     dtls_retransmit(context, node);
-    node = netq_head(&context->sendqueue);
+    node = netq_queue_head(&context->sendqueue);
     /* Check if we chould send out multiple or not */
     if(!all) break;
   }
@@ -28,6 +28,7 @@
 
 #include "dtls-state.h"
 #include "dtls-peer.h"
+#include "netq.h"
 
 #include "dtls-alert.h"
 #include "dtls-crypto.h"
@@ -57,6 +58,17 @@ typedef struct dtls_ecdsa_key_t {
 
 struct dtls_context_t;
 
+/**
+ * A datagram or the payload of a record together with the session it
+ * belongs to. Used to pass several of them at once, e.g. by
+ * dtls_handle_messages().
+ */
+typedef struct {
+  session_t *session;		/**< remote address and local interface */
+  uint8_t *data;		/**< the data */
+  size_t length;		/**< actual length of @p data */
+} dtls_message_t;
+
 /**
  * This structure contains callback functions used by tinydtls to
  * communicate with the application. At least the write function must
@@ -202,22 +214,174 @@ typedef struct {
 			  const unsigned char *other_pub_y,
 			  size_t key_size);
 #endif /* DTLS_ECC */
+
+  /**
+   * Optional. Called from dtls_handle_messages() to deliver the
+   * application data of several records at once instead of calling
+   * read() for each of them. The data is delivered only after
+   * decryption and verification have succeeded. The data pointers
+   * refer to the buffers passed to dtls_handle_messages() and are
+   * valid only during this call.
+   *
+   * @param ctx     The current DTLS context.
+   * @param records The received application data.
+   * @param count   The number of elements in @p records.
+   * @return ignored
+   */
+  int (*read_batch)(struct dtls_context_t *ctx,
+		    const dtls_message_t *records, size_t count);
+
+  /**
+   * Optional. Called from dtls_write_batch() to send several DTLS
+   * packets at once, e.g. with sendmmsg(). If not set, write() is
+   * called for each packet instead.
+   *
+   * @param ctx       The current DTLS context.
+   * @param datagrams The packets to send and their destinations.
+   * @param count     The number of elements in @p datagrams.
+   * @return The number of packets that were sent, or a value less
+   *         than zero to indicate an error.
+   */
+  int (*write_batch)(struct dtls_context_t *ctx,
+		     const dtls_message_t *datagrams, size_t count);
+
+  /**
+   * Optional. Called on a client when a full handshake has been
+   * completed and the server has issued a session ID or a session
+   * ticket, and when a resumed session has been given a new ticket.
+   * The application may keep @p state to resume the session later
+   * with dtls_connect_resume(), which saves the key exchange. @p state
+   * replaces the state kept before for this server. It contains the
+   * session's master secret and must be stored as securely as the
+   * long-term keys.
+   *
+   * @param ctx     The current DTLS context.
+   * @param session The session that has been established.
+   * @param state   The state to resume the session from.
+   * @return ignored
+   */
+  int (*store_resumption)(struct dtls_context_t *ctx,
+			  const session_t *session,
+			  const dtls_resumption_t *state);
+
+#ifdef DTLS_ECC
+  /**
+   * Optional. Called during an ECDHE-ECDSA handshake to hand an
+   * expensive ECC operation (signing, verifying a signature or ECDH)
+   * to an executor instead of computing it in dtls_handle_message().
+   * The executor must call dtls_crypto_job_run() for @p job, e.g. on
+   * a worker thread, and then pass it back with
+   * dtls_crypto_job_complete() on the thread that uses @p ctx. It must
+   * not do so from within this callback.
+   *
+   * The handshake with the peer is suspended until then. Records
+   * received from that peer meanwhile are kept and handled after the
+   * handshake has been resumed. Other peers are not affected.
+   *
+   * @param ctx The current DTLS context.
+   * @param job The job to run.
+   * @return @c 0 if the job was accepted, or a value less than zero
+   *         to compute it synchronously instead.
+   */
+  int (*submit_crypto_job)(struct dtls_context_t *ctx,
+			   dtls_crypto_job_t *job);
+#endif /* DTLS_ECC */
 } dtls_handler_t;
 
-struct netq_t;
+#ifndef DTLS_COOKIE_SECRET_LIFETIME
+/**
+ * Lifetime of a cookie secret generation in seconds. Cookies of the
+ * previous generation are still accepted, so that a cookie is valid
+ * for at most twice this time. @c 0 disables the rotation.
+ */
+#define DTLS_COOKIE_SECRET_LIFETIME 300
+#endif
+
+/** The number of cookie secret generations that are kept. */
+#define DTLS_COOKIE_KEYS 3
+
+/** A generation of the cookie secret as keyed HMAC snapshot. */
+typedef struct {
+  unsigned long tag;		/**< generation + 1, or 0 if not valid */
+  dtls_hmac_key_t key;		/**< HMAC keyed with the generation's secret */
+} dtls_cookie_key_t;
+
+#ifndef DTLS_SESSION_CACHE_SIZE
+#ifdef CONTIKI
+#define DTLS_SESSION_CACHE_SIZE 0
+#else /* CONTIKI */
+/**
+ * The number of sessions that a server keeps for resumption. Must be
+ * a power of two. 0 disables the cache, so that no session IDs are
+ * issued.
+ */
+#define DTLS_SESSION_CACHE_SIZE 64
+#endif /* CONTIKI */
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+#ifndef DTLS_SESSION_CACHE_LIFETIME
+/** Time in seconds for which a session can be resumed. */
+#define DTLS_SESSION_CACHE_LIFETIME 86400
+#endif
+
+/** The number of cache slots that are searched for a session ID. */
+#define DTLS_SESSION_CACHE_PROBES 4
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+/** A session kept by a server for resumption. */
+typedef struct {
+  dtls_tick_t expires;		/**< end of the lifetime, 0 if unused */
+  dtls_resumption_t state;	/**< the session */
+} dtls_session_cache_entry_t;
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+/** Length of the key that session tickets are encrypted with. */
+#define DTLS_TICKET_KEY_LENGTH 16
 
 /** Holds global information of the DTLS engine. */
 typedef struct dtls_context_t {
+  /**
+   * The secret that the cookie secret of each generation is derived
+   * from. Contexts with the same cookie_secret accept each other's
+   * cookies.
+   */
   unsigned char cookie_secret[DTLS_COOKIE_SECRET_LENGTH];
-  dtls_tick_t cookie_secret_age; /**< the time the secret has been generated */
-
-  dtls_peer_t *peers;		/**< peer hash map */
+  dtls_tick_t cookie_secret_age; /**< the time the secret has been set */
+  unsigned long cookie_generation; /**< generation of cookie_keys */
+  /** previous, current and next generation, indexed by generation */
+  dtls_cookie_key_t cookie_keys[DTLS_COOKIE_KEYS];
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+  /** the sessions issued by this server, indexed by their ID */
+  dtls_session_cache_entry_t session_cache[DTLS_SESSION_CACHE_SIZE];
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+#if DTLS_SESSION_TICKETS
+  /** The keys that session tickets are encrypted with. The current
+   * key is ticket_keys[ticket_key], the other one is the previous key,
+   * which is still accepted. */
+  unsigned char ticket_keys[2][DTLS_TICKET_KEY_LENGTH];
+  unsigned int ticket_key;
+  /** The key has been set with dtls_set_ticket_key() and is replaced
+   * by its successor instead of a random key. */
+  unsigned int ticket_key_shared;
+  dtls_tick_t ticket_key_age;	/**< the time the current key has been set */
+  /** Session tickets are neither requested nor issued, see
+   * dtls_disable_session_tickets(). */
+  unsigned int tickets_disabled;
+#endif /* DTLS_SESSION_TICKETS */
+
+#ifdef DTLS_PEERS_NOHASH
+  dtls_peer_t *peers;		/**< peer list */
+#else /* DTLS_PEERS_NOHASH */
+  dtls_peer_table_t peers;	/**< peer hash map */
+#endif /* DTLS_PEERS_NOHASH */
 
 #ifdef DTLS_SUPPORT_CONF_CONTEXT_STATE
   DTLS_SUPPORT_CONF_CONTEXT_STATE support;
 #endif /* DTLS_SUPPORT_CONF_CONTEXT_STATE */
 
-  struct netq_t *sendqueue;     /**< the packets to send */
+  netq_queue_t sendqueue;       /**< the packets to send */
 
   void *app;                    /**< application-specific data */
 
@@ -240,6 +404,48 @@ dtls_context_t *dtls_new_context(void *app_data);
 /** Releases any storage that has been allocated for \p ctx. */
 void dtls_free_context(dtls_context_t *ctx);
 
+/**
+ * Replaces the cookie secret of @p ctx, e.g. to let several contexts
+ * accept the same cookies. The secret of each generation is derived
+ * from @p secret and the time, so that contexts with the same secret
+ * rotate their cookies in step. This must not be called while
+ * dtls_cookie_check() runs on another thread.
+ *
+ * @param ctx    The DTLS context.
+ * @param secret The new secret of DTLS_COOKIE_SECRET_LENGTH bytes.
+ */
+void dtls_set_cookie_secret(dtls_context_t *ctx, const unsigned char *secret);
+
+#if DTLS_SESSION_TICKETS
+/**
+ * Replaces the key that the session tickets of @p ctx are encrypted
+ * with, e.g. to let several servers accept each other's tickets.
+ * Tickets of the replaced key are still accepted until the key is
+ * replaced again. Unless DTLS_SESSION_TICKET_LIFETIME is 0, this
+ * happens after that time with a successor that is derived from
+ * @p key, so that contexts with the same key keep accepting each
+ * other's tickets. As a leaked key then reveals all later keys, the
+ * application should set new random keys regularly. Without a key
+ * set here, @p ctx uses a new random key after each lifetime.
+ *
+ * @param ctx    The DTLS context.
+ * @param key    The new key of DTLS_TICKET_KEY_LENGTH bytes.
+ */
+void dtls_set_ticket_key(dtls_context_t *ctx, const unsigned char *key);
+
+/**
+ * Disables session tickets for @p ctx. As a client, @p ctx does not
+ * send the SessionTicket extension, so that a server resumes its
+ * sessions from the session cache. As a server, @p ctx ignores the
+ * extension and issues session IDs instead of tickets.
+ *
+ * @param ctx    The DTLS context.
+ */
+static inline void dtls_disable_session_tickets(dtls_context_t *ctx) {
+  ctx->tickets_disabled = 1;
+}
+#endif /* DTLS_SESSION_TICKETS */
+
 #define dtls_set_app_data(CTX,DATA) ((CTX)->app = (DATA))
 #define dtls_get_app_data(CTX) ((CTX)->app)
 
@@ -262,6 +468,22 @@ static inline void dtls_set_handler(dtls_context_t *ctx,
  */
 int dtls_connect(dtls_context_t *ctx, const session_t *dst);
 
+/**
+ * Establishes a DTLS channel with @p dst like dtls_connect(), but
+ * offers to resume the session given by @p state, which has been
+ * passed to the store_resumption() callback before. If the server
+ * still knows the session or accepts its session ticket, an
+ * abbreviated handshake without key exchange is performed.
+ * Otherwise, the server continues with a full handshake.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param dst    The remote party to connect to.
+ * @param state  The session to resume, or NULL for a full handshake.
+ * @return A value less than zero on error, greater or equal otherwise.
+ */
+int dtls_connect_resume(dtls_context_t *ctx, const session_t *dst,
+			const dtls_resumption_t *state);
+
 /**
  * Establishes a DTLS channel with the specified remote peer.
  * This function returns @c 0 if that channel already exists, a value
@@ -296,6 +518,86 @@ int dtls_renegotiate(dtls_context_t *ctx, const session_t *dst);
 int dtls_write(struct dtls_context_t *ctx, session_t *session, 
 	       uint8_t *buf, size_t len);
 
+/**
+ * Space that must be reserved in front of the payload passed to
+ * dtls_write_inplace(): the record header (13 bytes) and the
+ * explicit nonce (8 bytes).
+ */
+#define DTLS_WRITE_HEADROOM (13 + 8)
+
+/** Space that must be reserved after the payload passed to
+ * dtls_write_inplace() for the MAC (8 bytes for AES-128-CCM-8). */
+#define DTLS_WRITE_TAILROOM 8
+
+/**
+ * Largest payload that dtls_write_inplace() and dtls_write_batch() put
+ * into one record: a record must fit into DTLS_MAX_BUF, and its
+ * plaintext must not exceed 2^14 bytes (RFC 6347, Section 4.1 and RFC 5246, Section
+ * 6.2.1).
+ */
+#if DTLS_MAX_BUF - DTLS_WRITE_HEADROOM - DTLS_WRITE_TAILROOM > 16384
+#define DTLS_WRITE_MAX_PAYLOAD 16384
+#else
+#define DTLS_WRITE_MAX_PAYLOAD \
+  (DTLS_MAX_BUF - DTLS_WRITE_HEADROOM - DTLS_WRITE_TAILROOM)
+#endif
+
+/**
+ * Writes application data to the peer specified by @p session like
+ * dtls_write(), but without copying the data. The payload of @p len
+ * bytes must start at @p buf + DTLS_WRITE_HEADROOM, and @p buflen,
+ * the total size of @p buf, must be at least DTLS_WRITE_HEADROOM +
+ * @p len + DTLS_WRITE_TAILROOM. @p len must not exceed
+ * DTLS_WRITE_MAX_PAYLOAD. The record is created and encrypted in
+ * place and @p buf is handed to the write callback.
+ *
+ * @param ctx      The DTLS context to use.
+ * @param session  The remote transport address and local interface.
+ * @param buf      The buffer holding the payload.
+ * @param buflen   The total size of @p buf.
+ * @param len      The actual length of the payload.
+ *
+ * @return The number of bytes written or a value less than zero on
+ *         error. The contents of @p buf are undefined afterwards.
+ */
+int dtls_write_inplace(struct dtls_context_t *ctx, session_t *session,
+		       uint8_t *buf, size_t buflen, size_t len);
+
+#ifndef DTLS_WRITE_BATCH_MAX
+/** Maximum number of packets passed with one write_batch() call. */
+#define DTLS_WRITE_BATCH_MAX 16
+#endif
+
+#ifndef DTLS_WRITE_BATCH_BUF
+/** Size of the buffer where dtls_write_batch() collects records. */
+#define DTLS_WRITE_BATCH_BUF (4 * DTLS_MAX_BUF)
+#endif
+
+/**
+ * Writes application data to several peers like dtls_write(). One
+ * record is created for each element of @p msgs. The records are
+ * passed to the transport with as few write_batch() calls as
+ * possible, or with write() if write_batch() is not set. For sessions
+ * without a connected peer, the same rules as for dtls_write()
+ * apply, i.e. a connection is initiated and no data is sent.
+ *
+ * Messages longer than DTLS_WRITE_MAX_PAYLOAD are skipped. The batch
+ * stops at the first error, or when the transport does not take all
+ * records passed to it. The records that have been prepared before
+ * are still sent. @p msgs is not modified.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param msgs   The payloads and their destination sessions.
+ * @param count  The number of elements in @p msgs.
+ * @return The number of leading elements of @p msgs that have been
+ *         handled, i.e. sent or skipped, or a value less than zero if
+ *         an error occurred at the first element. If the result is
+ *         less than @p count, the caller may retry with the remaining
+ *         elements.
+ */
+int dtls_write_batch(struct dtls_context_t *ctx, dtls_message_t *msgs,
+		     size_t count);
+
 /**
  * Checks sendqueue of given DTLS context object for any outstanding
  * packets to be transmitted. 
@@ -331,6 +633,7 @@ typedef struct __attribute__((__packed__)) {
 #define DTLS_HT_CLIENT_HELLO         1
 #define DTLS_HT_SERVER_HELLO         2
 #define DTLS_HT_HELLO_VERIFY_REQUEST 3
+#define DTLS_HT_NEW_SESSION_TICKET   4
 #define DTLS_HT_CERTIFICATE         11
 #define DTLS_HT_SERVER_KEY_EXCHANGE 12
 #define DTLS_HT_CERTIFICATE_REQUEST 13
@@ -391,6 +694,91 @@ int dtls_record_read(dtls_state_t *state, uint8_t *msg, int msglen);
 int dtls_handle_message(dtls_context_t *ctx, session_t *session,
 			uint8_t *msg, int msglen);
 
+#ifndef DTLS_READ_BATCH_MAX
+/** Maximum number of records delivered with one read_batch() call. */
+#define DTLS_READ_BATCH_MAX 32
+#endif
+
+/**
+ * Handles several incoming datagrams like dtls_handle_message().
+ * Consecutive datagrams from the same session share the peer lookup.
+ * If the read_batch() callback is set, the application data is
+ * collected and passed on with as few calls as possible, otherwise
+ * read() is called for each record. Application data is always
+ * delivered before any event that is caused by a later record.
+ *
+ * @param ctx   The dtls context to use.
+ * @param msgs  The received datagrams. Application data is decrypted
+ *              in place.
+ * @param count The number of elements in @p msgs.
+ * @return The number of datagrams that could not be handled
+ *         successfully.
+ */
+int dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+			 size_t count);
+
+/** The size of the Hello Verify Request record created by dtls_cookie_check(). */
+#define DTLS_HELLO_VERIFY_LENGTH					\
+  (sizeof(dtls_record_header_t) + sizeof(dtls_handshake_header_t)	\
+   + sizeof(dtls_hello_verify_t) + DTLS_COOKIE_LENGTH)
+
+/** Return values of dtls_cookie_check(). */
+#define DTLS_COOKIE_PASS         0 /**< not an initial Client Hello */
+#define DTLS_COOKIE_VALID        1 /**< Client Hello with valid cookie */
+#define DTLS_COOKIE_HELLO_VERIFY 2 /**< Hello Verify Request created */
+
+/**
+ * Checks the cookie of a Client Hello in the datagram @p msg without
+ * looking at the peers of @p ctx. This allows a server to answer or
+ * drop Client Hello floods before they reach dtls_handle_message().
+ * The function reads only the cookie keys of @p ctx and does not
+ * allocate memory, so it can be called from any thread at the same
+ * time as the thread that uses @p ctx. Cookies of the current and the
+ * previous secret generation are accepted.
+ *
+ * If the datagram starts with an unencrypted Client Hello without a
+ * valid cookie, the matching Hello Verify Request record is written
+ * to @p reply and must be sent back to @p session by the caller. A
+ * datagram with a valid cookie must be passed to
+ * dtls_handle_message() as usual, which checks the cookie again.
+ *
+ * @param ctx          The dtls context whose cookie secret is used.
+ * @param session      The sender of @p msg.
+ * @param msg          The received datagram.
+ * @param msglen       The length of @p msg.
+ * @param reply        Buffer for the Hello Verify Request.
+ * @param reply_length Holds the size of @p reply, which must be at
+ *                     least DTLS_HELLO_VERIFY_LENGTH bytes, and is
+ *                     set to the length of the record.
+ * @return @c DTLS_COOKIE_PASS if @p msg does not start with an
+ *         initial Client Hello and must be handled by the engine,
+ *         @c DTLS_COOKIE_VALID if the cookie is valid,
+ *         @c DTLS_COOKIE_HELLO_VERIFY if @p reply must be sent, or a
+ *         value less than zero if the Client Hello is malformed and
+ *         the datagram should be dropped.
+ */
+int dtls_cookie_check(const dtls_context_t *ctx, const session_t *session,
+		      const uint8_t *msg, size_t msglen,
+		      uint8_t *reply, size_t *reply_length);
+
+#ifdef DTLS_ECC
+/**
+ * Resumes the handshake that waits for @p job, which has been passed
+ * to the submit_crypto_job() callback and run with
+ * dtls_crypto_job_run(). Records of that peer that have been received
+ * meanwhile are handled as well. This must be called on the thread
+ * that uses @p ctx. If the handshake has been given up in the
+ * meantime, e.g. because the peer or @p ctx was freed, the job is only
+ * released.
+ *
+ * @param ctx The DTLS context that submitted @p job.
+ * @param job The finished job.
+ * @return A value less than zero if the handshake failed, zero
+ *         otherwise.
+ */
+int dtls_crypto_job_complete(dtls_context_t *ctx, dtls_crypto_job_t *job);
+#endif /* DTLS_ECC */
+
 /**
  * Check if @p session is associated with a peer object in @p context.
  * This function returns a pointer to the peer if found, NULL otherwise.
@@ -411,6 +799,32 @@ dtls_peer_t *dtls_get_peer(const dtls_context_t *context,
  */
 void dtls_reset_peer(dtls_context_t *context, dtls_peer_t *peer);
 
+/**
+ * Removes the peer for @p session from @p context without closing the
+ * connection, so that it can be handed to another context with
+ * dtls_attach_peer(). Retransmissions that are still pending for the
+ * peer are kept with it and continue in the new context. A peer whose
+ * handshake waits for a crypto job cannot be detached.
+ *
+ * @param context  The DTLS context that holds the peer.
+ * @param session  The session of the peer.
+ * @return The detached peer, or NULL if there is no such peer or it
+ *  cannot be detached now.
+ */
+dtls_peer_t *dtls_detach_peer(dtls_context_t *context,
+			      const session_t *session);
+
+/**
+ * Adds @p peer that has been detached from another context with
+ * dtls_detach_peer() to @p context, together with its pending
+ * retransmissions. On error, the peer is released.
+ *
+ * @param context  The DTLS context to take the peer.
+ * @param peer     The peer to add.
+ * @return @c 0 on success, or a value less than zero on error.
+ */
+int dtls_attach_peer(dtls_context_t *context, dtls_peer_t *peer);
+
 #endif /* _DTLS_DTLS_H_ */
 
 /**
@@ -145,10 +145,74 @@
 /** Defined to 1 if tinydtls is built with support for ECC */
 #define DTLS_ECC 1
 
+#ifndef DTLS_ECDH_POOL_SIZE
+#ifdef CONTIKI
+#define DTLS_ECDH_POOL_SIZE 0
+#else /* CONTIKI */
+/** The maximum number of precomputed ephemeral ECDH key pairs, see
+ * dtls_ecdh_pool_refill(). 0 disables the pool. */
+#define DTLS_ECDH_POOL_SIZE 16
+#endif /* CONTIKI */
+#endif /* DTLS_ECDH_POOL_SIZE */
+
+#ifndef DTLS_ECDSA_PRESIG_POOL_SIZE
+#ifdef CONTIKI
+#define DTLS_ECDSA_PRESIG_POOL_SIZE 0
+#else /* CONTIKI */
+/** The maximum number of precomputed ECDSA presignatures, see
+ * dtls_ecdsa_presig_pool_refill(). 0 disables the pool. */
+#define DTLS_ECDSA_PRESIG_POOL_SIZE 8
+#endif /* CONTIKI */
+#endif /* DTLS_ECDSA_PRESIG_POOL_SIZE */
+
+#ifndef DTLS_CRYPTO_JOB_MAX
+/** The maximum number of handshake crypto jobs handed to the
+ * submit_crypto_job() callback at the same time. */
+#define DTLS_CRYPTO_JOB_MAX DTLS_HANDSHAKE_MAX
+#endif
+
+#ifndef DTLS_CRYPTO_JOB_DEFER_MAX
+/** The maximum number of datagrams kept for a peer whose handshake
+ * waits for a crypto job. */
+#define DTLS_CRYPTO_JOB_DEFER_MAX 4
+#endif
+
+#ifndef DTLS_SESSION_TICKETS
+#ifdef CONTIKI
+#define DTLS_SESSION_TICKETS 0
+#else /* CONTIKI */
+/** Defined to 1 to support session tickets (RFC 5077) as client and
+ * as server. */
+#define DTLS_SESSION_TICKETS 1
+#endif /* CONTIKI */
+#endif /* DTLS_SESSION_TICKETS */
+
+#ifndef DTLS_SESSION_TICKET_MAX_LENGTH
+/** The maximum length of a session ticket that a client keeps. */
+#define DTLS_SESSION_TICKET_MAX_LENGTH 128
+#endif
+
+#ifndef DTLS_SESSION_TICKET_LIFETIME
+/** Time in seconds after which a server replaces its ticket key. The
+ * tickets of the previous key are still accepted, so that a ticket is
+ * valid for at most twice this time. 0 disables the rotation. */
+#define DTLS_SESSION_TICKET_LIFETIME 3600
+#endif
+
 /** Defined to 1 if tinydtls is built with support for PSK */
 #define DTLS_PSK 1
 
-/** do not use uthash hash tables */
+#ifdef CONTIKI
+/** Keep the peers in a plain list instead of the hash-indexed peer
+ * table. The table grows dynamically and is of no use for the few
+ * peers supported on constrained devices. */
 #define DTLS_PEERS_NOHASH 1
+#endif /* CONTIKI */
+
+#ifndef DTLS_PEER_TABLE_MIN_SIZE
+/** Initial (and minimum) number of slots in the peer table. Must be
+ * a power of two. */
+#define DTLS_PEER_TABLE_MIN_SIZE 16
+#endif
 
 #define DTLS_CHECK_CONTENTTYPE 1
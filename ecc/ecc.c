@@ -40,6 +40,21 @@
 #include "ecc.h"
 #include <string.h>
 
+#if !defined(ECC_NO_G_TABLE) && !defined(ECC_GEN_TABLE)
+#include "ecc_g_table.h"
+#endif
+
+/*
+ * On 64-bit hosts whose compiler has a 128-bit integer type, field
+ * multiplication and the reduction mod p use 4 x 64-bit limbs. The
+ * numbers stay uint32_t[8] at the API, only the arithmetic differs.
+ * Define ECC_NO_64BIT_LIMBS to use the 32-bit code anyway.
+ */
+#if defined(__SIZEOF_INT128__) && !defined(ECC_NO_64BIT_LIMBS)
+#define ECC_64BIT_LIMBS 1
+typedef unsigned __int128 uint128_t;
+#endif
+
 static uint32_t add( const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_t length){
 	uint64_t d = 0; //carry
 	int v = 0;
@@ -134,6 +149,7 @@ static int isGreater(const uint32_t *A, const uint32_t *B, uint8_t length){
 }
 
 
+#if !defined(ECC_64BIT_LIMBS) || defined(TEST_INCLUDE)
 static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reducer, uint32_t *result){
 	if(add(x, y, result, arrayLength)){ //add prime if carry is still set!
 		uint32_t tempas[8];
@@ -143,6 +159,7 @@ static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reduce
 	}
 	return 0;
 }
+#endif
 
 static int fieldSub(const uint32_t *x, const uint32_t *y, const uint32_t *modulus, uint32_t *result){
 	if(sub(x, y, result, arrayLength)){ //add modulus if carry is set
@@ -154,9 +171,56 @@ static int fieldSub(const uint32_t *x, const uint32_t *y, const uint32_t *modulu
 	return 0;
 }
 
+#ifdef ECC_64BIT_LIMBS
+static const uint64_t ecc_prime_m64[4] = {0xFFFFFFFFFFFFFFFFULL, 0x00000000FFFFFFFFULL,
+					  0x0000000000000000ULL, 0xFFFFFFFF00000001ULL};
+
+static void load64(const uint32_t *x, uint64_t *l){
+	int i;
+	for (i = 0; i < 4; i++)
+		l[i] = (uint64_t)x[2 * i] | (uint64_t)x[2 * i + 1] << 32;
+}
+
+static void store64(const uint64_t *l, uint32_t *x, int n){
+	int i;
+	for (i = 0; i < n; i++){
+		x[2 * i] = (uint32_t)l[i];
+		x[2 * i + 1] = (uint32_t)(l[i] >> 32);
+	}
+}
+
+//256bit * 256bit = 512bit with 64bit limbs
+static void fieldMult64(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint64_t a[4], b[4], r[8];
+	uint128_t t;
+	uint64_t carry;
+	int i, j;
+
+	load64(x, a);
+	load64(y, b);
+	memset(r, 0, sizeof(r));
+	for (i = 0; i < 4; i++){
+		carry = 0;
+		for (j = 0; j < 4; j++){
+			t = (uint128_t)a[i] * b[j] + r[i + j] + carry;
+			r[i + j] = (uint64_t)t;
+			carry = (uint64_t)(t >> 64);
+		}
+		r[i + 4] = carry;
+	}
+	store64(r, result, 8);
+}
+#endif /* ECC_64BIT_LIMBS */
+
 //finite Field multiplication
 //32bit * 32bit = 64bit
 static int fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_t length){
+#ifdef ECC_64BIT_LIMBS
+	if (length == arrayLength){
+		fieldMult64(x, y, result);
+		return 0;
+	}
+#endif
 	uint32_t temp[length * 2];
 	setZero(temp, length * 2);
 	setZero(result, length * 2);
@@ -175,6 +239,70 @@ static int fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uin
 	return 0;
 }
 
+#ifdef ECC_64BIT_LIMBS
+/*
+ * A = B mod p for a 512 bit B with the Solinas reduction from FIPS
+ * 186-4, D.2.3. p256 is a sum of powers of 2^32, so B mod p is a
+ * signed sum of the 32-bit words of B, each result word gets at most
+ * nine terms. These are accumulated in 64 bits with one carry pass,
+ * then the carry out of the top word is folded back in.
+ */
+static void fieldModP(uint32_t *A, const uint32_t *B)
+{
+	const int64_t c0 = B[0], c1 = B[1], c2 = B[2], c3 = B[3];
+	const int64_t c4 = B[4], c5 = B[5], c6 = B[6], c7 = B[7];
+	const int64_t c8 = B[8], c9 = B[9], c10 = B[10], c11 = B[11];
+	const int64_t c12 = B[12], c13 = B[13], c14 = B[14], c15 = B[15];
+	int64_t w[8];
+	int64_t carry;
+	uint64_t a[4], r[4], borrow;
+	uint128_t t;
+	int i;
+
+	/* T + 2 S1 + 2 S2 + S3 + S4 - D1 - D2 - D3 - D4 */
+	w[0] = c0 + c8 + c9 - c11 - c12 - c13 - c14;
+	w[1] = c1 + c9 + c10 - c12 - c13 - c14 - c15;
+	w[2] = c2 + c10 + c11 - c13 - c14 - c15;
+	w[3] = c3 + 2 * c11 + 2 * c12 + c13 - c15 - c8 - c9;
+	w[4] = c4 + 2 * c12 + 2 * c13 + c14 - c9 - c10;
+	w[5] = c5 + 2 * c13 + 2 * c14 + c15 - c10 - c11;
+	w[6] = c6 + 3 * c14 + 2 * c15 + c13 - c8 - c9;
+	w[7] = c7 + 3 * c15 + c8 - c10 - c11 - c12 - c13;
+
+	/*
+	 * 2^256 = 2^224 - 2^192 - 2^96 + 1 (mod p), so a carry c out of
+	 * the top word is added to word 0 and 7 and subtracted from word
+	 * 3 and 6. This converges after at most two more passes.
+	 */
+	carry = 0;
+	do {
+		w[0] += carry;
+		w[3] -= carry;
+		w[6] -= carry;
+		w[7] += carry;
+		carry = 0;
+		for (i = 0; i < 8; i++){
+			w[i] += carry;
+			carry = w[i] >> 32;	/* arithmetic shift, floor */
+			w[i] &= 0xFFFFFFFF;
+		}
+	} while (carry);
+
+	for (i = 0; i < 4; i++)
+		a[i] = (uint64_t)w[2 * i] | (uint64_t)w[2 * i + 1] << 32;
+
+	/* the value is below 2^256 < 2p now, subtract p if needed */
+	borrow = 0;
+	for (i = 0; i < 4; i++){
+		t = (uint128_t)a[i] - ecc_prime_m64[i] - borrow;
+		r[i] = (uint64_t)t;
+		borrow = (uint64_t)(t >> 64) & 1;
+	}
+	if (!borrow)
+		memcpy(a, r, sizeof(a));
+	store64(a, A, 4);
+}
+#else /* ECC_64BIT_LIMBS */
 //TODO: maximum:
 //fffffffe00000002fffffffe0000000100000001fffffffe00000001fffffffe00000001fffffffefffffffffffffffffffffffe000000000000000000000001_16
 static void fieldModP(uint32_t *A, const uint32_t *B)
@@ -251,6 +379,8 @@ static void fieldModP(uint32_t *A, const uint32_t *B)
 	}
 }
 
+#endif /* ECC_64BIT_LIMBS */
+
 /**
  * calculate the result = A mod n.
  * n is the order of the eliptic curve.
@@ -408,6 +538,11 @@ static void fieldInv(const uint32_t *A, const uint32_t *modulus, const uint32_t
 	}
 }
 
+#ifdef TEST_INCLUDE
+/*
+ * Affine point arithmetic, one field inversion per operation. Only
+ * the tests and gen_g_table.c still use it.
+ */
 void static ec_double(const uint32_t *px, const uint32_t *py, uint32_t *Dx, uint32_t *Dy){
 	uint32_t tempA[8];
 	uint32_t tempB[8];
@@ -487,29 +622,443 @@ void static ec_add(const uint32_t *px, const uint32_t *py, const uint32_t *qx, c
 	fieldModP(tempC, tempD);
 	fieldSub(tempC, qy, ecc_prime_m, Sy);
 }
+#endif /* TEST_INCLUDE */
 
-void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
-	uint32_t Qx[8];
-	uint32_t Qy[8];
-	setZero(Qx, 8);
-	setZero(Qy, 8);
+/*
+ * Point arithmetic in Jacobian coordinates: (X, Y, Z) represents the
+ * affine point (X / Z^2, Y / Z^3), Z = 0 is the point at infinity.
+ * This avoids the field inversion that ec_double() and ec_add() need
+ * for every step, only the conversion back to affine coordinates at
+ * the end of a scalar multiplication needs one.
+ */
+static void fieldMultP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint32_t tempD[16];
+	fieldMult(x, y, tempD, arrayLength);
+	fieldModP(result, tempD);
+}
 
-	uint32_t tempx[8];
-	uint32_t tempy[8];
+#ifdef ECC_64BIT_LIMBS
+/* result = x + y mod p for x, y < p */
+static void fieldAddP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint64_t a[4], b[4], r[4];
+	uint128_t t;
+	uint64_t carry = 0, borrow = 0;
+	int i;
+
+	load64(x, a);
+	load64(y, b);
+	for (i = 0; i < 4; i++){
+		t = (uint128_t)a[i] + b[i] + carry;
+		a[i] = (uint64_t)t;
+		carry = (uint64_t)(t >> 64);
+	}
+	for (i = 0; i < 4; i++){
+		t = (uint128_t)a[i] - ecc_prime_m64[i] - borrow;
+		r[i] = (uint64_t)t;
+		borrow = (uint64_t)(t >> 64) & 1;
+	}
+	store64(carry || !borrow ? r : a, result, 4);
+}
+
+/* result = x - y mod p for x, y < p */
+static void fieldSubP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint64_t a[4], b[4];
+	uint128_t t;
+	uint64_t carry = 0, borrow = 0;
+	int i;
+
+	load64(x, a);
+	load64(y, b);
+	for (i = 0; i < 4; i++){
+		t = (uint128_t)a[i] - b[i] - borrow;
+		a[i] = (uint64_t)t;
+		borrow = (uint64_t)(t >> 64) & 1;
+	}
+	if (borrow){
+		for (i = 0; i < 4; i++){
+			t = (uint128_t)a[i] + ecc_prime_m64[i] + carry;
+			a[i] = (uint64_t)t;
+			carry = (uint64_t)(t >> 64);
+		}
+	}
+	store64(a, result, 4);
+}
+#else /* ECC_64BIT_LIMBS */
+/* like fieldAdd() but the result is always less than p */
+static void fieldAddP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	fieldAdd(x, y, ecc_prime_r, result);
+	if(isGreater(result, ecc_prime_m, arrayLength) >= 0)
+		sub(result, ecc_prime_m, result, arrayLength);
+}
+
+static void fieldSubP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	fieldSub(x, y, ecc_prime_m, result);
+}
+#endif /* ECC_64BIT_LIMBS */
+
+/*
+ * (X, Y, Z) = 2 * (X, Y, Z), "dbl-2001-b" for a = -3 from
+ * https://hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-3.html
+ */
+static void ec_double_jacobian(uint32_t *X, uint32_t *Y, uint32_t *Z){
+	uint32_t delta[8];
+	uint32_t gamma[8];
+	uint32_t beta[8];
+	uint32_t alpha[8];
+	uint32_t tempA[8];
+	uint32_t tempB[8];
+
+	if(isZero(Z))
+		return;
+
+	fieldMultP(Z, Z, delta); //delta = Z^2
+	fieldMultP(Y, Y, gamma); //gamma = Y^2
+	fieldMultP(X, gamma, beta); //beta = X * gamma
+
+	fieldSubP(X, delta, tempA);
+	fieldAddP(X, delta, tempB);
+	fieldMultP(tempA, tempB, alpha);
+	fieldAddP(alpha, alpha, tempA);
+	fieldAddP(tempA, alpha, alpha); //alpha = 3 * (X - delta) * (X + delta)
+
+	fieldAddP(Y, Z, tempA);
+	fieldMultP(tempA, tempA, tempB);
+	fieldSubP(tempB, gamma, tempA);
+	fieldSubP(tempA, delta, Z); //Z3 = (Y + Z)^2 - gamma - delta
+
+	fieldAddP(beta, beta, beta);
+	fieldAddP(beta, beta, beta); //beta = 4 * beta
+	fieldMultP(alpha, alpha, tempA);
+	fieldAddP(beta, beta, tempB);
+	fieldSubP(tempA, tempB, X); //X3 = alpha^2 - 8 * beta
+
+	fieldSubP(beta, X, tempA);
+	fieldMultP(alpha, tempA, tempB); //tempB = alpha * (4 * beta - X3)
+	fieldMultP(gamma, gamma, tempA);
+	fieldAddP(tempA, tempA, tempA);
+	fieldAddP(tempA, tempA, tempA);
+	fieldAddP(tempA, tempA, tempA); //tempA = 8 * gamma^2
+	fieldSubP(tempB, tempA, Y); //Y3 = alpha * (4 * beta - X3) - 8 * gamma^2
+}
+
+/*
+ * (X, Y, Z) = (X, Y, Z) + (qx, qy) with an affine point (qx, qy),
+ * "madd-2004-hmv" from the same source. (0, 0) is treated as the
+ * point at infinity like in ec_add().
+ */
+static void ec_add_jacobian(uint32_t *X, uint32_t *Y, uint32_t *Z, const uint32_t *qx, const uint32_t *qy){
+	uint32_t tempA[8];
+	uint32_t tempB[8];
+	uint32_t tempC[8];
+	uint32_t H[8];
+	uint32_t R[8];
+
+	if(isZero(qx) && isZero(qy))
+		return;
+
+	if(isZero(Z)){
+		copy(qx, X, arrayLength);
+		copy(qy, Y, arrayLength);
+		setZero(Z, 8);
+		Z[0] = 1;
+		return;
+	}
+
+	fieldMultP(Z, Z, tempA); //tempA = Z^2
+	fieldMultP(qx, tempA, tempB); //tempB = qx * Z^2
+	fieldSubP(tempB, X, H); //H = qx * Z^2 - X
+	fieldMultP(tempA, Z, tempB);
+	fieldMultP(qy, tempB, tempC); //tempC = qy * Z^3
+	fieldSubP(tempC, Y, R); //R = qy * Z^3 - Y
+
+	if(isZero(H)){
+		if(isZero(R)){
+			ec_double_jacobian(X, Y, Z);
+		} else {
+			setZero(X, 8);
+			setZero(Y, 8);
+			setZero(Z, 8);
+		}
+		return;
+	}
+
+	fieldMultP(Z, H, Z); //Z3 = Z * H
+	fieldMultP(H, H, tempA); //tempA = H^2
+	fieldMultP(tempA, H, tempB); //tempB = H^3
+	fieldMultP(X, tempA, tempC); //tempC = X * H^2
+
+	fieldMultP(R, R, tempA);
+	fieldSubP(tempA, tempB, tempA);
+	fieldSubP(tempA, tempC, tempA);
+	fieldSubP(tempA, tempC, X); //X3 = R^2 - H^3 - 2 * X * H^2
+
+	fieldMultP(Y, tempB, tempB); //tempB = Y * H^3
+	fieldSubP(tempC, X, tempA);
+	fieldMultP(R, tempA, tempC);
+	fieldSubP(tempC, tempB, Y); //Y3 = R * (X * H^2 - X3) - Y * H^3
+}
+
+/* converts (X, Y, Z) to affine coordinates, infinity becomes (0, 0) */
+static void ec_jacobian_to_affine(const uint32_t *X, const uint32_t *Y, const uint32_t *Z, uint32_t *resultx, uint32_t *resulty){
+	uint32_t zInv[8];
+	uint32_t tempA[8];
+	uint32_t tempB[8];
+
+	if(isZero(Z)){
+		setZero(resultx, 8);
+		setZero(resulty, 8);
+		return;
+	}
+
+	fieldInv(Z, ecc_prime_m, ecc_prime_r, zInv);
+	fieldMultP(zInv, zInv, tempA); //tempA = Z^-2
+	fieldMultP(X, tempA, resultx);
+	fieldMultP(tempA, zInv, tempB); //tempB = Z^-3
+	fieldMultP(Y, tempB, resulty);
+}
+
+void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
 
 	int i;
 	for (i = 256;i--;){
-		ec_double(Qx, Qy, tempx, tempy);
-		copy(tempx, Qx,arrayLength);
-		copy(tempy, Qy,arrayLength);
+		ec_double_jacobian(X, Y, Z);
 		if (((secret[i / 32]) & ((uint32_t)1 << (i % 32)))) {
-			ec_add(Qx, Qy, px, py, tempx, tempy); //eccAdd
-			copy(tempx, Qx,arrayLength);
-			copy(tempy, Qy,arrayLength);
+			ec_add_jacobian(X, Y, Z, px, py);
 		}
 	}
-	copy(Qx, resultx,arrayLength);
-	copy(Qy, resulty,arrayLength);
+	ec_jacobian_to_affine(X, Y, Z, resultx, resulty);
+}
+
+/*
+ * Multiplies the generator G with secret.
+ *
+ * This uses the fixed-base comb table from ecc_g_table.h: the bits
+ * secret[i], secret[i + d], ..., secret[i + (w - 1) * d] select one
+ * precomputed sum of the points 2^(j * d) * G, so only d doublings
+ * and d additions are needed instead of 256 doublings and about 128
+ * additions. Define ECC_NO_G_TABLE to save the table's flash space
+ * at the cost of using the generic ecc_ec_mult().
+ */
+void ecc_ec_mult_g(const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+#if !defined(ECC_NO_G_TABLE) && !defined(ECC_GEN_TABLE)
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
+
+	int i, j, bit, index;
+	for (i = ECC_COMB_SPACING; i--;){
+		ec_double_jacobian(X, Y, Z);
+
+		index = 0;
+		for (j = 0; j < ECC_COMB_TEETH; j++) {
+			bit = j * ECC_COMB_SPACING + i;
+			if (bit < 256 && ((secret[bit / 32]) & ((uint32_t)1 << (bit % 32))))
+				index |= 1 << j;
+		}
+		if (index) {
+			ec_add_jacobian(X, Y, Z, ecc_g_table[index - 1][0], ecc_g_table[index - 1][1]);
+		}
+	}
+	ec_jacobian_to_affine(X, Y, Z, resultx, resulty);
+#else
+	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, secret, resultx, resulty);
+#endif
+}
+
+/*
+ * Window widths of the interleaved wNAF multiplication in
+ * ecc_ecdsa_validate(). The odd multiples of the public key are
+ * computed for every verification, the ones of the generator come
+ * from ecc_g_table.h if it is available.
+ */
+#define ECC_Q_WNAF_WIDTH 5
+#if !defined(ECC_NO_G_TABLE) && !defined(ECC_GEN_TABLE)
+#define ECC_G_WNAF_WIDTH ECC_G_NAF_WIDTH
+#else
+#define ECC_G_WNAF_WIDTH ECC_Q_WNAF_WIDTH
+#endif
+
+/* The number of odd multiples that ec_odd_multiples() can compute. */
+#define ECC_ODD_MULTIPLES_MAX (1 << (ECC_Q_WNAF_WIDTH - 2))
+
+/*
+ * Computes the width-w NAF of the 256 bit number k: every digit is 0
+ * or odd with an absolute value below 2^(w - 1) and of w consecutive
+ * digits at most one is not 0. Returns the number of digits.
+ */
+static int ec_wnaf(const uint32_t *k, int w, int8_t *naf){
+	uint32_t d[9];
+	uint32_t c, t;
+	int i, j, digit, len = 0;
+
+	copy(k, d, 8);
+	d[8] = 0;
+
+	for (i = 0; i < 257; i++){
+		digit = 0;
+		if (d[0] & 1) {
+			digit = d[0] & ((1 << w) - 1);
+			if (digit >= 1 << (w - 1))
+				digit -= 1 << w;
+
+			// d = d - digit, this clears the lowest w bits
+			if (digit > 0) {
+				c = digit;
+				for (j = 0; j < 9 && c; j++) {
+					t = d[j];
+					d[j] = t - c;
+					c = t < c;
+				}
+			} else {
+				c = -digit;
+				for (j = 0; j < 9 && c; j++) {
+					d[j] += c;
+					c = d[j] < c;
+				}
+			}
+			len = i + 1;
+		}
+		naf[i] = digit;
+
+		for (j = 0; j < 8; j++)
+			d[j] = (d[j] >> 1) | (d[j + 1] << 31);
+		d[8] >>= 1;
+	}
+	return len;
+}
+
+/*
+ * Fills table with the affine odd multiples P, 3P, ..., (2n - 1)P.
+ *
+ * 2P = (X, Y, Z) is only known in Jacobian coordinates. On the curve
+ * isomorphic to secp256r1 under (x, y) -> (x * Z^2, y * Z^3) it is the
+ * affine point (X, Y), so the sums P + 2P + ... are computed there with
+ * mixed additions, which do not depend on the curve parameters. A point
+ * (X', Y', Z') of that curve is (X', Y', Z' * Z) on secp256r1. In the
+ * end all points are converted with a single inversion (Montgomery's
+ * trick). Returns -1 if one of them is the point at infinity, which
+ * does not happen for points of the curve, or if n is larger than
+ * ECC_ODD_MULTIPLES_MAX.
+ */
+static int ec_odd_multiples(const uint32_t *px, const uint32_t *py, uint32_t (*table)[2][8], int n){
+	uint32_t X[8], Y[8], Z[8];
+	uint32_t dx[8], dy[8], dz[8];
+	uint32_t z[ECC_ODD_MULTIPLES_MAX][8];
+	uint32_t acc[ECC_ODD_MULTIPLES_MAX][8];
+	uint32_t inv[8], zInv[8], tempA[8], tempB[8];
+	int i;
+
+	if (n < 1 || n > ECC_ODD_MULTIPLES_MAX)
+		return -1;
+
+	// (dx, dy, dz) = 2P
+	copy(px, dx, arrayLength);
+	copy(py, dy, arrayLength);
+	setZero(dz, 8);
+	dz[0] = 1;
+	ec_double_jacobian(dx, dy, dz);
+	if (isZero(dz))
+		return -1;
+
+	// (X, Y, Z) = P on the isomorphic curve
+	fieldMultP(dz, dz, tempA);
+	fieldMultP(px, tempA, X);
+	fieldMultP(tempA, dz, tempB);
+	fieldMultP(py, tempB, Y);
+	setZero(Z, 8);
+	Z[0] = 1;
+
+	// table[i] = (2i + 1)P with z[i] = Z * dz, acc[i] = z[1] * ... * z[i]
+	copy(px, table[0][0], arrayLength);
+	copy(py, table[0][1], arrayLength);
+	copy(Z, acc[0], arrayLength);
+	for (i = 1; i < n; i++) {
+		ec_add_jacobian(X, Y, Z, dx, dy);
+		if (isZero(Z))
+			return -1;
+		copy(X, table[i][0], arrayLength);
+		copy(Y, table[i][1], arrayLength);
+		fieldMultP(Z, dz, z[i]);
+		fieldMultP(acc[i - 1], z[i], acc[i]);
+	}
+
+	fieldInv(acc[n - 1], ecc_prime_m, ecc_prime_r, inv);
+	for (i = n - 1; i > 0; i--) {
+		fieldMultP(inv, acc[i - 1], zInv); //zInv = 1 / z[i]
+		fieldMultP(inv, z[i], inv); //inv = 1 / (z[1] * ... * z[i - 1])
+
+		fieldMultP(zInv, zInv, tempA);
+		fieldMultP(table[i][0], tempA, tempB);
+		copy(tempB, table[i][0], arrayLength);
+		fieldMultP(tempA, zInv, tempA);
+		fieldMultP(table[i][1], tempA, tempB);
+		copy(tempB, table[i][1], arrayLength);
+	}
+	return 0;
+}
+
+/* (X, Y, Z) = (X, Y, Z) + digit * P for an odd wNAF digit and the odd multiples of P */
+static void ec_add_jacobian_digit(uint32_t *X, uint32_t *Y, uint32_t *Z, const uint32_t (*table)[2][8], int digit){
+	uint32_t negY[8];
+	uint32_t zero[8];
+
+	if (digit > 0) {
+		ec_add_jacobian(X, Y, Z, table[digit >> 1][0], table[digit >> 1][1]);
+	} else {
+		setZero(zero, 8);
+		fieldSubP(zero, table[-digit >> 1][1], negY);
+		ec_add_jacobian(X, Y, Z, table[-digit >> 1][0], negY);
+	}
+}
+
+/*
+ * (X, Y, Z) = u1 * G + u2 * P in Jacobian coordinates
+ *
+ * Both products share one chain of doublings (Shamir's trick), and
+ * the scalars are recoded into wNAF so that only about 256 / (w + 1)
+ * additions are needed for each of them. Returns -1 if P is not a
+ * usable point.
+ */
+static int ec_mult_twin(const uint32_t *u1, const uint32_t *px, const uint32_t *py, const uint32_t *u2, uint32_t *X, uint32_t *Y, uint32_t *Z){
+	int8_t naf1[257];
+	int8_t naf2[257];
+	uint32_t qTable[ECC_ODD_MULTIPLES_MAX][2][8];
+#if !defined(ECC_NO_G_TABLE) && !defined(ECC_GEN_TABLE)
+	const uint32_t (*gTable)[2][8] = ecc_g_naf_table;
+#else
+	uint32_t gTable[1 << (ECC_G_WNAF_WIDTH - 2)][2][8];
+#endif
+	int i, len1, len2;
+
+	if (ec_odd_multiples(px, py, qTable, ECC_ODD_MULTIPLES_MAX) < 0)
+		return -1;
+#if defined(ECC_NO_G_TABLE) || defined(ECC_GEN_TABLE)
+	ec_odd_multiples(ecc_g_point_x, ecc_g_point_y, gTable, 1 << (ECC_G_WNAF_WIDTH - 2));
+#endif
+
+	len1 = ec_wnaf(u1, ECC_G_WNAF_WIDTH, naf1);
+	len2 = ec_wnaf(u2, ECC_Q_WNAF_WIDTH, naf2);
+
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
+	for (i = len1 > len2 ? len1 : len2; i--;){
+		ec_double_jacobian(X, Y, Z);
+		if (i < len1 && naf1[i])
+			ec_add_jacobian_digit(X, Y, Z, gTable, naf1[i]);
+		if (i < len2 && naf2[i])
+			ec_add_jacobian_digit(X, Y, Z, (const uint32_t (*)[2][8])qTable, naf2[i]);
+	}
+	return 0;
 }
 
 /**
@@ -533,15 +1082,41 @@ void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret,
  */
 int ecc_ecdsa_sign_hash(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint32_t *r, uint32_t *s)
 {
-	uint32_t tmp1[16];
-	uint32_t tmp2[9];
-	uint32_t tmp3[9];
+	uint32_t kInv[8];
+	int ret;
+
+	ret = ecc_ecdsa_presign(k, kInv, r);
+	if (!ret)
+		ret = ecc_ecdsa_sign_presigned(d, e, kInv, r, s);
+
+	setZero(kInv, 8);
+	return ret;
+}
+
+/**
+ * The part of the ecdsa signature that does not depend on the message
+ * or the key (steps 3 to 5 and k^{-1} of step 6).
+ *
+ * input:
+ *  k: random data, this must be changed for every signature (32 bytes)
+ *
+ * output:
+ *  kInv: k^{-1} mod n (32 bytes)
+ *  r: r value of the signature (36 bytes)
+ *
+ * return:
+ *   0: everything is ok
+ *  -1: try again with different k.
+ */
+int ecc_ecdsa_presign(const uint32_t *k, uint32_t *kInv, uint32_t *r)
+{
+	uint32_t tmp[8];
 
 	if (isZero(k))
 		return -1;
 
 	// 4. Calculate the curve point (x_1, y_1) = k * G.
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, k, r, tmp1);
+	ecc_ec_mult_g(k, r, tmp);
 
 	// 5. Calculate r = x_1 \pmod{n}.
 	fieldModO(r, r, 8);
@@ -550,6 +1125,34 @@ int ecc_ecdsa_sign_hash(const uint32_t *d, const uint32_t *e, const uint32_t *k,
 	if (isZero(r))
 		return -1;
 
+	// 6. k^{-1}
+	fieldInv(k, ecc_order_m, ecc_order_r, kInv);
+	return 0;
+}
+
+/**
+ * Completes an ecdsa signature from the output of ecc_ecdsa_presign(),
+ * this only takes a few multiplications mod n. Every (kInv, r) pair
+ * must only be used for one signature.
+ *
+ * input:
+ *  d: private key on the curve secp256r1 (32 bytes)
+ *  e: hash to sign (32 bytes)
+ *  kInv, r: from ecc_ecdsa_presign()
+ *
+ * output:
+ *  s: s value of the signature (36 bytes)
+ *
+ * return:
+ *   0: everything is ok
+ *  -1: can not create signature, try again with a different kInv, r.
+ */
+int ecc_ecdsa_sign_presigned(const uint32_t *d, const uint32_t *e, const uint32_t *kInv, const uint32_t *r, uint32_t *s)
+{
+	uint32_t tmp1[16];
+	uint32_t tmp2[9];
+	uint32_t tmp3[9];
+
 	// 6. Calculate s = k^{-1}(z + r d_A) \pmod{n}.
 	// 6. r * d
 	fieldMult(r, d, tmp1, arrayLength);
@@ -559,11 +1162,8 @@ int ecc_ecdsa_sign_hash(const uint32_t *d, const uint32_t *e, const uint32_t *k,
 	tmp1[8] = add(e, tmp2, tmp1, 8);
 	fieldModO(tmp1, tmp3, 9);
 
-	// 6. k^{-1}
-	fieldInv(k, ecc_order_m, ecc_order_r, tmp2);
-
 	// 6. (k^{-1}) (z + (r d))
-	fieldMult(tmp2, tmp3, tmp1, arrayLength);
+	fieldMult(kInv, tmp3, tmp1, arrayLength);
 	fieldModO(tmp1, s, 16);
 
 	// 6. If s = 0, go back to step 3.
@@ -596,12 +1196,9 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	uint32_t tmp[16];
 	uint32_t u1[9];
 	uint32_t u2[9];
-	uint32_t tmp1_x[8];
-	uint32_t tmp1_y[8];
-	uint32_t tmp2_x[8];
-	uint32_t tmp2_y[8];
-	uint32_t tmp3_x[8];
-	uint32_t tmp3_y[8];
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
 
 	// 3. Calculate w = s^{-1} \pmod{n}
 	fieldInv(s, ecc_order_m, ecc_order_r, w);
@@ -615,17 +1212,15 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	fieldModO(tmp, u2, 16);
 
 	// 5. Calculate the curve point (x_1, y_1) = u_1 * G + u_2 * Q_A.
-	// tmp1 = u_1 * G
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, u1, tmp1_x, tmp1_y);
-
-	// tmp2 = u_2 * Q_A
-	ecc_ec_mult(x, y, u2, tmp2_x, tmp2_y);
-
-	// tmp3 = tmp1 + tmp2
-	ec_add(tmp1_x, tmp1_y, tmp2_x, tmp2_y, tmp3_x, tmp3_y);
-	// TODO: this u_1 * G + u_2 * Q_A  could be optimiced with Straus's algorithm.
+	if (ec_mult_twin(u1, x, y, u2, X, Y, Z) < 0 || isZero(Z))
+		return -1;
 
-	return isSame(tmp3_x, r, arrayLength) ? 0 : -1;
+	// x_1 = X / Z^2 is less than p, so instead of inverting Z check r * Z^2 = X
+	if (isGreater(r, ecc_prime_m, arrayLength) >= 0)
+		return -1;
+	fieldMultP(Z, Z, w);
+	fieldMultP(r, w, tmp);
+	return isSame(tmp, X, arrayLength) ? 0 : -1;
 }
 
 int ecc_is_valid_key(const uint32_t * priv_key)
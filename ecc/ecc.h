@@ -45,17 +45,20 @@ extern const uint32_t ecc_g_point_y[8];
 
 //ec Functions
 void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty);
+void ecc_ec_mult_g(const uint32_t *secret, uint32_t *resultx, uint32_t *resulty);
 
 static inline void ecc_ecdh(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty) {
 	ecc_ec_mult(px, py, secret, resultx, resulty);
 }
 int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e, const uint32_t *r, const uint32_t *s);
 int ecc_ecdsa_sign_hash(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint32_t *r, uint32_t *s);
+int ecc_ecdsa_presign(const uint32_t *k, uint32_t *kInv, uint32_t *r);
+int ecc_ecdsa_sign_presigned(const uint32_t *d, const uint32_t *e, const uint32_t *kInv, const uint32_t *r, uint32_t *s);
 
 int ecc_is_valid_key(const uint32_t * priv_key);
 static inline void ecc_gen_pub_key(const uint32_t *priv_key, uint32_t *pub_x, uint32_t *pub_y)
 {
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, priv_key, pub_x, pub_y);
+	ecc_ec_mult_g(priv_key, pub_x, pub_y);
 }
 
 #ifdef TEST_INCLUDE
@@ -0,0 +1,118 @@
+/*
+ * Generates ecc_g_table.h, the fixed-base comb table for the generator
+ * of secp256r1 that is used by ecc_ec_mult_g() and the table of odd
+ * multiples of the generator used by ecc_ecdsa_validate().
+ *
+ * Usage: gen_g_table [teeth [naf width]] > ecc_g_table.h
+ *
+ * With w teeth the scalar is split into w parts of d = ceil(256 / w)
+ * bits each. Entry i - 1 of the table holds the point
+ *
+ *   sum over j with bit j of i set of 2^(j * d) * G
+ *
+ * so that k * G takes d point doublings and at most d additions. The
+ * table has 2^w - 1 entries of 64 bytes each.
+ *
+ * For a wNAF width of v the second table holds G, 3G, ..., (2^(v - 1) - 1)G,
+ * 2^(v - 2) entries of 64 bytes each.
+ *
+ * This program is built together with ecc.c (compiled with
+ * -DTEST_INCLUDE -DECC_GEN_TABLE) for the build host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ecc.h"
+
+static void print_number(const uint32_t *n)
+{
+	int i;
+
+	printf("{");
+	for (i = 0; i < arrayLength; i++)
+		printf("%s0x%08X", i == 0 ? "" : i == 4 ? ",\n\t   " : ", ", n[i]);
+	printf("}");
+}
+
+int main(int argc, char const *argv[])
+{
+	uint32_t base_x[16][8], base_y[16][8];
+	uint32_t x[8], y[8], tx[8], ty[8];
+	uint32_t dx[8], dy[8];
+	int teeth = argc > 1 ? atoi(argv[1]) : 6;
+	int naf_width = argc > 2 ? atoi(argv[2]) : 7;
+	int spacing, i, j;
+
+	if (teeth < 1 || teeth > 16) {
+		fprintf(stderr, "teeth must be between 1 and 16\n");
+		return 1;
+	}
+	if (naf_width < 2 || naf_width > 8) {
+		fprintf(stderr, "naf width must be between 2 and 8\n");
+		return 1;
+	}
+	spacing = (256 + teeth - 1) / teeth;
+
+	/* base_j = 2^(j * spacing) * G */
+	ecc_copy(ecc_g_point_x, base_x[0], arrayLength);
+	ecc_copy(ecc_g_point_y, base_y[0], arrayLength);
+	for (j = 1; j < teeth; j++) {
+		ecc_copy(base_x[j - 1], x, arrayLength);
+		ecc_copy(base_y[j - 1], y, arrayLength);
+		for (i = 0; i < spacing; i++) {
+			ecc_ec_double(x, y, tx, ty);
+			ecc_copy(tx, x, arrayLength);
+			ecc_copy(ty, y, arrayLength);
+		}
+		ecc_copy(x, base_x[j], arrayLength);
+		ecc_copy(y, base_y[j], arrayLength);
+	}
+
+	printf("/* generated by gen_g_table.c, do not edit */\n\n");
+	printf("#define ECC_COMB_TEETH %d\n", teeth);
+	printf("#define ECC_COMB_SPACING %d\n\n", spacing);
+	printf("static const uint32_t ecc_g_table[%d][2][8] = {\n",
+	       (1 << teeth) - 1);
+
+	for (i = 1; i < 1 << teeth; i++) {
+		ecc_setZero(x, arrayLength);
+		ecc_setZero(y, arrayLength);
+		for (j = 0; j < teeth; j++) {
+			if (!(i & (1 << j)))
+				continue;
+			ecc_ec_add(x, y, base_x[j], base_y[j], tx, ty);
+			ecc_copy(tx, x, arrayLength);
+			ecc_copy(ty, y, arrayLength);
+		}
+		printf("\t{ ");
+		print_number(x);
+		printf(",\n\t  ");
+		print_number(y);
+		printf(" }%s\n", i + 1 < 1 << teeth ? "," : "");
+	}
+	printf("};\n\n");
+
+	/* G, 3G, 5G, ... */
+	printf("#define ECC_G_NAF_WIDTH %d\n\n", naf_width);
+	printf("static const uint32_t ecc_g_naf_table[%d][2][8] = {\n",
+	       1 << (naf_width - 2));
+
+	ecc_ec_double(ecc_g_point_x, ecc_g_point_y, dx, dy);
+	ecc_copy(ecc_g_point_x, x, arrayLength);
+	ecc_copy(ecc_g_point_y, y, arrayLength);
+	for (i = 0; i < 1 << (naf_width - 2); i++) {
+		if (i > 0) {
+			ecc_ec_add(x, y, dx, dy, tx, ty);
+			ecc_copy(tx, x, arrayLength);
+			ecc_copy(ty, y, arrayLength);
+		}
+		printf("\t{ ");
+		print_number(x);
+		printf(",\n\t  ");
+		print_number(y);
+		printf(" }%s\n", i + 1 < 1 << (naf_width - 2) ? "," : "");
+	}
+	printf("};\n");
+	return 0;
+}
@@ -142,6 +142,34 @@ void multTest(){
 	assert(ecc_isSame(tempy, resultMulty, arrayLength));
 }
 
+void multGTest(){
+	uint32_t tempx[8];
+	uint32_t tempy[8];
+	uint32_t resultx[8];
+	uint32_t resulty[8];
+	uint32_t k[8];
+	int i;
+
+	ecc_ec_mult_g(secret, tempx, tempy);
+	ecc_ec_mult(BasePointx, BasePointy, secret, resultx, resulty);
+	assert(ecc_isSame(tempx, resultx, arrayLength));
+	assert(ecc_isSame(tempy, resulty, arrayLength));
+
+	for (i = 0; i < 16; i++) {
+		if (i == 0) {
+			/* upper bits set, lower comb columns empty */
+			memset(k, 0xff, sizeof(k));
+			k[0] = 0;
+		} else {
+			ecc_setRandom(k);
+		}
+		ecc_ec_mult_g(k, tempx, tempy);
+		ecc_ec_mult(BasePointx, BasePointy, k, resultx, resulty);
+		assert(ecc_isSame(tempx, resultx, arrayLength));
+		assert(ecc_isSame(tempy, resulty, arrayLength));
+	}
+}
+
 void eccdhTest(){
 	uint32_t tempx[8];
 	uint32_t tempy[8];
@@ -173,6 +201,7 @@ void ecdsaTest() {
 	uint32_t tempy[9];
 	uint32_t pub_x[8];
 	uint32_t pub_y[8];
+	uint32_t message[8];
 
 	ecc_ec_mult(BasePointx, BasePointy, ecdsaTestSecret, pub_x, pub_y);
 
@@ -192,6 +221,21 @@ void ecdsaTest() {
 
 	ret = ecc_ecdsa_validate(pub_x, pub_y, ecdsaTestMessage, tempx, tempy);
 	assert(!ret);
+
+	/* a changed message, signature or key must not verify */
+	ecc_copy(ecdsaTestMessage, message, arrayLength);
+	message[3] ^= 0x100;
+	ret = ecc_ecdsa_validate(pub_x, pub_y, message, tempx, tempy);
+	assert(ret);
+
+	tempx[0] ^= 1;
+	ret = ecc_ecdsa_validate(pub_x, pub_y, ecdsaTestMessage, tempx, tempy);
+	assert(ret);
+	tempx[0] ^= 1;
+
+	pub_y[7] ^= 1;
+	ret = ecc_ecdsa_validate(pub_x, pub_y, ecdsaTestMessage, tempx, tempy);
+	assert(ret);
 }
 
 #ifdef CONTIKI
@@ -205,6 +249,7 @@ PROCESS_THREAD(ecc_filed_test, ev, d)
 	addTest();
 	doubleTest();
 	multTest();
+	multGTest();
 	eccdhTest();
 	ecdsaTest();
 	printf("%s\n", "All Tests successful.");
@@ -218,6 +263,7 @@ int main(int argc, char const *argv[])
 	addTest();
 	doubleTest();
 	multTest();
+	multGTest();
 	eccdhTest();
 	ecdsaTest();
 	printf("%s\n", "All Tests successful.");
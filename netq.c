@@ -34,21 +34,72 @@
 #define LOG_LEVEL  LOG_LEVEL_DTLS
 #include "dtls-log.h"
 
-MEMB(netq_storage, netq_t, NETQ_MAXCNT);
+/* A netq_t node followed by the storage for its datagram. */
+#define NETQ_BLOCK(Size)			\
+  struct {					\
+    netq_t node;				\
+    unsigned char data[Size];			\
+  }
+
+typedef NETQ_BLOCK(NETQ_SMALL_SIZE) netq_small_t;
+typedef NETQ_BLOCK(NETQ_MEDIUM_SIZE) netq_medium_t;
+typedef NETQ_BLOCK(DTLS_MAX_BUF) netq_large_t;
+
+MEMB(netq_small_storage, netq_small_t, NETQ_SMALL_MAXCNT);
+#if NETQ_MEDIUM_SIZE < DTLS_MAX_BUF
+MEMB(netq_medium_storage, netq_medium_t, NETQ_MEDIUM_MAXCNT);
+#endif /* NETQ_MEDIUM_SIZE < DTLS_MAX_BUF */
+MEMB(netq_storage, netq_large_t, NETQ_MAXCNT);
+
+/* size classes ordered by their payload size */
+static const struct {
+  struct memb *storage;
+  size_t size;
+} netq_classes[] = {
+  { &netq_small_storage, NETQ_SMALL_SIZE },
+#if NETQ_MEDIUM_SIZE < DTLS_MAX_BUF
+  { &netq_medium_storage, NETQ_MEDIUM_SIZE },
+#endif /* NETQ_MEDIUM_SIZE < DTLS_MAX_BUF */
+  { &netq_storage, DTLS_MAX_BUF }
+};
+
+#define NETQ_CLASSES (sizeof(netq_classes) / sizeof(netq_classes[0]))
 
 static inline netq_t *
 netq_malloc_node(size_t size) {
-  return (netq_t *)memb_alloc(&netq_storage);
+  netq_t *node;
+  uint8_t i;
+
+  for (i = 0; i < NETQ_CLASSES; i++) {
+    if (netq_classes[i].size < size)
+      continue;
+
+    /* use larger classes if this one is exhausted */
+    node = (netq_t *)memb_alloc(netq_classes[i].storage);
+    if (node) {
+      memset(node, 0, sizeof(netq_t));
+      node->size_class = i;
+      /* the datagram storage directly follows the node, at the same
+       * offset for all classes */
+      node->data = (unsigned char *)node
+	+ offsetof(netq_small_t, data);
+      return node;
+    }
+  }
+  return NULL;
 }
 
 static inline void
 netq_free_node(netq_t *node) {
-  memb_free(&netq_storage, node);
+  memb_free(netq_classes[node->size_class].storage, node);
 }
 
 void
 netq_init() {
-  memb_init(&netq_storage);
+  uint8_t i;
+
+  for (i = 0; i < NETQ_CLASSES; i++)
+    memb_init(netq_classes[i].storage);
 }
 
 int
@@ -131,19 +182,164 @@ netq_t
   return p;
 }
 
+static inline int
+netq_queue_level(const netq_t *node) {
+  return node->retransmit_cnt < NETQ_QUEUE_LEVELS
+    ? node->retransmit_cnt : NETQ_QUEUE_LEVELS - 1;
+}
+
+int
+netq_queue_insert(netq_queue_t *queue, netq_t *node) {
+  netq_t *p;
+  int level;
+
+  assert(queue);
+  assert(node);
+  assert(node->peer);
+
+  level = netq_queue_level(node);
+
+  /* search backwards as new nodes usually are due last */
+  p = queue->tail[level];
+  while(p && p->t > node->t) {
+    p = p->prev;
+  }
+
+  node->prev = p;
+  if(p) {
+    node->next = p->next;
+    p->next = node;
+  } else {
+    node->next = queue->head[level];
+    queue->head[level] = node;
+  }
+  if(node->next) {
+    node->next->prev = node;
+  } else {
+    queue->tail[level] = node;
+  }
+
+  node->peer_next = node->peer->sendqueue;
+  node->peer->sendqueue = node;
+  return 1;
+}
+
+netq_t *
+netq_queue_head(netq_queue_t *queue) {
+  netq_t *first = NULL;
+  int level;
+
+  for(level = 0; level < NETQ_QUEUE_LEVELS; level++) {
+    if(queue->head[level] && (!first || queue->head[level]->t < first->t)) {
+      first = queue->head[level];
+    }
+  }
+  return first;
+}
+
+/* Removes @p node from the lists of @p queue, but not from its
+ * peer's list. */
+static void
+netq_queue_unlink(netq_queue_t *queue, netq_t *node) {
+  int level;
+
+  assert(queue);
+  assert(node);
+
+  level = netq_queue_level(node);
+  if(node->prev) {
+    node->prev->next = node->next;
+  } else {
+    queue->head[level] = node->next;
+  }
+  if(node->next) {
+    node->next->prev = node->prev;
+  } else {
+    queue->tail[level] = node->prev;
+  }
+  node->next = node->prev = NULL;
+}
+
+void
+netq_queue_remove(netq_queue_t *queue, netq_t *node) {
+  netq_t **p;
+
+  netq_queue_unlink(queue, node);
+
+  /* a peer has only a few packets in flight */
+  for(p = &node->peer->sendqueue; *p; p = &(*p)->peer_next) {
+    if(*p == node) {
+      *p = node->peer_next;
+      break;
+    }
+  }
+  node->peer_next = NULL;
+}
+
+netq_t *
+netq_queue_pop_first(netq_queue_t *queue) {
+  netq_t *node = netq_queue_head(queue);
+
+  if(node) {
+    netq_queue_remove(queue, node);
+  }
+  return node;
+}
+
+void
+netq_queue_delete_peer(netq_queue_t *queue, dtls_peer_t *peer) {
+  netq_t *node;
+
+  while((node = peer->sendqueue) != NULL) {
+    netq_queue_remove(queue, node);
+    netq_free_node(node);
+  }
+}
+
+void
+netq_queue_detach_peer(netq_queue_t *queue, dtls_peer_t *peer) {
+  netq_t *node;
+
+  for(node = peer->sendqueue; node; node = node->peer_next) {
+    netq_queue_unlink(queue, node);
+  }
+}
+
+void
+netq_queue_attach_peer(netq_queue_t *queue, dtls_peer_t *peer) {
+  netq_t *node, *next;
+
+  node = peer->sendqueue;
+  peer->sendqueue = NULL;
+  for(; node; node = next) {
+    next = node->peer_next;
+    netq_queue_insert(queue, node);
+  }
+}
+
+void
+netq_queue_delete_all(netq_queue_t *queue) {
+  netq_t *node;
+
+  while((node = netq_queue_pop_first(queue)) != NULL) {
+    netq_free_node(node);
+  }
+}
+
 netq_t *
 netq_node_new(size_t size) {
   netq_t *node;
+  if (size > DTLS_MAX_BUF) {
+    LOG_WARN("netq_node_new: %zu bytes exceed DTLS_MAX_BUF\n", size);
+    return NULL;
+  }
+
   node = netq_malloc_node(size);
 
   if (!node) {
     LOG_WARN("netq_node_new: malloc\n");
   }
 
-  if (node) {
-    memset(node, 0, sizeof(netq_t));
-  }
-
   return node;
 }
 
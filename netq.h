@@ -19,7 +19,7 @@
 #define _DTLS_NETQ_H_
 
 #include "tinydtls.h"
-#include "dtls.h"
+#include "dtls-peer.h"
 
 /**
  * \defgroup netq Network Packet Queue
@@ -41,13 +41,38 @@
 #error SET_DTLS_MAX_BUF
 #endif
 
+#ifndef NETQ_SMALL_SIZE
+/** Payload size of the smallest class of netq_t nodes. */
+#define NETQ_SMALL_SIZE 64
+#endif
+
+#ifndef NETQ_MEDIUM_SIZE
+/** Payload size of the medium class of netq_t nodes. This class is
+ * not used if it is not smaller than DTLS_MAX_BUF. */
+#define NETQ_MEDIUM_SIZE 256
+#endif
+
+#ifndef NETQ_SMALL_MAXCNT
+/** maximum number of small netq_t nodes */
+#define NETQ_SMALL_MAXCNT NETQ_MAXCNT
+#endif
+
+#ifndef NETQ_MEDIUM_MAXCNT
+/** maximum number of medium netq_t nodes */
+#define NETQ_MEDIUM_MAXCNT NETQ_MAXCNT
+#endif
+
 /** 
- * Datagrams in the netq_t structure have a fixed maximum size of
- * DTLS_MAX_BUF to simplify memory management on constrained nodes. */ 
+ * Datagrams in the netq_t structure have a maximum size of
+ * DTLS_MAX_BUF. Storage for a datagram is taken from the smallest
+ * size class that can hold it (NETQ_SMALL_SIZE, NETQ_MEDIUM_SIZE or
+ * DTLS_MAX_BUF), or from a larger class if that one is exhausted. */
 typedef unsigned char netq_packet_t[DTLS_MAX_BUF];
 
 typedef struct netq_t {
   struct netq_t *next;
+  struct netq_t *prev;		/**< previous node in a netq_queue_t */
+  struct netq_t *peer_next;	/**< next node of the same peer in a netq_queue_t */
 
   dtls_tick_t t;	        /**< when to send PDU for the next time */
   unsigned int timeout;		/**< randomized timeout value */
@@ -57,8 +82,9 @@ typedef struct netq_t {
   uint8_t type;
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
 
+  uint8_t size_class;		/**< storage class this node was taken from */
   size_t length;		/**< actual length of data */
-  netq_packet_t data;		/**< the datagram to send */
+  unsigned char *data;		/**< the datagram to send */
 } netq_t;
 
 /**
@@ -79,7 +105,11 @@ void netq_node_free(netq_t *node);
 /** Removes all items from given queue and frees the allocated storage */
 void netq_delete_all(netq_t **queue);
 
-/** Creates a new node suitable for adding to a netq_t queue. */
+/**
+ * Creates a new node suitable for adding to a netq_t queue. The
+ * node's data can hold up to @p size bytes. This function returns
+ * NULL if @p size exceeds DTLS_MAX_BUF or no storage is left.
+ */
 netq_t *netq_node_new(size_t size);
 
 /**
@@ -98,6 +128,66 @@ void netq_remove(netq_t **queue, netq_t *p);
  */
 netq_t *netq_pop_first(netq_t **queue);
 
+/** Number of retransmission levels in a netq_queue_t. */
+#define NETQ_QUEUE_LEVELS (DTLS_DEFAULT_MAX_RETRANSMIT + 1)
+
+/**
+ * Queue of datagrams waiting for retransmission. Nodes are kept in
+ * one list per retransmission count, each ordered by its time-stamp
+ * t. As all nodes with the same retransmission count use the same
+ * timeout relative to the time they were queued, a new node almost
+ * always belongs to the end of its list and insertion is O(1). The
+ * earliest node is the first one of the lists' heads. In addition,
+ * the nodes of each peer are linked from dtls_peer_t.sendqueue, so
+ * that all of them can be removed without walking the whole queue.
+ */
+typedef struct netq_queue_t {
+  netq_t *head[NETQ_QUEUE_LEVELS];
+  netq_t *tail[NETQ_QUEUE_LEVELS];
+} netq_queue_t;
+
+/**
+ * Adds @p node to @p queue, ordered by its time-stamp t. The list
+ * is selected by the node's retransmit_cnt. @p node->peer must be
+ * set. This function returns @c 0 on error, or non-zero if @p node
+ * has been added successfully.
+ */
+int netq_queue_insert(netq_queue_t *queue, netq_t *node);
+
+/**
+ * Returns a pointer to the item in @p queue that is due first, or
+ * NULL if @p queue is empty.
+ */
+netq_t *netq_queue_head(netq_queue_t *queue);
+
+/** Removes @p node from @p queue. The node is not freed. */
+void netq_queue_remove(netq_queue_t *queue, netq_t *node);
+
+/**
+ * Removes the item from @p queue that is due first and returns a
+ * pointer to it. If the queue is empty, this function returns NULL.
+ */
+netq_t *netq_queue_pop_first(netq_queue_t *queue);
+
+/** Removes and frees all items in @p queue that belong to @p peer. */
+void netq_queue_delete_peer(netq_queue_t *queue, dtls_peer_t *peer);
+
+/**
+ * Removes the items of @p peer from @p queue without freeing them.
+ * They stay linked from @p peer->sendqueue, so that
+ * netq_queue_attach_peer() can add them to another queue.
+ */
+void netq_queue_detach_peer(netq_queue_t *queue, dtls_peer_t *peer);
+
+/**
+ * Adds the items of @p peer that have been removed with
+ * netq_queue_detach_peer() to @p queue, keeping their time-stamps.
+ */
+void netq_queue_attach_peer(netq_queue_t *queue, dtls_peer_t *peer);
+
+/** Removes all items from @p queue and frees the allocated storage. */
+void netq_queue_delete_all(netq_queue_t *queue);
+
 void netq_init(void);
 
 /**@}*/
@@ -0,0 +1,816 @@
+/* Multi-threaded DTLS server runtime: one DTLS context and one
+   SO_REUSEPORT socket per worker thread */
+
+#define _GNU_SOURCE
+
+#include "tinydtls.h"
+#include "dtls-shards.h"
+#include "dtls-support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOCK(P) pthread_mutex_lock(P)
+#define UNLOCK(P) pthread_mutex_unlock(P)
+
+/* Log configuration */
+#define LOG_MODULE "dtls-shards"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+typedef enum {
+  SHARD_MSG_FORWARD,  /* datagram for a session that the shard owns */
+  SHARD_MSG_HANDOVER, /* peer handed to the shard, with its datagram */
+  SHARD_MSG_DELIVER   /* datagram to be handled by the shard itself */
+} shard_msg_type_t;
+
+typedef struct shard_msg_t {
+  struct shard_msg_t *next;
+  shard_msg_type_t type;
+  unsigned int from;
+  dtls_peer_t *peer;
+  session_t session;
+  size_t length;
+  uint8_t data[];
+} shard_msg_t;
+
+typedef struct dir_entry_t {
+  struct dir_entry_t *next;
+  session_t session;
+  unsigned int owner;
+} dir_entry_t;
+
+/* Receive buffers of a shard. */
+typedef struct {
+  uint8_t buf[DTLS_SHARDS_BATCH][DTLS_MAX_BUF];
+  size_t length[DTLS_SHARDS_BATCH];
+  session_t session[DTLS_SHARDS_BATCH];
+  dtls_message_t batch[DTLS_SHARDS_BATCH];
+#ifdef __linux__
+  struct mmsghdr msgs[DTLS_SHARDS_BATCH];
+  struct iovec iov[DTLS_SHARDS_BATCH];
+#endif /* __linux__ */
+} shard_io_t;
+
+typedef struct {
+  unsigned int index;
+  int fd;
+  int wakeup[2];
+  pthread_t thread;
+  dtls_context_t *ctx;
+  dtls_handler_t handler;
+
+  pthread_mutex_t lock;	/* protects inbox, stop and stats */
+  shard_msg_t *inbox, *inbox_tail;
+  int stop;
+
+  dtls_shard_stats_t stats;
+  shard_io_t *io;
+} dtls_shard_t;
+
+static dtls_shard_t shards[DTLS_SHARDS_MAX];
+static unsigned int shard_count, shard_last;
+static int shard_cpus;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The directory maps sessions to the shard that holds their peer. It
+ * is only changed with dir_mutex held. When a shard posts a message
+ * to an inbox while holding dir_mutex, it takes the inbox lock after
+ * dir_mutex, never the other way round. */
+static dir_entry_t *directory[DTLS_SHARDS_DIRECTORY_SIZE];
+static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread dtls_shard_t *current_shard;
+
+static dir_entry_t **
+dir_find(const session_t *session) {
+  dir_entry_t **e;
+
+  e = &directory[dtls_session_hash(session) % DTLS_SHARDS_DIRECTORY_SIZE];
+  while (*e && !dtls_session_equals(&(*e)->session, session))
+    e = &(*e)->next;
+  return e;
+}
+
+/* Returns the owner of @p session, or -1 if it is unknown. */
+static int
+dir_owner(const session_t *session) {
+  dir_entry_t **e;
+  int owner;
+
+  LOCK(&dir_mutex);
+  e = dir_find(session);
+  owner = *e ? (int)(*e)->owner : -1;
+  UNLOCK(&dir_mutex);
+  return owner;
+}
+
+/* Sets the owner of @p session to @p owner. Must be called with
+ * dir_mutex held. */
+static int
+dir_set(const session_t *session, unsigned int owner) {
+  dir_entry_t **e = dir_find(session);
+
+  if (!*e) {
+    if (!(*e = malloc(sizeof(dir_entry_t)))) {
+      return -1;
+    }
+    (*e)->next = NULL;
+    (*e)->session = *session;
+  }
+  (*e)->owner = owner;
+  return 0;
+}
+
+/* Removes @p session from the directory if it is owned by @p owner.
+ * Must be called with dir_mutex held. */
+static void
+dir_remove(const session_t *session, unsigned int owner) {
+  dir_entry_t **e = dir_find(session);
+  dir_entry_t *tmp;
+
+  if (*e && (*e)->owner == owner) {
+    tmp = *e;
+    *e = tmp->next;
+    free(tmp);
+  }
+}
+
+static void
+dir_clear(void) {
+  dir_entry_t *e, *tmp;
+  size_t i;
+
+  for (i = 0; i < DTLS_SHARDS_DIRECTORY_SIZE; i++) {
+    for (e = directory[i]; e; e = tmp) {
+      tmp = e->next;
+      free(e);
+    }
+    directory[i] = NULL;
+  }
+}
+
+/* Queues a message for @p shard. The message is dropped if it cannot
+ * be allocated, just as if the datagram was lost. */
+static void
+shard_post(dtls_shard_t *shard, shard_msg_type_t type, unsigned int from,
+	   dtls_peer_t *peer, const session_t *session,
+	   const uint8_t *data, size_t length) {
+  shard_msg_t *msg;
+  int wakeup;
+
+  if (!(msg = malloc(sizeof(shard_msg_t) + length))) {
+    dtls_warn("cannot queue datagram for shard %u\n", shard->index);
+    if (peer)
+      dtls_free_peer(peer);
+    return;
+  }
+  msg->next = NULL;
+  msg->type = type;
+  msg->from = from;
+  msg->peer = peer;
+  msg->session = *session;
+  msg->length = length;
+  memcpy(msg->data, data, length);
+
+  LOCK(&shard->lock);
+  wakeup = shard->inbox == NULL;
+  if (shard->inbox_tail)
+    shard->inbox_tail->next = msg;
+  else
+    shard->inbox = msg;
+  shard->inbox_tail = msg;
+  UNLOCK(&shard->lock);
+
+  if (wakeup && write(shard->wakeup[1], "", 1) < 0 && errno != EAGAIN)
+    dtls_warn("cannot wake up shard %u: %s\n", shard->index, strerror(errno));
+}
+
+/* Adds @p n to the counter @p counter of @p shard. The lock lets
+ * dtls_shards_stats() read the counters while the shard runs. */
+static void
+shard_stats_add(dtls_shard_t *shard, unsigned long *counter,
+		unsigned long n) {
+  LOCK(&shard->lock);
+  *counter += n;
+  UNLOCK(&shard->lock);
+}
+
+static void
+shard_free_msgs(shard_msg_t *msg) {
+  shard_msg_t *tmp;
+
+  for (; msg; msg = tmp) {
+    tmp = msg->next;
+    if (msg->peer)
+      dtls_free_peer(msg->peer);
+    free(msg);
+  }
+}
+
+/* Handles a datagram that has arrived for a session without a local
+ * peer and registers the peer if the handshake created one. */
+static void
+shard_handle_new(dtls_shard_t *shard, session_t *session,
+		 uint8_t *data, size_t length) {
+  dir_entry_t *entry;
+  dtls_peer_t *peer;
+  int res;
+
+  dtls_handle_message(shard->ctx, session, data, length);
+  if (!dtls_get_peer(shard->ctx, session))
+    return;
+
+  LOCK(&dir_mutex);
+  entry = *dir_find(session);
+  if (entry)
+    res = entry->owner;
+  else if (dir_set(session, shard->index) == 0)
+    res = shard->index;
+  else
+    res = -1;
+  UNLOCK(&dir_mutex);
+
+  if (res >= 0 && res != (int)shard->index) {
+    /* Another shard has created a peer for the same session at the
+     * same time. That one is kept, and so the client will continue
+     * the handshake there with its next retransmission. */
+    dtls_debug("session already owned by shard %d\n", res);
+    if ((peer = dtls_detach_peer(shard->ctx, session)))
+      dtls_free_peer(peer);
+  }
+}
+
+static void
+shard_process_inbox(dtls_shard_t *shard);
+
+static int
+shard_write(struct dtls_context_t *ctx,
+	    session_t *session, uint8_t *buf, size_t len);
+
+static void
+shard_handle_unknown(dtls_shard_t *shard, session_t *session,
+		     uint8_t *data, size_t length) {
+  uint8_t reply[DTLS_HELLO_VERIFY_LENGTH];
+  size_t reply_length = sizeof(reply);
+  int owner;
+
+  /* Answer Client Hello messages without a valid cookie before the
+   * directory or the peers are involved. */
+  switch (dtls_cookie_check(shard->ctx, session, data, length,
+			    reply, &reply_length)) {
+  case DTLS_COOKIE_PASS:
+  case DTLS_COOKIE_VALID:
+    break;
+  case DTLS_COOKIE_HELLO_VERIFY:
+    shard_stats_add(shard, &shard->stats.hello_verifies, 1);
+    shard_write(shard->ctx, session, reply, reply_length);
+    return;
+  default:
+    shard_stats_add(shard, &shard->stats.dropped, 1);
+    return;
+  }
+
+  owner = dir_owner(session);
+
+  if (owner >= 0 && owner != (int)shard->index) {
+    shard_stats_add(shard, &shard->stats.forwarded, 1);
+    shard_post(&shards[owner], SHARD_MSG_FORWARD, shard->index,
+	       NULL, session, data, length);
+    return;
+  }
+
+  if (owner == (int)shard->index) {
+    /* The peer may just have been handed to us. */
+    shard_process_inbox(shard);
+    if (dtls_get_peer(shard->ctx, session)) {
+      dtls_handle_message(shard->ctx, session, data, length);
+      return;
+    }
+  }
+
+  shard_handle_new(shard, session, data, length);
+}
+
+static void
+shard_handle_msg(dtls_shard_t *shard, shard_msg_t *msg) {
+  dtls_peer_t *peer;
+
+  switch (msg->type) {
+  case SHARD_MSG_FORWARD:
+    if ((peer = dtls_detach_peer(shard->ctx, &msg->session))) {
+      /* The traffic of this session arrives at another shard now. */
+      LOCK(&dir_mutex);
+      if (dir_set(&msg->session, msg->from) == 0) {
+	shard_post(&shards[msg->from], SHARD_MSG_HANDOVER, shard->index,
+		   peer, &msg->session, msg->data, msg->length);
+	shard_stats_add(shard, &shard->stats.handovers, 1);
+	peer = NULL;
+      }
+      UNLOCK(&dir_mutex);
+      if (peer)
+	dtls_attach_peer(shard->ctx, peer);
+      else
+	break;
+    }
+
+    if (dtls_get_peer(shard->ctx, &msg->session)) {
+      dtls_handle_message(shard->ctx, &msg->session, msg->data, msg->length);
+    } else {
+      /* The peer is gone, so the sender handles the datagram. */
+      LOCK(&dir_mutex);
+      dir_remove(&msg->session, shard->index);
+      shard_post(&shards[msg->from], SHARD_MSG_DELIVER, shard->index,
+		 NULL, &msg->session, msg->data, msg->length);
+      UNLOCK(&dir_mutex);
+    }
+    break;
+  case SHARD_MSG_HANDOVER:
+    peer = msg->peer;
+    msg->peer = NULL;
+    if (dtls_attach_peer(shard->ctx, peer) == 0)
+      dtls_handle_message(shard->ctx, &msg->session, msg->data, msg->length);
+    break;
+  case SHARD_MSG_DELIVER:
+    shard_handle_new(shard, &msg->session, msg->data, msg->length);
+    break;
+  }
+}
+
+static void
+shard_process_inbox(dtls_shard_t *shard) {
+  shard_msg_t *msg, *tmp;
+
+  LOCK(&shard->lock);
+  msg = shard->inbox;
+  shard->inbox = shard->inbox_tail = NULL;
+  UNLOCK(&shard->lock);
+
+  for (; msg; msg = tmp) {
+    tmp = msg->next;
+    msg->next = NULL;
+    shard_handle_msg(shard, msg);
+    shard_free_msgs(msg);
+  }
+}
+
+/* Removes the sessions from the directory that this shard does not
+ * have a peer for anymore. Nothing is removed while handovers to
+ * this shard are queued, as their peers are not attached yet. */
+static void
+shard_sweep(dtls_shard_t *shard) {
+  dir_entry_t **e, *tmp;
+  size_t i;
+  int pending;
+
+  LOCK(&dir_mutex);
+  LOCK(&shard->lock);
+  pending = shard->inbox != NULL;
+  UNLOCK(&shard->lock);
+
+  for (i = 0; !pending && i < DTLS_SHARDS_DIRECTORY_SIZE; i++) {
+    e = &directory[i];
+    while (*e) {
+      if ((*e)->owner == shard->index
+	  && !dtls_get_peer(shard->ctx, &(*e)->session)) {
+	tmp = *e;
+	*e = tmp->next;
+	free(tmp);
+      } else {
+	e = &(*e)->next;
+      }
+    }
+  }
+  UNLOCK(&dir_mutex);
+}
+
+/* Returns the socket of the shard that uses @p ctx. This is the
+ * current thread's shard except when the contexts are released. */
+static int
+shard_fd(struct dtls_context_t *ctx) {
+  unsigned int i;
+
+  if (current_shard && current_shard->ctx == ctx)
+    return current_shard->fd;
+  for (i = 0; i < shard_count; i++) {
+    if (shards[i].ctx == ctx)
+      return shards[i].fd;
+  }
+  return -1;
+}
+
+static int
+shard_write(struct dtls_context_t *ctx,
+	    session_t *session, uint8_t *buf, size_t len) {
+  return sendto(shard_fd(ctx), buf, len, MSG_DONTWAIT,
+		&session->addr.sa, session->size);
+}
+
+#ifdef __linux__
+static int
+shard_write_batch(struct dtls_context_t *ctx,
+		  const dtls_message_t *datagrams, size_t count) {
+  struct mmsghdr msgs[DTLS_SHARDS_BATCH];
+  struct iovec iov[DTLS_SHARDS_BATCH];
+  size_t i;
+
+  if (count > DTLS_SHARDS_BATCH)
+    count = DTLS_SHARDS_BATCH;
+
+  memset(msgs, 0, count * sizeof(struct mmsghdr));
+  for (i = 0; i < count; i++) {
+    iov[i].iov_base = datagrams[i].data;
+    iov[i].iov_len = datagrams[i].length;
+    msgs[i].msg_hdr.msg_name = &datagrams[i].session->addr.sa;
+    msgs[i].msg_hdr.msg_namelen = datagrams[i].session->size;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  return sendmmsg(shard_fd(ctx), msgs, count, MSG_DONTWAIT);
+}
+#endif /* __linux__ */
+
+/* Reads up to DTLS_SHARDS_BATCH datagrams without blocking and
+ * returns their number. */
+static int
+shard_recv(dtls_shard_t *shard) {
+  shard_io_t *io = shard->io;
+  int i, n;
+
+#ifdef __linux__
+  for (i = 0; i < DTLS_SHARDS_BATCH; i++) {
+    dtls_session_init(&io->session[i]);
+    io->iov[i].iov_base = io->buf[i];
+    io->iov[i].iov_len = DTLS_MAX_BUF;
+    memset(&io->msgs[i], 0, sizeof(struct mmsghdr));
+    io->msgs[i].msg_hdr.msg_name = &io->session[i].addr;
+    io->msgs[i].msg_hdr.msg_namelen = sizeof(io->session[i].addr);
+    io->msgs[i].msg_hdr.msg_iov = &io->iov[i];
+    io->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  n = recvmmsg(shard->fd, io->msgs, DTLS_SHARDS_BATCH, MSG_DONTWAIT, NULL);
+  for (i = 0; i < n; i++) {
+    io->session[i].size = io->msgs[i].msg_hdr.msg_namelen;
+    io->length[i] = io->msgs[i].msg_len;
+    if (io->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      io->length[i] = 0;
+  }
+#else /* __linux__ */
+  for (n = 0; n < DTLS_SHARDS_BATCH; n++) {
+    ssize_t len;
+
+    dtls_session_init(&io->session[n]);
+    io->session[n].size = sizeof(io->session[n].addr);
+    len = recvfrom(shard->fd, io->buf[n], DTLS_MAX_BUF, MSG_DONTWAIT,
+		   &io->session[n].addr.sa, &io->session[n].size);
+    if (len < 0)
+      break;
+    io->length[n] = len;
+  }
+  if (n == 0)
+    n = -1;
+#endif /* __linux__ */
+
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    dtls_warn("shard %u: cannot read: %s\n", shard->index, strerror(errno));
+  }
+  return n < 0 ? 0 : n;
+}
+
+/* Handles the datagrams that shard_recv() has read. Datagrams of
+ * local peers are passed to dtls_handle_messages() together, the
+ * others one by one as they may need the directory. */
+static void
+shard_handle_datagrams(dtls_shard_t *shard, int count) {
+  shard_io_t *io = shard->io;
+  size_t pending = 0;
+  unsigned long datagrams = 0;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (!io->length[i])
+      continue;
+    datagrams++;
+
+    if (dtls_get_peer(shard->ctx, &io->session[i])) {
+      io->batch[pending].session = &io->session[i];
+      io->batch[pending].data = io->buf[i];
+      io->batch[pending].length = io->length[i];
+      pending++;
+      continue;
+    }
+
+    if (pending) {
+      dtls_handle_messages(shard->ctx, io->batch, pending);
+      pending = 0;
+    }
+    shard_handle_unknown(shard, &io->session[i], io->buf[i], io->length[i]);
+  }
+
+  if (pending) {
+    dtls_handle_messages(shard->ctx, io->batch, pending);
+  }
+  if (datagrams)
+    shard_stats_add(shard, &shard->stats.datagrams, datagrams);
+}
+
+static void *
+shard_main(void *arg) {
+  dtls_shard_t *shard = arg;
+  struct pollfd fds[2];
+  dtls_tick_t now, next, sweep;
+  char drain[64];
+  int timeout, stop, n;
+
+  current_shard = shard;
+
+#ifdef __linux__
+  if (shard_cpus > 0) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->index % shard_cpus, &cpus);
+    if ((n = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)))
+      dtls_warn("cannot pin shard %u: %s\n", shard->index, strerror(n));
+  }
+#endif /* __linux__ */
+
+  fds[0].fd = shard->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = shard->wakeup[0];
+  fds[1].events = POLLIN;
+
+  dtls_ticks(&sweep);
+  sweep += DTLS_SHARDS_SWEEP_INTERVAL * DTLS_TICKS_PER_SECOND;
+
+  for (;;) {
+    dtls_check_retransmit(shard->ctx, &next, 1);
+
+    dtls_ticks(&now);
+    if (!next || next > sweep)
+      next = sweep;
+    timeout = next > now ? (int)((next - now) * 1000 / DTLS_TICKS_PER_SECOND) : 0;
+
+    fds[0].revents = fds[1].revents = 0;
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+      dtls_warn("shard %u: poll: %s\n", shard->index, strerror(errno));
+    }
+
+    if (fds[1].revents & POLLIN) {
+      while (read(shard->wakeup[0], drain, sizeof(drain)) > 0)
+	;
+    }
+
+    LOCK(&shard->lock);
+    stop = shard->stop;
+    UNLOCK(&shard->lock);
+    if (stop)
+      break;
+
+    shard_process_inbox(shard);
+
+    if (fds[0].revents & POLLIN) {
+      while ((n = shard_recv(shard)) > 0) {
+	shard_handle_datagrams(shard, n);
+	if (n < DTLS_SHARDS_BATCH)
+	  break;
+      }
+    }
+
+    dtls_ticks(&now);
+    if (now >= sweep) {
+      shard_sweep(shard);
+      sweep = now + DTLS_SHARDS_SWEEP_INTERVAL * DTLS_TICKS_PER_SECOND;
+    }
+  }
+  return NULL;
+}
+
+static int
+shard_socket(const dtls_shards_config_t *config) {
+  int fd, on = 1;
+
+  if ((fd = socket(config->addr->sa_family, SOCK_DGRAM, 0)) < 0) {
+    dtls_warn("socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+#ifdef SO_REUSEPORT
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    dtls_warn("setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+    goto error;
+  }
+#endif /* SO_REUSEPORT */
+#ifdef IPV6_V6ONLY
+  if (config->addr->sa_family == AF_INET6) {
+    on = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+  }
+#endif /* IPV6_V6ONLY */
+
+  if (bind(fd, config->addr, config->addrlen) < 0) {
+    dtls_warn("bind: %s\n", strerror(errno));
+    goto error;
+  }
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    dtls_warn("fcntl: %s\n", strerror(errno));
+    goto error;
+  }
+  return fd;
+
+ error:
+  close(fd);
+  return -1;
+}
+
+static int
+shard_init(dtls_shard_t *shard, unsigned int index,
+	   const dtls_shards_config_t *config) {
+  memset(shard, 0, sizeof(dtls_shard_t));
+  shard->index = index;
+  shard->fd = shard->wakeup[0] = shard->wakeup[1] = -1;
+  pthread_mutex_init(&shard->lock, NULL);
+
+  if ((shard->fd = shard_socket(config)) < 0)
+    return -1;
+
+  if (pipe(shard->wakeup) < 0) {
+    dtls_warn("pipe: %s\n", strerror(errno));
+    shard->wakeup[0] = shard->wakeup[1] = -1;
+    return -1;
+  }
+  fcntl(shard->wakeup[0], F_SETFL, O_NONBLOCK);
+  fcntl(shard->wakeup[1], F_SETFL, O_NONBLOCK);
+
+  if (!(shard->io = malloc(sizeof(shard_io_t)))) {
+    dtls_warn("cannot allocate buffers for shard %u\n", index);
+    return -1;
+  }
+
+  if (!(shard->ctx = dtls_new_context(config->app)))
+    return -1;
+
+  shard->handler = *config->handler;
+  shard->handler.write = shard_write;
+#ifdef __linux__
+  shard->handler.write_batch = shard_write_batch;
+#else /* __linux__ */
+  shard->handler.write_batch = NULL;
+#endif /* __linux__ */
+#ifdef DTLS_ECC
+  shard->handler.submit_crypto_job = NULL;
+#endif /* DTLS_ECC */
+  dtls_set_handler(shard->ctx, &shard->handler);
+
+  /* A client may send its ClientHello with the cookie, or resume its
+   * session with a ticket, at another shard than the first one. The
+   * first shard shares its ticket key too, so that it derives the
+   * same successors as the others. */
+  if (index > 0)
+    dtls_set_cookie_secret(shard->ctx, shards[0].ctx->cookie_secret);
+#if DTLS_SESSION_TICKETS
+  dtls_set_ticket_key(shard->ctx,
+		      shards[0].ctx->ticket_keys[shards[0].ctx->ticket_key]);
+#endif /* DTLS_SESSION_TICKETS */
+  return 0;
+}
+
+static void
+shard_release(dtls_shard_t *shard) {
+  shard_free_msgs(shard->inbox);
+  shard->inbox = shard->inbox_tail = NULL;
+  dtls_free_context(shard->ctx);
+  shard->ctx = NULL;
+  free(shard->io);
+  shard->io = NULL;
+  if (shard->fd >= 0)
+    close(shard->fd);
+  if (shard->wakeup[0] >= 0) {
+    close(shard->wakeup[0]);
+    close(shard->wakeup[1]);
+  }
+  shard->fd = shard->wakeup[0] = shard->wakeup[1] = -1;
+  pthread_mutex_destroy(&shard->lock);
+}
+
+static void
+shards_shutdown(unsigned int started) {
+  unsigned int i;
+
+  for (i = 0; i < started; i++) {
+    LOCK(&shards[i].lock);
+    shards[i].stop = 1;
+    UNLOCK(&shards[i].lock);
+    if (write(shards[i].wakeup[1], "", 1) < 0 && errno != EAGAIN)
+      dtls_warn("cannot wake up shard %u: %s\n", i, strerror(errno));
+  }
+  for (i = 0; i < started; i++) {
+    pthread_join(shards[i].thread, NULL);
+  }
+  /* Peers that are queued for handover are released only now, when
+   * no shard can post anymore. */
+  for (i = 0; i < shard_count; i++) {
+    shard_release(&shards[i]);
+  }
+  LOCK(&dir_mutex);
+  dir_clear();
+  UNLOCK(&dir_mutex);
+}
+
+int
+dtls_shards_start(const dtls_shards_config_t *config) {
+  unsigned int i, workers;
+  long cpus;
+  int res;
+
+  if (!config || !config->addr || !config->handler) {
+    return -1;
+  }
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    cpus = 1;
+
+  workers = config->workers ? config->workers : (unsigned int)cpus;
+  if (workers > DTLS_SHARDS_MAX)
+    workers = DTLS_SHARDS_MAX;
+#ifndef SO_REUSEPORT
+  if (workers > 1) {
+    dtls_warn("SO_REUSEPORT is not supported, using one shard\n");
+    workers = 1;
+  }
+#endif /* SO_REUSEPORT */
+
+  LOCK(&shards_mutex);
+  if (shard_count) {
+    UNLOCK(&shards_mutex);
+    dtls_warn("shards are running already\n");
+    return -1;
+  }
+
+  shard_cpus = config->pin_cpus ? (int)cpus : 0;
+  for (shard_count = 0; shard_count < workers; shard_count++) {
+    if (shard_init(&shards[shard_count], shard_count, config) < 0) {
+      shard_count++;
+      goto error;
+    }
+  }
+
+  for (i = 0; i < shard_count; i++) {
+    if ((res = pthread_create(&shards[i].thread, NULL, shard_main, &shards[i]))) {
+      dtls_warn("cannot start shard %u: %s\n", i, strerror(res));
+      shards_shutdown(i);
+      shard_count = 0;
+      UNLOCK(&shards_mutex);
+      return -1;
+    }
+  }
+  shard_last = shard_count;
+  UNLOCK(&shards_mutex);
+  return shard_count;
+
+ error:
+  for (i = 0; i < shard_count; i++) {
+    shard_release(&shards[i]);
+  }
+  shard_count = 0;
+  UNLOCK(&shards_mutex);
+  return -1;
+}
+
+void
+dtls_shards_stop(void) {
+  LOCK(&shards_mutex);
+  if (shard_count) {
+    shards_shutdown(shard_count);
+    shard_count = 0;
+  }
+  UNLOCK(&shards_mutex);
+}
+
+int
+dtls_shards_stats(unsigned int shard, dtls_shard_stats_t *stats) {
+  int res = -1;
+
+  LOCK(&shards_mutex);
+  if (shard < shard_last && stats) {
+    if (shard_count) {
+      /* the shard is running */
+      LOCK(&shards[shard].lock);
+      *stats = shards[shard].stats;
+      UNLOCK(&shards[shard].lock);
+    } else {
+      *stats = shards[shard].stats;
+    }
+    res = 0;
+  }
+  UNLOCK(&shards_mutex);
+  return res;
+}
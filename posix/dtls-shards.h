@@ -0,0 +1,100 @@
+/**
+ * @file dtls-shards.h
+ * @brief Multi-threaded DTLS server runtime for POSIX
+ *
+ * The runtime starts a number of worker threads (shards). Each shard
+ * has its own dtls_context_t and its own UDP socket that is bound to
+ * the same address with SO_REUSEPORT, so that the kernel distributes
+ * the clients over the shards by their address. A shard handles its
+ * sessions without locks; only the directory that maps sessions to
+ * shards is shared.
+ *
+ * When a datagram of a known session arrives at a different shard
+ * (e.g. because the kernel spread the sockets anew after one has been
+ * closed), it is forwarded to the owning shard, which hands the peer
+ * over to the shard that now receives the traffic of that session.
+ *
+ * Client Hello messages of unknown sessions are checked with
+ * dtls_cookie_check() first, so that a flood of them is answered
+ * without taking the directory lock or creating peers.
+ */
+
+#ifndef _DTLS_SHARDS_H_
+#define _DTLS_SHARDS_H_
+
+#include <sys/socket.h>
+
+#include "dtls.h"
+
+#ifndef DTLS_SHARDS_MAX
+/** The maximum number of worker threads. */
+#define DTLS_SHARDS_MAX 64
+#endif
+
+#ifndef DTLS_SHARDS_BATCH
+/** The maximum number of datagrams that are read at once. */
+#define DTLS_SHARDS_BATCH 32
+#endif
+
+#ifndef DTLS_SHARDS_DIRECTORY_SIZE
+/** The number of buckets of the session directory. */
+#define DTLS_SHARDS_DIRECTORY_SIZE 1024
+#endif
+
+#ifndef DTLS_SHARDS_SWEEP_INTERVAL
+/**
+ * Interval in seconds in which the shards remove the sessions from
+ * the directory that they do not have a peer for anymore.
+ */
+#define DTLS_SHARDS_SWEEP_INTERVAL 10
+#endif
+
+typedef struct {
+  const struct sockaddr *addr; /**< the local address to bind to */
+  socklen_t addrlen;	       /**< the size of @c addr */
+  unsigned int workers;	       /**< number of shards, 0 for one per CPU */
+  int pin_cpus;		       /**< pin shard @c i to CPU @c i */
+
+  /**
+   * The callbacks for all shards. write() and write_batch() are
+   * provided by the runtime and submit_crypto_job() is not used, as
+   * the shards compute handshakes in parallel already.
+   */
+  const dtls_handler_t *handler;
+  void *app;		       /**< application data of all contexts */
+} dtls_shards_config_t;
+
+typedef struct {
+  unsigned long datagrams;     /**< datagrams read from the socket */
+  unsigned long forwarded;     /**< datagrams passed to the owner */
+  unsigned long handovers;     /**< peers handed to another shard */
+  unsigned long hello_verifies; /**< HelloVerifyRequests sent statelessly */
+  unsigned long dropped;       /**< malformed ClientHello messages */
+} dtls_shard_stats_t;
+
+/**
+ * Starts the worker threads as given by @p config. Only one set of
+ * workers can be running at a time.
+ *
+ * @return The number of shards that have been started, or a value
+ *  less than zero on error.
+ */
+int dtls_shards_start(const dtls_shards_config_t *config);
+
+/**
+ * Stops the worker threads and releases their contexts, which closes
+ * all connections.
+ */
+void dtls_shards_stop(void);
+
+/**
+ * Copies the counters of shard @p shard to @p stats. This may be
+ * called while the shards run. After dtls_shards_stop(), the final
+ * values are kept until the next start.
+ *
+ * @return @c 0 on success, or a value less than zero if there is no
+ *  such shard.
+ */
+int dtls_shards_stats(unsigned int shard, dtls_shard_stats_t *stats);
+
+#endif /* _DTLS_SHARDS_H_ */
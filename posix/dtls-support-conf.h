@@ -26,4 +26,14 @@ typedef uint64_t dtls_tick_t;
 
 void dtls_support_log_prefix(int level, const char *level_str, const char *module);
 
+/**
+ * Starts a background thread that refills the pools of precomputed
+ * key material (see dtls_ecdh_pool_refill()) whenever they run low.
+ * Returns 0 on success, -1 otherwise.
+ */
+int dtls_pool_thread_start(void);
+
+/** Stops the thread started by dtls_pool_thread_start(). */
+void dtls_pool_thread_stop(void);
+
 #endif /* DTLS_SUPPORT_CONF_H_ */
@@ -12,12 +12,26 @@
 #endif
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <unistd.h>
+
+/* getrandom() is available on Linux since glibc 2.25 and in other C
+ * libraries such as musl. Elsewhere, /dev/urandom is read. */
+#if defined(__linux__) && \
+  (!defined(__GLIBC__) || __GLIBC__ > 2 || \
+   (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+#define HAVE_GETRANDOM 1
+#include <sys/random.h>
+#endif /* __linux__ */
+
+#include "aes/rijndael.h"
+#include "dtls-numeric.h"
+#include "dtls-crypto.h"
 
 #include <pthread.h>
-static pthread_mutex_t cipher_context_mutex = PTHREAD_MUTEX_INITIALIZER;
-static dtls_cipher_context_t cipher_context;
 #define LOCK(P) pthread_mutex_lock(P)
 #define UNLOCK(P) pthread_mutex_unlock(P)
 
@@ -49,38 +63,396 @@ dtls_support_log_prefix(int level, const char *level_str, const char *module)
   }
 }
 
-dtls_cipher_context_t *
-dtls_cipher_context_acquire(void)
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_thread_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t pool_thread;
+static int pool_thread_running, pool_thread_wakeup;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* The pool locks are held across fork() so that the child gets them
+ * in a consistent state. The child must not use the parent's
+ * precomputed keys and has no refill thread. */
+static void
+pool_atfork_prepare(void)
+{
+  LOCK(&pool_thread_mutex);
+  LOCK(&pool_mutex);
+}
+
+static void
+pool_atfork_parent(void)
+{
+  UNLOCK(&pool_mutex);
+  UNLOCK(&pool_thread_mutex);
+}
+
+static void
+pool_atfork_child(void)
+{
+  UNLOCK(&pool_mutex);
+  pool_thread_running = 0;
+  pool_thread_wakeup = 0;
+  UNLOCK(&pool_thread_mutex);
+#ifdef DTLS_ECC
+  dtls_crypto_pool_flush();
+#endif /* DTLS_ECC */
+}
+
+static void
+pool_register_atfork(void)
 {
-  LOCK(&cipher_context_mutex);
-  return &cipher_context;
+  pthread_atfork(pool_atfork_prepare, pool_atfork_parent, pool_atfork_child);
 }
 
 void
-dtls_cipher_context_release(dtls_cipher_context_t *c)
+dtls_pool_lock(void)
 {
-  /* just one single context for now */
-  UNLOCK(&cipher_context_mutex);
+  LOCK(&pool_mutex);
 }
 
+void
+dtls_pool_unlock(void)
+{
+  UNLOCK(&pool_mutex);
+}
 
 void
-memb_init(struct memb *m)
+dtls_pool_wakeup(void)
+{
+  LOCK(&pool_thread_mutex);
+  pool_thread_wakeup = 1;
+  pthread_cond_signal(&pool_thread_cond);
+  UNLOCK(&pool_thread_mutex);
+}
+
+static void *
+pool_thread_main(void *arg)
+{
+  int running = 1;
+
+  while (running) {
+#ifdef DTLS_ECC
+    while (dtls_ecdh_pool_refill(1) + dtls_ecdsa_presig_pool_refill(1) > 0)
+      ;
+#endif /* DTLS_ECC */
+
+    LOCK(&pool_thread_mutex);
+    while (pool_thread_running && !pool_thread_wakeup)
+      pthread_cond_wait(&pool_thread_cond, &pool_thread_mutex);
+    pool_thread_wakeup = 0;
+    running = pool_thread_running;
+    UNLOCK(&pool_thread_mutex);
+  }
+  return NULL;
+}
+
+int
+dtls_pool_thread_start(void)
+{
+  int res = 0;
+
+  LOCK(&pool_thread_mutex);
+  if (!pool_thread_running) {
+    pool_thread_running = 1;
+    if ((res = pthread_create(&pool_thread, NULL, pool_thread_main, NULL))) {
+      dtls_warn("cannot start key pool thread: %s\n", strerror(res));
+      pool_thread_running = 0;
+    }
+  }
+  UNLOCK(&pool_thread_mutex);
+  return res ? -1 : 0;
+}
+
+void
+dtls_pool_thread_stop(void)
+{
+  int running;
+
+  LOCK(&pool_thread_mutex);
+  running = pool_thread_running;
+  pool_thread_running = 0;
+  pthread_cond_signal(&pool_thread_cond);
+  UNLOCK(&pool_thread_mutex);
+
+  if (running)
+    pthread_join(pool_thread, NULL);
+}
+
+/* --------- memory blocks ----------- */
+
+/*
+ * Memory blocks are lists of slabs. A slab holds a header and an
+ * array of objects that are MEMB_CONF_ALIGN bytes aligned. Free
+ * objects are linked through their first word. Slabs are never
+ * released.
+ */
+struct memb_slab {
+  struct memb_slab *next;
+  void *mem;			/* as returned by malloc() */
+};
+
+#define MEMB_SLAB_HEADER \
+  ((sizeof(struct memb_slab) + MEMB_CONF_ALIGN - 1) & ~(size_t)(MEMB_CONF_ALIGN - 1))
+
+static struct memb *memb_blocks[MEMB_CONF_MAX_BLOCKS];
+static unsigned int memb_block_count;
+static pthread_mutex_t memb_blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t memb_once = PTHREAD_ONCE_INIT;
+
+#if MEMB_CONF_THREAD_CACHE
+typedef struct {
+  void *head;
+  unsigned int count;
+} memb_cache_t;
+
+static __thread memb_cache_t memb_cache[MEMB_CONF_MAX_BLOCKS];
+static __thread int memb_cache_armed;
+static pthread_key_t memb_cache_key;
+
+/* Moves up to @p count objects from the cache @p c to the free list
+ * of @p m. Must be called with the lock of @p m held. */
+static void
+memb_cache_flush(struct memb *m, memb_cache_t *c, unsigned int count)
 {
+  void *p;
+
+  while (count-- && (p = c->head)) {
+    c->head = *(void **)p;
+    c->count--;
+    *(void **)p = m->free;
+    m->free = p;
+    m->used--;
+  }
 }
 
+/* Returns the cached objects of a terminating thread. */
+static void
+memb_cache_release(void *arg)
+{
+  unsigned int i;
+
+  for (i = 0; i < MEMB_CONF_MAX_BLOCKS; i++) {
+    if (memb_cache[i].count) {
+      LOCK(&memb_blocks[i]->lock);
+      memb_cache_flush(memb_blocks[i], &memb_cache[i], memb_cache[i].count);
+      UNLOCK(&memb_blocks[i]->lock);
+    }
+  }
+}
+
+static inline memb_cache_t *
+memb_thread_cache(struct memb *m)
+{
+  if (!m->index)
+    return NULL;
+  if (!memb_cache_armed) {
+    /* any non-NULL value makes the destructor run */
+    pthread_setspecific(memb_cache_key, memb_cache);
+    memb_cache_armed = 1;
+  }
+  return &memb_cache[m->index - 1];
+}
+#endif /* MEMB_CONF_THREAD_CACHE */
+
+/* The locks of all memory blocks are held across fork(), so that
+ * the child gets consistent free lists. */
+static void
+memb_atfork_prepare(void)
+{
+  unsigned int i;
+
+  LOCK(&memb_blocks_mutex);
+  for (i = 0; i < memb_block_count; i++)
+    LOCK(&memb_blocks[i]->lock);
+}
+
+static void
+memb_atfork_release(void)
+{
+  unsigned int i = memb_block_count;
+
+  while (i--)
+    UNLOCK(&memb_blocks[i]->lock);
+  UNLOCK(&memb_blocks_mutex);
+}
+
+static void
+memb_register_atfork(void)
+{
+  pthread_atfork(memb_atfork_prepare, memb_atfork_release,
+		 memb_atfork_release);
+#if MEMB_CONF_THREAD_CACHE
+  pthread_key_create(&memb_cache_key, memb_cache_release);
+#endif /* MEMB_CONF_THREAD_CACHE */
+}
+
+/* Registers @p m for memb_get_stats(), the thread caches and fork(). */
+static void
+memb_register(struct memb *m)
+{
+  pthread_once(&memb_once, memb_register_atfork);
+
+  LOCK(&memb_blocks_mutex);
+  if (!m->index && memb_block_count < MEMB_CONF_MAX_BLOCKS) {
+    memb_blocks[memb_block_count++] = m;
+    m->index = memb_block_count;
+  }
+  UNLOCK(&memb_blocks_mutex);
+}
+
+/* Adds a slab to @p m. Must be called with the lock of @p m held. */
+static int
+memb_grow(struct memb *m)
+{
+  struct memb_slab *slab;
+  unsigned int n = m->num;
+  uint8_t *mem, *obj;
+
+#if MEMB_CONF_GROW
+  if (n < MEMB_CONF_SLAB_OBJECTS)
+    n = MEMB_CONF_SLAB_OBJECTS;
+#else /* MEMB_CONF_GROW */
+  if (m->slabs)
+    return -1;
+#endif /* MEMB_CONF_GROW */
+  if (!n)
+    return -1;
+
+  mem = malloc(MEMB_CONF_ALIGN - 1 + MEMB_SLAB_HEADER + n * m->stride);
+  if (!mem)
+    return -1;
+
+  slab = (struct memb_slab *)(((uintptr_t)mem + MEMB_CONF_ALIGN - 1)
+			      & ~(uintptr_t)(MEMB_CONF_ALIGN - 1));
+  slab->mem = mem;
+  slab->next = m->slabs;
+  m->slabs = slab;
+  m->capacity += n;
+
+  /* the objects are handed out in address order */
+  obj = (uint8_t *)slab + MEMB_SLAB_HEADER + n * m->stride;
+  while (n--) {
+    obj -= m->stride;
+    *(void **)obj = m->free;
+    m->free = obj;
+  }
+  return 0;
+}
+
+void
+memb_init(struct memb *m)
+{
+  size_t stride = m->size < sizeof(void *) ? sizeof(void *) : m->size;
+
+  memb_register(m);
+
+  /* Unlike on Contiki, the objects in use are kept, as several
+   * modules and applications may call dtls_init(). */
+  LOCK(&m->lock);
+  m->stride = (stride + MEMB_CONF_ALIGN - 1) & ~(size_t)(MEMB_CONF_ALIGN - 1);
+  UNLOCK(&m->lock);
+}
 
 void *
 memb_alloc(struct memb *m)
 {
-  return malloc(m->size);
+  void *p;
+#if MEMB_CONF_THREAD_CACHE
+  memb_cache_t *c = memb_thread_cache(m);
+
+  if (c && c->head) {
+    p = c->head;
+    c->head = *(void **)p;
+    c->count--;
+    return p;
+  }
+#endif /* MEMB_CONF_THREAD_CACHE */
+
+  LOCK(&m->lock);
+  if (!m->stride) {
+    UNLOCK(&m->lock);
+    memb_init(m);
+    LOCK(&m->lock);
+  }
+  if (!m->free)
+    memb_grow(m);
+
+  if ((p = m->free)) {
+    m->free = *(void **)p;
+    m->used++;
+#if MEMB_CONF_THREAD_CACHE
+    /* take half a cache worth of objects for the next allocations */
+    while (c && m->free && c->count < MEMB_CONF_THREAD_CACHE / 2) {
+      void *q = m->free;
+
+      m->free = *(void **)q;
+      *(void **)q = c->head;
+      c->head = q;
+      c->count++;
+      m->used++;
+    }
+#endif /* MEMB_CONF_THREAD_CACHE */
+    if (m->used > m->high_water)
+      m->high_water = m->used;
+  } else {
+    m->failed++;
+  }
+  UNLOCK(&m->lock);
+  return p;
 }
 
 char
 memb_free(struct memb *m, void *ptr)
 {
-  free(ptr);
-  return 1;
+#if MEMB_CONF_THREAD_CACHE
+  memb_cache_t *c;
+#endif /* MEMB_CONF_THREAD_CACHE */
+
+  if (!ptr)
+    return -1;
+
+#if MEMB_CONF_THREAD_CACHE
+  if ((c = memb_thread_cache(m))) {
+    *(void **)ptr = c->head;
+    c->head = ptr;
+    if (++c->count > MEMB_CONF_THREAD_CACHE) {
+      LOCK(&m->lock);
+      memb_cache_flush(m, c, c->count / 2);
+      UNLOCK(&m->lock);
+    }
+    return 0;
+  }
+#endif /* MEMB_CONF_THREAD_CACHE */
+
+  LOCK(&m->lock);
+  *(void **)ptr = m->free;
+  m->free = ptr;
+  m->used--;
+  UNLOCK(&m->lock);
+  return 0;
+}
+
+int
+memb_get_stats(unsigned int i, struct memb_stats *stats)
+{
+  struct memb *m;
+
+  LOCK(&memb_blocks_mutex);
+  m = i < memb_block_count ? memb_blocks[i] : NULL;
+  UNLOCK(&memb_blocks_mutex);
+  if (!m || !stats)
+    return -1;
+
+  LOCK(&m->lock);
+  stats->name = m->name;
+  stats->size = m->stride;
+  stats->capacity = m->capacity;
+  stats->used = m->used;
+  stats->high_water = m->high_water;
+  stats->failed = m->failed;
+  UNLOCK(&m->lock);
+  return 0;
 }
 
 
@@ -109,23 +481,198 @@ dtls_ticks(dtls_tick_t *t)
     + (tv.tv_usec * (dtls_tick_t)DTLS_TICKS_PER_SECOND / 1000000);
 }
 
-int
-dtls_fill_random(uint8_t *buf, size_t len)
+/* --------- random numbers ----------- */
+
+/*
+ * Random numbers are taken from a per-thread AES-128 CTR_DRBG as
+ * specified in NIST SP 800-90A (without derivation function). The
+ * generator is seeded from getrandom() or /dev/urandom and reseeded
+ * after DTLS_DRBG_RESEED_INTERVAL refills of its output buffer, or in
+ * the child after fork(). Output is generated DTLS_DRBG_BUFFER_SIZE bytes
+ * at a time, so that most calls only copy from the buffer. Bytes are
+ * erased from the buffer once they have been handed out, and the key
+ * is updated after each refill.
+ */
+#ifndef DTLS_DRBG_BUFFER_SIZE
+#define DTLS_DRBG_BUFFER_SIZE 256
+#endif /* DTLS_DRBG_BUFFER_SIZE */
+
+#ifndef DTLS_DRBG_RESEED_INTERVAL
+#define DTLS_DRBG_RESEED_INTERVAL 4096
+#endif /* DTLS_DRBG_RESEED_INTERVAL */
+
+#define DRBG_KEYLEN   16
+#define DRBG_BLOCKLEN 16
+#define DRBG_SEEDLEN  (DRBG_KEYLEN + DRBG_BLOCKLEN)
+
+typedef struct {
+  rijndael_ctx ctx;
+  uint8_t V[DRBG_BLOCKLEN];
+  unsigned int refills;         /**< refills since the last (re)seed */
+  unsigned int generation;      /**< drbg_generation when seeded */
+  int seeded;
+  size_t pos;                   /**< next unused byte in buffer */
+  uint8_t buffer[DTLS_DRBG_BUFFER_SIZE];
+} dtls_drbg_t;
+
+static __thread dtls_drbg_t drbg;
+
+/* incremented in the child after fork() to force a reseed */
+static unsigned int drbg_generation;
+static pthread_once_t drbg_once = PTHREAD_ONCE_INIT;
+
+static void
+drbg_atfork_child(void)
+{
+  drbg_generation++;
+}
+
+static void
+drbg_register_atfork(void)
 {
-  FILE *urandom = fopen("/dev/urandom", "r");
+  pthread_atfork(NULL, NULL, drbg_atfork_child);
+}
+
+static int
+get_entropy(uint8_t *buf, size_t len)
+{
+  int fd;
+  ssize_t n;
+
+#ifdef HAVE_GETRANDOM
+  while(len) {
+    n = getrandom(buf, len, 0);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  if(!len) {
+    return 1;
+  }
+#endif /* HAVE_GETRANDOM */
 
-  if(!urandom) {
-    dtls_emerg("cannot initialize random\n");
+  /* getrandom() is not available or not supported by the kernel */
+  fd = open("/dev/urandom", O_RDONLY);
+  if(fd < 0) {
     return 0;
   }
+  while(len && (n = read(fd, buf, len)) > 0) {
+    buf += n;
+    len -= n;
+  }
+  close(fd);
+  return len == 0;
+}
+
+static void
+drbg_increment(uint8_t V[DRBG_BLOCKLEN])
+{
+  int i = DRBG_BLOCKLEN;
 
-  if(fread(buf, 1, len, urandom) != len) {
-    dtls_emerg("cannot fill random\n");
-    fclose(urandom);
+  while(i-- && ++V[i] == 0)
+    ;
+}
+
+/* CTR_DRBG_Update() from SP 800-90A, 10.2.1.2 */
+static void
+drbg_update(dtls_drbg_t *d, const uint8_t data[DRBG_SEEDLEN])
+{
+  uint8_t temp[DRBG_SEEDLEN];
+  int i;
+
+  for(i = 0; i < DRBG_SEEDLEN; i += DRBG_BLOCKLEN) {
+    drbg_increment(d->V);
+    rijndael_encrypt(&d->ctx, d->V, temp + i);
+  }
+  if(data) {
+    memxor(temp, data, DRBG_SEEDLEN);
+  }
+
+  rijndael_set_key_enc_only(&d->ctx, temp, 8 * DRBG_KEYLEN);
+  memcpy(d->V, temp + DRBG_KEYLEN, DRBG_BLOCKLEN);
+  memset(temp, 0, sizeof(temp));
+}
+
+static int
+drbg_seed(dtls_drbg_t *d)
+{
+  uint8_t seed[DRBG_SEEDLEN];
+
+  if(!get_entropy(seed, sizeof(seed))) {
     return 0;
   }
 
-  fclose(urandom);
+  if(!d->seeded) {
+    /* instantiate with key and V set to zero */
+    uint8_t key[DRBG_KEYLEN] = { 0 };
+    rijndael_set_key_enc_only(&d->ctx, key, 8 * DRBG_KEYLEN);
+    memset(d->V, 0, sizeof(d->V));
+  }
+  drbg_update(d, seed);
+  memset(seed, 0, sizeof(seed));
+
+  d->refills = 0;
+  d->generation = drbg_generation;
+  d->seeded = 1;
+  d->pos = sizeof(d->buffer);     /* discard buffered output */
+  return 1;
+}
+
+static int
+drbg_refill(dtls_drbg_t *d)
+{
+  size_t i;
+
+  if(d->refills >= DTLS_DRBG_RESEED_INTERVAL) {
+    if(!drbg_seed(d)) {
+      return 0;
+    }
+  }
+
+  for(i = 0; i < sizeof(d->buffer); i += DRBG_BLOCKLEN) {
+    drbg_increment(d->V);
+    rijndael_encrypt(&d->ctx, d->V, d->buffer + i);
+  }
+  drbg_update(d, NULL);
+
+  d->refills++;
+  d->pos = 0;
+  return 1;
+}
+
+int
+dtls_fill_random(uint8_t *buf, size_t len)
+{
+  dtls_drbg_t *d = &drbg;
+  size_t n;
+
+  if(!d->seeded || d->generation != drbg_generation) {
+    pthread_once(&drbg_once, drbg_register_atfork);
+    if(!drbg_seed(d)) {
+      dtls_emerg("cannot initialize random\n");
+      return 0;
+    }
+  }
+
+  while(len) {
+    if(d->pos == sizeof(d->buffer) && !drbg_refill(d)) {
+      dtls_emerg("cannot fill random\n");
+      return 0;
+    }
+
+    n = min(len, sizeof(d->buffer) - d->pos);
+    memcpy(buf, d->buffer + d->pos, n);
+    memset(d->buffer + d->pos, 0, n);
+    d->pos += n;
+    buf += n;
+    len -= n;
+  }
 
   return 1;
 }
@@ -171,6 +718,96 @@ dtls_session_equals(const session_t *a, const session_t *b) {
   return 0;
 }
 
+/* The key of dtls_session_hash(), random for each process, so that
+ * remote peers cannot choose addresses that collide in the peer table
+ * or the shard directory. */
+static uint64_t session_hash_key[2];
+static pthread_once_t session_hash_once = PTHREAD_ONCE_INIT;
+
+static void
+session_hash_init(void)
+{
+  if(!dtls_fill_random((uint8_t *)session_hash_key, sizeof(session_hash_key)))
+    dtls_warn("cannot initialize the session hash key\n");
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) do {				\
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);	\
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;				\
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;				\
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);	\
+  } while(0)
+
+/* SipHash-2-4, see https://www.aumasson.jp/siphash/siphash.pdf */
+static uint64_t
+siphash24(const uint64_t key[2], const uint8_t *data, size_t len)
+{
+  uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+  uint64_t m, b = (uint64_t)len << 56;
+  size_t i;
+
+  for(; len >= 8; data += 8, len -= 8) {
+    for(m = 0, i = 0; i < 8; i++)
+      m |= (uint64_t)data[i] << (8 * i);
+    v3 ^= m;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  for(i = 0; i < len; i++)
+    b |= (uint64_t)data[i] << (8 * i);
+  v3 ^= b;
+  SIPROUND(v0, v1, v2, v3);
+  SIPROUND(v0, v1, v2, v3);
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND(v0, v1, v2, v3);
+  SIPROUND(v0, v1, v2, v3);
+  SIPROUND(v0, v1, v2, v3);
+  SIPROUND(v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint32_t
+dtls_session_hash(const session_t *a) {
+  uint8_t buf[sizeof(a->ifindex) + sizeof(a->addr.sa.sa_family) +
+	      sizeof(in_port_t) + sizeof(struct in6_addr)];
+  uint8_t *p = buf;
+  uint64_t h;
+  assert(a);
+
+  pthread_once(&session_hash_once, session_hash_init);
+
+#define ADD(field, size) do { memcpy(p, (field), (size)); p += (size); } while(0)
+  ADD(&a->ifindex, sizeof(a->ifindex));
+  ADD(&a->addr.sa.sa_family, sizeof(a->addr.sa.sa_family));
+
+  /* hash only the parts that are compared by dtls_session_equals() */
+  switch (a->addr.sa.sa_family) {
+  case AF_INET:
+    ADD(&a->addr.sin.sin_port, sizeof(a->addr.sin.sin_port));
+    ADD(&a->addr.sin.sin_addr, sizeof(struct in_addr));
+    break;
+  case AF_INET6:
+    ADD(&a->addr.sin6.sin6_port, sizeof(a->addr.sin6.sin6_port));
+    ADD(&a->addr.sin6.sin6_addr, sizeof(struct in6_addr));
+    break;
+  default:
+    ;
+  }
+#undef ADD
+
+  h = siphash24(session_hash_key, buf, p - buf);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
 void *
 dtls_session_get_address(const session_t *a)
 {
@@ -257,6 +894,8 @@ dtls_session_print(const session_t *addr)
 void
 dtls_support_init(void)
 {
+  pthread_once(&pool_once, pool_register_atfork);
+
 #ifdef HAVE_TIME_H
   dtls_clock_offset = time(NULL);
 #else
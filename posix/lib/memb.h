@@ -52,6 +52,47 @@
 #ifndef MEMB_H_
 #define MEMB_H_
 
+#include <stddef.h>
+#include <pthread.h>
+
+#ifndef MEMB_CONF_GROW
+/**
+ * If set, a memory block that is exhausted gets another slab of at
+ * least MEMB_CONF_SLAB_OBJECTS objects. Otherwise memb_alloc() fails
+ * once the @c num objects given to MEMB() are in use.
+ */
+#define MEMB_CONF_GROW 1
+#endif
+
+#ifndef MEMB_CONF_SLAB_OBJECTS
+/** The minimum number of objects per slab if MEMB_CONF_GROW is set. */
+#define MEMB_CONF_SLAB_OBJECTS 16
+#endif
+
+#ifndef MEMB_CONF_ALIGN
+/** Objects are aligned to and padded to this size (a cache line). */
+#define MEMB_CONF_ALIGN 64
+#endif
+
+#ifndef MEMB_CONF_THREAD_CACHE
+/**
+ * The number of free objects of each memory block that a thread may
+ * keep for itself, so that most allocations need no lock. 0 disables
+ * the thread caches. Objects in a cache are not available to other
+ * threads, so the caches are only enabled if MEMB_CONF_GROW is set.
+ */
+#if MEMB_CONF_GROW
+#define MEMB_CONF_THREAD_CACHE 32
+#else /* MEMB_CONF_GROW */
+#define MEMB_CONF_THREAD_CACHE 0
+#endif /* MEMB_CONF_GROW */
+#endif
+
+#ifndef MEMB_CONF_MAX_BLOCKS
+/** The number of memory blocks that have stats and thread caches. */
+#define MEMB_CONF_MAX_BLOCKS 32
+#endif
+
 /**
  * Declare a memory block.
  *
@@ -74,10 +115,35 @@ MEMB(connections, struct connection, 16);
  *
  */
 #define MEMB(name, structure, num) \
-  static struct memb name = {sizeof(structure)}
+  static struct memb name = { sizeof(structure), num, #name, \
+                              PTHREAD_MUTEX_INITIALIZER }
+
+struct memb_slab;
 
 struct memb {
-  unsigned short size;
+  unsigned short size;		/**< size of one object */
+  unsigned short num;		/**< number of objects given to MEMB() */
+  const char *name;
+  pthread_mutex_t lock;		/**< protects the fields below */
+
+  int index;			/**< registration number plus one */
+  size_t stride;		/**< aligned size of one object */
+  void *free;			/**< list of free objects */
+  struct memb_slab *slabs;
+  unsigned int capacity;	/**< objects in all slabs */
+  unsigned int used;		/**< objects not in the free list */
+  unsigned int high_water;	/**< maximum of @c used */
+  unsigned long failed;		/**< failed allocations */
+};
+
+/** Usage statistics of a memory block. */
+struct memb_stats {
+  const char *name;		/**< name given to MEMB() */
+  size_t size;			/**< size of one object, with padding */
+  unsigned int capacity;	/**< objects in all slabs */
+  unsigned int used;		/**< allocated objects */
+  unsigned int high_water;	/**< maximum of @c used so far */
+  unsigned long failed;		/**< allocations that have failed */
 };
 
 /**
@@ -108,4 +174,13 @@ void *memb_alloc(struct memb *m);
  */
 char  memb_free(struct memb *m, void *ptr);
 
+/**
+ * Copies the statistics of the memory block with number @p i to
+ * @p stats. Memory blocks are numbered in the order in which they
+ * have been initialized. Objects in thread caches count as used.
+ *
+ * \return 0 on success, or -1 if there is no such memory block.
+ */
+int   memb_get_stats(unsigned int i, struct memb_stats *stats);
+
 #endif /* MEMB_H_ */
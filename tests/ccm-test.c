@@ -49,7 +49,7 @@ PROCESS_THREAD(ccm_test_process, ev, d)
 int main(int argc, char **argv) {
 #endif /* WITH_CONTIKI */
   long int len;
-  int n;
+  int n, impl;
 
   rijndael_ctx ctx;
 
@@ -57,36 +57,49 @@ int main(int argc, char **argv) {
   PROCESS_BEGIN();
 #endif /* CONTIKI */
 
-  for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
-
-    if (rijndael_set_key_enc_only(&ctx, data[n].key, 8*sizeof(data[n].key)) < 0) {
-      fprintf(stderr, "cannot set key\n");
-      return -1;
+  /* run all vectors with each available AES implementation */
+  for (impl = RIJNDAEL_IMPL_TABLE; impl <= RIJNDAEL_IMPL_AESNI; impl++) {
+    if (rijndael_set_impl(impl) < 0) {
+      printf("AES implementation %d not available, skipped\n", impl);
+      continue;
     }
+    printf("AES implementation: %s\n",
+	   impl == RIJNDAEL_IMPL_AESNI ? "AES-NI" : "table");
+
+    for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+      /* the vectors are encrypted in place, work on a copy */
+      unsigned char msg[sizeof(data[n].msg)];
+      memcpy(msg, data[n].msg, sizeof(msg));
 
-    len = dtls_ccm_encrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
-				   data[n].msg + data[n].la, 
-				   data[n].lm - data[n].la, 
-				   data[n].msg, data[n].la);
+      if (rijndael_set_key_enc_only(&ctx, data[n].key, 8*sizeof(data[n].key)) < 0) {
+        fprintf(stderr, "cannot set key\n");
+        return -1;
+      }
+
+      len = dtls_ccm_encrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
+				     msg + data[n].la, 
+				     data[n].lm - data[n].la, 
+				     msg, data[n].la);
     
-    len +=  + data[n].la;
-    printf("Packet Vector #%d ", n+1);
-    if (len != data[n].r_lm || memcmp(data[n].msg, data[n].result, len))
-      printf("FAILED, ");
-    else 
-      printf("OK, ");
+      len +=  + data[n].la;
+      printf("Packet Vector #%d ", n+1);
+      if (len != data[n].r_lm || memcmp(msg, data[n].result, len))
+        printf("FAILED, ");
+      else 
+        printf("OK, ");
     
-    printf("result is (total length = %lu):\n\t", len);
-    dump(data[n].msg, len);
+      printf("result is (total length = %lu):\n\t", len);
+      dump(msg, len);
 
-    len = dtls_ccm_decrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
-				   data[n].msg + data[n].la, len - data[n].la, 
-				   data[n].msg, data[n].la);
+      len = dtls_ccm_decrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
+				     msg + data[n].la, len - data[n].la, 
+				     msg, data[n].la);
     
-    if (len < 0)
-      printf("Packet Vector #%d: cannot decrypt message\n", n+1);
-    else 
-      printf("\t*** MAC verified (total length = %lu) ***\n", len + data[n].la);
+      if (len < 0)
+        printf("Packet Vector #%d: cannot decrypt message\n", n+1);
+      else 
+        printf("\t*** MAC verified (total length = %lu) ***\n", len + data[n].la);
+    }
   }
 
 #ifdef CONTIKI
@@ -391,5 +391,55 @@ struct test_vector data[] = {
       0xa6, 0xc7, 0x46, 0x3d, 0x5a, 0xc3, 0x0a, 0x73,
       0x14, 0x96, 0xa4, 0x84, 0x7f, 0x37, 0x55, 0x42,
       0xce, 0x7e, 0xf9, 0x3b, 0xe5 } /* result */
+  },
+
+  /* #33 */
+  /* DTLS record: M=8 L=3, 13 bytes of additional data */
+  { 8, 3, 32, 13,
+    { 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+      0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf },	/* AES key */
+    { 0x5a, 0x11, 0x7e, 0x03, 0x00, 0x01, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x07 },	/* Nonce */
+    { 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+      0x17, 0xfe, 0xfd, 0x00, 0x13, 0x03, 0x0a, 0x11,
+      0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49,
+      0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73, 0x7a, 0x81 },	/* msg */
+    40,	/* length of result */
+    { 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+      0x17, 0xfe, 0xfd, 0x00, 0x13, 0x22, 0xc8, 0x92,
+      0x8d, 0xfb, 0x77, 0x5b, 0x5e, 0x69, 0xfd, 0xf3,
+      0x2f, 0xcf, 0x3b, 0x22, 0xfe, 0xf5, 0x8b, 0xde,
+      0x1d, 0x0b, 0xae, 0xa5, 0x3a, 0x90, 0xdd, 0xe8 }	/* result */
+  },
+
+  /* #34 */
+  /* DTLS record: M=8 L=3, 13 bytes of additional data */
+  { 8, 3, 77, 13,
+    { 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+      0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf },	/* AES key */
+    { 0x5a, 0x11, 0x7e, 0x03, 0x00, 0x01, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x07 },	/* Nonce */
+    { 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+      0x17, 0xfe, 0xfd, 0x00, 0x40, 0x03, 0x0a, 0x11,
+      0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49,
+      0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73, 0x7a, 0x81,
+      0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2, 0xb9,
+      0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0xf1,
+      0xf8, 0xff, 0x06, 0x0d, 0x14, 0x1b, 0x22, 0x29,
+      0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61,
+      0x68, 0x6f, 0x76, 0x7d, 0x84, 0x8b, 0x92, 0x99,
+      0xa0, 0xa7, 0xae, 0xb5, 0xbc },	/* msg */
+    85,	/* length of result */
+    { 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+      0x17, 0xfe, 0xfd, 0x00, 0x40, 0x22, 0xc8, 0x92,
+      0x8d, 0xfb, 0x77, 0x5b, 0x5e, 0x69, 0xfd, 0xf3,
+      0x2f, 0xcf, 0x3b, 0x22, 0xfe, 0xf5, 0x8b, 0xde,
+      0x3e, 0x91, 0x4a, 0x9a, 0x2f, 0x68, 0x85, 0xfe,
+      0xaf, 0x07, 0x12, 0x70, 0xf2, 0xd5, 0x97, 0xb2,
+      0x25, 0x72, 0xcf, 0xed, 0x18, 0xf2, 0x7c, 0xf2,
+      0x64, 0xb5, 0x01, 0xdd, 0xf6, 0x7d, 0xdc, 0x21,
+      0x74, 0x99, 0x14, 0xd8, 0x69, 0xa8, 0x2b, 0x46,
+      0xf6, 0x72, 0x5f, 0xcf, 0x7d, 0x6b, 0xf9, 0x86,
+      0x26, 0x9e, 0x30, 0x92, 0x84 }	/* result */
   }
 };
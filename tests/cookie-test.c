@@ -0,0 +1,234 @@
+/*
+ * Checks the rotation of the cookie secret. The program is linked
+ * with its own build of dtls.c where DTLS_COOKIE_SECRET_LIFETIME is
+ * one second (see Makefile). A cookie must be accepted in the
+ * generation after the one that issued it and rejected two
+ * generations later. Meanwhile, a second thread checks fresh cookies
+ * with dtls_cookie_check() while the main thread replaces the keys.
+ */
+
+#include "tinydtls.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dtls.h"
+
+/* Log configuration */
+#define LOG_MODULE "cookie-test"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+#if DTLS_COOKIE_SECRET_LIFETIME != 1
+#error "cookie-test must be built with DTLS_COOKIE_SECRET_LIFETIME=1"
+#endif
+
+#ifdef __GNUC__
+#define UNUSED_PARAM __attribute__((unused))
+#else
+#define UNUSED_PARAM
+#endif /* __GNUC__ */
+
+typedef struct {
+  size_t length;
+  uint8_t data[DTLS_MAX_BUF];
+} datagram_t;
+
+static datagram_t written;
+static dtls_context_t *server;
+static session_t session;
+static datagram_t hello, hello_cookie;
+static size_t cookie_offset;
+static unsigned long last_generation;
+static int errors;
+
+static int
+send_to_peer(struct dtls_context_t *ctx UNUSED_PARAM,
+	     session_t *dst UNUSED_PARAM, uint8_t *data, size_t len) {
+  if (len > sizeof(written.data))
+    return -1;
+  memcpy(written.data, data, len);
+  written.length = len;
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx UNUSED_PARAM,
+	       session_t *dst UNUSED_PARAM,
+	       uint8_t *data UNUSED_PARAM, size_t len UNUSED_PARAM) {
+  return 0;
+}
+
+static dtls_handler_t handler = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+};
+
+static unsigned long
+generation(void) {
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  return now / DTLS_TICKS_PER_SECOND;
+}
+
+/* Waits for the start of the next cookie secret generation. */
+static unsigned long
+next_generation(void) {
+  unsigned long g = generation();
+
+  while (generation() == g)
+    usleep(1000);
+  return g + 1;
+}
+
+/* Returns the result of dtls_cookie_check() for the Client Hello in @p d. */
+static int
+check(const datagram_t *d, uint8_t *reply, size_t *reply_length) {
+  return dtls_cookie_check(server, &session, d->data, d->length,
+			   reply, reply_length);
+}
+
+/* Replaces the keys of the server as dtls_handle_message() does. */
+static void
+update_keys(void) {
+  dtls_tick_t next;
+
+  dtls_check_retransmit(server, &next, 0);
+}
+
+/* Checks fresh cookies until last_generation has passed. */
+static void *
+run_reader(void *arg) {
+  uint8_t reply[DTLS_HELLO_VERIFY_LENGTH];
+  datagram_t d;
+  size_t reply_length;
+  unsigned long checks = 0;
+  int *failed = arg;
+
+  d = hello_cookie;
+  while (generation() <= last_generation) {
+    reply_length = sizeof(reply);
+    if (check(&hello, reply, &reply_length) != DTLS_COOKIE_HELLO_VERIFY) {
+      dtls_warn("no Hello Verify Request\n");
+      (*failed)++;
+      break;
+    }
+    /* the cookie is the end of the Hello Verify Request */
+    memcpy(d.data + cookie_offset, reply + reply_length - DTLS_COOKIE_LENGTH,
+	   DTLS_COOKIE_LENGTH);
+    reply_length = sizeof(reply);
+    if (check(&d, reply, &reply_length) != DTLS_COOKIE_VALID) {
+      dtls_warn("fresh cookie rejected after %lu checks\n", checks);
+      (*failed)++;
+      break;
+    }
+    checks++;
+  }
+  return NULL;
+}
+
+static int
+expect(const char *what, int result, int expected) {
+  if (result != expected) {
+    printf("%s: FAILED (%d instead of %d)\n", what, result, expected);
+    errors++;
+    return 0;
+  }
+  printf("%s: OK\n", what);
+  return 1;
+}
+
+int
+main(void) {
+  uint8_t reply[DTLS_HELLO_VERIFY_LENGTH];
+  size_t reply_length, i;
+  dtls_context_t *client;
+  pthread_t reader;
+  int reader_errors = 0;
+
+  dtls_init();
+
+  client = dtls_new_context(NULL);
+  server = dtls_new_context(NULL);
+  if (!client || !server) {
+    printf("cannot create contexts\n");
+    return 1;
+  }
+  dtls_set_handler(client, &handler);
+  dtls_set_handler(server, &handler);
+
+  dtls_session_init(&session);
+  session.addr.sin.sin_family = AF_INET;
+  session.addr.sin.sin_port = htons(20220);
+  session.size = sizeof(session.addr.sin);
+
+  /* start at a generation boundary, so that the steps below do not
+   * cross another one */
+  next_generation();
+  update_keys();
+
+  /* the Client Hello without and with cookie */
+  dtls_connect(client, &session);
+  hello = written;
+  reply_length = sizeof(reply);
+  if (!expect("Hello Verify Request", check(&hello, reply, &reply_length),
+	      DTLS_COOKIE_HELLO_VERIFY))
+    return 1;
+  dtls_handle_message(client, &session, reply, reply_length);
+  hello_cookie = written;
+
+  for (i = 0; i + DTLS_COOKIE_LENGTH <= hello_cookie.length; i++) {
+    if (memcmp(hello_cookie.data + i, reply + reply_length - DTLS_COOKIE_LENGTH,
+	       DTLS_COOKIE_LENGTH) == 0)
+      break;
+  }
+  if (i + DTLS_COOKIE_LENGTH > hello_cookie.length) {
+    printf("no cookie in Client Hello\n");
+    return 1;
+  }
+  cookie_offset = i;
+
+  reply_length = sizeof(reply);
+  expect("cookie of current generation",
+	 check(&hello_cookie, reply, &reply_length), DTLS_COOKIE_VALID);
+
+  /* the cookies are checked before and after the server's thread has
+   * updated its keys */
+  next_generation();
+  reply_length = sizeof(reply);
+  expect("cookie of previous generation",
+	 check(&hello_cookie, reply, &reply_length), DTLS_COOKIE_VALID);
+  update_keys();
+  reply_length = sizeof(reply);
+  expect("cookie of previous generation, keys updated",
+	 check(&hello_cookie, reply, &reply_length), DTLS_COOKIE_VALID);
+
+  next_generation();
+  reply_length = sizeof(reply);
+  expect("cookie two generations back",
+	 check(&hello_cookie, reply, &reply_length), DTLS_COOKIE_HELLO_VERIFY);
+  update_keys();
+  reply_length = sizeof(reply);
+  expect("cookie two generations back, keys updated",
+	 check(&hello_cookie, reply, &reply_length), DTLS_COOKIE_HELLO_VERIFY);
+
+  /* fresh cookies stay valid while the keys are replaced */
+  last_generation = generation() + 2;
+  if (pthread_create(&reader, NULL, run_reader, &reader_errors)) {
+    printf("cannot start reader thread\n");
+    return 1;
+  }
+  while (generation() <= last_generation)
+    update_keys();
+  pthread_join(reader, NULL);
+  expect("concurrent checks", reader_errors ? -1 : 0, 0);
+
+  dtls_free_context(client);
+  dtls_free_context(server);
+
+  printf("%s\n", errors ? "FAILED" : "All tests successful.");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * Measures full DTLS handshakes per second. A client and a server
+ * context run in the same process and exchange their records through
+ * a memory queue, so the result only depends on the protocol and
+ * crypto code.
+ *
+ * The ECDHE-ECDSA handshakes are run a second time with the ephemeral
+ * keys and ECDSA presignatures taken from the pools that a background
+ * thread refills, and a third time with the signatures and the ECDH
+ * computed by crypto jobs on a worker thread. At the end, the
+ * high-water marks of the memory blocks are shown.
+ *
+ * Usage: dtls-bench [handshakes]
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef DTLS_ECC
+#include <pthread.h>
+#endif /* DTLS_ECC */
+
+#include "dtls.h"
+#include "dtls-crypto.h"
+#include "lib/memb.h"
+
+/* Log configuration */
+#define LOG_MODULE "dtls-bench"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+#ifdef __GNUC__
+#define UNUSED_PARAM __attribute__((unused))
+#else
+#define UNUSED_PARAM
+#endif /* __GNUC__ */
+
+#define QUEUE_SIZE 32
+
+typedef struct {
+  dtls_context_t *to;
+  size_t length;
+  uint8_t data[DTLS_MAX_BUF];
+} datagram_t;
+
+static datagram_t queue[QUEUE_SIZE];
+static unsigned int queue_head, queue_tail;
+
+static dtls_context_t *client, *server;
+static session_t client_session, server_session;
+static int connected;
+
+#ifdef DTLS_ECC
+#define JOB_QUEUE_SIZE 4
+
+typedef struct {
+  dtls_context_t *ctx;
+  dtls_crypto_job_t *job;
+} crypto_job_t;
+
+/* The crypto jobs to run on the worker thread, and the jobs that are
+ * done and wait for dtls_crypto_job_complete(). */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  crypto_job_t todo[JOB_QUEUE_SIZE];
+  crypto_job_t done[JOB_QUEUE_SIZE];
+  unsigned int todo_head, todo_tail;
+  unsigned int done_head, done_tail;
+  int pending;			/* submitted but not completed */
+  int stop;
+} executor = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER
+};
+#endif /* DTLS_ECC */
+
+static const unsigned char ecdsa_priv_key[] = {
+			0x41, 0xC1, 0xCB, 0x6B, 0x51, 0x24, 0x7A, 0x14,
+			0x43, 0x21, 0x43, 0x5B, 0x7A, 0x80, 0xE7, 0x14,
+			0x89, 0x6A, 0x33, 0xBB, 0xAD, 0x72, 0x94, 0xCA,
+			0x40, 0x14, 0x55, 0xA1, 0x94, 0xA9, 0x49, 0xFA};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0x36, 0xDF, 0xE2, 0xC6, 0xF9, 0xF2, 0xED, 0x29,
+			0xDA, 0x0A, 0x9A, 0x8F, 0x62, 0x68, 0x4E, 0x91,
+			0x63, 0x75, 0xBA, 0x10, 0x30, 0x0C, 0x28, 0xC5,
+			0xE4, 0x7C, 0xFB, 0xF2, 0x5F, 0xA5, 0x8F, 0x52};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0x71, 0xA0, 0xD4, 0xFC, 0xDE, 0x1A, 0xB8, 0x78,
+			0x5A, 0x3C, 0x78, 0x69, 0x35, 0xA7, 0xCF, 0xAB,
+			0xE9, 0x3F, 0x98, 0x72, 0x09, 0xDA, 0xED, 0x0B,
+			0x4F, 0xAB, 0xC3, 0x6F, 0xC7, 0x72, 0xF8, 0x29};
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session UNUSED_PARAM,
+	     uint8_t *data, size_t len) {
+  datagram_t *d;
+
+  if (queue_tail - queue_head == QUEUE_SIZE || len > DTLS_MAX_BUF)
+    return -1;
+
+  d = &queue[queue_tail++ % QUEUE_SIZE];
+  d->to = ctx == client ? server : client;
+  d->length = len;
+  memcpy(d->data, data, len);
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx UNUSED_PARAM,
+	       session_t *session UNUSED_PARAM,
+	       uint8_t *data UNUSED_PARAM, size_t len UNUSED_PARAM) {
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx UNUSED_PARAM,
+	     session_t *session UNUSED_PARAM,
+	     dtls_alert_level_t level UNUSED_PARAM, unsigned short code) {
+  if (code == DTLS_EVENT_CONNECTED)
+    connected++;
+  return 0;
+}
+
+#ifdef DTLS_PSK
+static int
+get_psk_info(struct dtls_context_t *ctx UNUSED_PARAM,
+	     const session_t *session UNUSED_PARAM,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id UNUSED_PARAM, size_t id_len UNUSED_PARAM,
+	     unsigned char *result, size_t result_length) {
+  static const char identity[] = "Client_identity";
+  static const char key[] = "secretPSK";
+
+  switch (type) {
+  case DTLS_PSK_HINT:
+    return 0;
+  case DTLS_PSK_IDENTITY:
+    if (result_length < sizeof(identity) - 1)
+      break;
+    memcpy(result, identity, sizeof(identity) - 1);
+    return sizeof(identity) - 1;
+  case DTLS_PSK_KEY:
+    if (result_length < sizeof(key) - 1)
+      break;
+    memcpy(result, key, sizeof(key) - 1);
+    return sizeof(key) - 1;
+  default:
+    break;
+  }
+  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+}
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static int
+get_ecdsa_key(struct dtls_context_t *ctx UNUSED_PARAM,
+	      const session_t *session UNUSED_PARAM,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx UNUSED_PARAM,
+		 const session_t *session UNUSED_PARAM,
+		 const unsigned char *other_pub_x UNUSED_PARAM,
+		 const unsigned char *other_pub_y UNUSED_PARAM,
+		 size_t key_size UNUSED_PARAM) {
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+#ifdef DTLS_ECC
+static void *
+run_crypto_jobs(void *arg UNUSED_PARAM) {
+  crypto_job_t j;
+
+  pthread_mutex_lock(&executor.lock);
+  while (!executor.stop) {
+    if (executor.todo_head == executor.todo_tail) {
+      pthread_cond_wait(&executor.cond, &executor.lock);
+      continue;
+    }
+    j = executor.todo[executor.todo_head++ % JOB_QUEUE_SIZE];
+
+    pthread_mutex_unlock(&executor.lock);
+    dtls_crypto_job_run(j.job);
+    pthread_mutex_lock(&executor.lock);
+
+    executor.done[executor.done_tail++ % JOB_QUEUE_SIZE] = j;
+    pthread_cond_broadcast(&executor.cond);
+  }
+  pthread_mutex_unlock(&executor.lock);
+  return NULL;
+}
+
+static int
+submit_crypto_job(struct dtls_context_t *ctx, dtls_crypto_job_t *job) {
+  int res = -1;
+
+  pthread_mutex_lock(&executor.lock);
+  if (executor.todo_tail - executor.todo_head < JOB_QUEUE_SIZE) {
+    crypto_job_t *j = &executor.todo[executor.todo_tail++ % JOB_QUEUE_SIZE];
+
+    j->ctx = ctx;
+    j->job = job;
+    executor.pending++;
+    pthread_cond_broadcast(&executor.cond);
+    res = 0;
+  }
+  pthread_mutex_unlock(&executor.lock);
+  return res;
+}
+
+/* Waits for a job of the worker thread and completes it. */
+static void
+complete_crypto_job(void) {
+  crypto_job_t j;
+
+  pthread_mutex_lock(&executor.lock);
+  while (executor.done_head == executor.done_tail)
+    pthread_cond_wait(&executor.cond, &executor.lock);
+  j = executor.done[executor.done_head++ % JOB_QUEUE_SIZE];
+  executor.pending--;
+  pthread_mutex_unlock(&executor.lock);
+
+  dtls_crypto_job_complete(j.ctx, j.job);
+}
+#endif /* DTLS_ECC */
+
+static dtls_handler_t server_handler = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key
+#endif /* DTLS_ECC */
+};
+
+static void
+deliver(void) {
+  for (;;) {
+    while (queue_head != queue_tail) {
+      datagram_t *d = &queue[queue_head++ % QUEUE_SIZE];
+
+      dtls_handle_message(d->to,
+			  d->to == server ? &server_session : &client_session,
+			  d->data, d->length);
+    }
+#ifdef DTLS_ECC
+    /* resume the handshakes that wait for a crypto job */
+    if (executor.pending) {
+      complete_crypto_job();
+      continue;
+    }
+#endif /* DTLS_ECC */
+    break;
+  }
+}
+
+static double
+now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+bench(const char *name, dtls_handler_t *client_handler, int count) {
+  dtls_peer_t *peer;
+  double start;
+  int i;
+
+  client = dtls_new_context(NULL);
+  server = dtls_new_context(NULL);
+  if (!client || !server) {
+    dtls_emerg("cannot create context\n");
+    return -1;
+  }
+  dtls_set_handler(client, client_handler);
+  dtls_set_handler(server, &server_handler);
+
+  connected = 0;
+  start = now();
+  for (i = 0; i < count; i++) {
+    dtls_connect(client, &client_session);
+    deliver();
+
+    if ((peer = dtls_get_peer(client, &client_session)))
+      dtls_reset_peer(client, peer);
+    if ((peer = dtls_get_peer(server, &server_session)))
+      dtls_reset_peer(server, peer);
+
+    /* discard the alerts sent while resetting the peers */
+    queue_head = queue_tail;
+  }
+
+  printf("%-12s %4d handshakes, %8.1f handshakes/s", name, connected / 2,
+	 connected / 2 / (now() - start));
+  if (connected < 2 * count)
+    printf(" (%d failed)", count - connected / 2);
+  printf("\n");
+
+  dtls_free_context(client);
+  dtls_free_context(server);
+  return connected ? 0 : -1;
+}
+
+int
+main(int argc, char **argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 50;
+  int result = 0;
+#ifdef DTLS_PSK
+  dtls_handler_t psk_handler = server_handler;
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  dtls_handler_t ecc_handler = server_handler;
+#endif /* DTLS_ECC */
+
+  dtls_init();
+
+  dtls_session_init(&client_session);
+  client_session.addr.sin.sin_family = AF_INET;
+  client_session.addr.sin.sin_port = htons(20220);
+  client_session.size = sizeof(client_session.addr.sin);
+
+  dtls_session_init(&server_session);
+  server_session.addr.sin.sin_family = AF_INET;
+  server_session.addr.sin.sin_port = htons(20221);
+  server_session.size = sizeof(server_session.addr.sin);
+
+#ifdef DTLS_PSK
+  /* without ECDSA keys the client offers only the PSK cipher suite */
+  psk_handler.get_ecdsa_key = NULL;
+  psk_handler.verify_ecdsa_key = NULL;
+  result |= bench("PSK", &psk_handler, count);
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  result |= bench("ECDHE-ECDSA", &ecc_handler, count);
+
+  if (dtls_pool_thread_start() == 0) {
+    dtls_pool_stats_t keys, presigs, keys_before, presigs_before;
+
+    /* let the thread fill the pools first */
+    while (dtls_ecdh_pool_needs_refill() ||
+	   dtls_ecdsa_presig_pool_needs_refill())
+      usleep(1000);
+
+    dtls_ecdh_pool_get_stats(&keys_before);
+    dtls_ecdsa_presig_pool_get_stats(&presigs_before);
+    result |= bench("ECDHE+pool", &ecc_handler, count);
+    dtls_ecdh_pool_get_stats(&keys);
+    dtls_ecdsa_presig_pool_get_stats(&presigs);
+    printf("%-12s %lu hits, %lu misses\n", "key pool",
+	   keys.hits - keys_before.hits, keys.misses - keys_before.misses);
+    printf("%-12s %lu hits, %lu misses\n", "presig pool",
+	   presigs.hits - presigs_before.hits,
+	   presigs.misses - presigs_before.misses);
+    dtls_pool_thread_stop();
+  }
+
+  {
+    pthread_t worker;
+
+    if (pthread_create(&worker, NULL, run_crypto_jobs, NULL) == 0) {
+      ecc_handler.submit_crypto_job = submit_crypto_job;
+      server_handler.submit_crypto_job = submit_crypto_job;
+      result |= bench("ECDHE+async", &ecc_handler, count);
+      server_handler.submit_crypto_job = NULL;
+
+      pthread_mutex_lock(&executor.lock);
+      executor.stop = 1;
+      pthread_cond_broadcast(&executor.cond);
+      pthread_mutex_unlock(&executor.lock);
+      pthread_join(worker, NULL);
+    }
+  }
+#endif /* DTLS_ECC */
+
+  {
+    struct memb_stats stats;
+    unsigned int i;
+
+    for (i = 0; memb_get_stats(i, &stats) == 0; i++)
+      printf("%-22s %5zu bytes, %4u objects, %4u high water\n",
+	     stats.name, stats.size, stats.capacity, stats.high_water);
+  }
+
+  return result ? 1 : 0;
+}
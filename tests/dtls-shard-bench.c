@@ -0,0 +1,345 @@
+/*
+ * Measures how the handshake rate of the sharded server runtime
+ * (posix/dtls-shards.h) scales with the number of worker threads.
+ * The server runs with 1, 2, ... up to the given number of shards
+ * on a loopback port. Client threads connect from fresh sockets, so
+ * that the kernel spreads the sessions over the shards, and count
+ * the completed handshakes.
+ *
+ * The clients run in the same process, so the numbers are only
+ * meaningful if there are about twice as many CPUs as shards.
+ *
+ * Usage: dtls-shard-bench [max-shards [handshakes-per-client [psk]]]
+ */
+
+#include "tinydtls.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "dtls.h"
+#include "dtls-shards.h"
+
+/* Log configuration */
+#define LOG_MODULE "dtls-shard-bench"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+#ifdef __GNUC__
+#define UNUSED_PARAM __attribute__((unused))
+#else
+#define UNUSED_PARAM
+#endif /* __GNUC__ */
+
+#define SERVER_PORT 20230
+
+/* The number of client threads per shard. */
+#define CLIENTS_PER_SHARD 2
+
+/* How long a client waits for a handshake, in seconds. */
+#define HANDSHAKE_TIMEOUT 5
+
+typedef struct {
+  pthread_t thread;
+  int fd;
+  int connected;
+  int handshakes;
+  int failed;
+} client_t;
+
+static session_t server_session;
+static int handshakes_per_client;
+
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8_t *data, size_t len) {
+  client_t *client = dtls_get_app_data(ctx);
+
+  return sendto(client->fd, data, len, MSG_DONTWAIT,
+		&session->addr.sa, session->size);
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx UNUSED_PARAM,
+	       session_t *session UNUSED_PARAM,
+	       uint8_t *data UNUSED_PARAM, size_t len UNUSED_PARAM) {
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx,
+	     session_t *session UNUSED_PARAM,
+	     dtls_alert_level_t level UNUSED_PARAM, unsigned short code) {
+  client_t *client = dtls_get_app_data(ctx);
+
+  if (client && code == DTLS_EVENT_CONNECTED)
+    client->connected = 1;
+  return 0;
+}
+
+#ifdef DTLS_PSK
+static int
+get_psk_info(struct dtls_context_t *ctx UNUSED_PARAM,
+	     const session_t *session UNUSED_PARAM,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id UNUSED_PARAM, size_t id_len UNUSED_PARAM,
+	     unsigned char *result, size_t result_length) {
+  static const char identity[] = "Client_identity";
+  static const char key[] = "secretPSK";
+
+  switch (type) {
+  case DTLS_PSK_HINT:
+    return 0;
+  case DTLS_PSK_IDENTITY:
+    if (result_length < sizeof(identity) - 1)
+      break;
+    memcpy(result, identity, sizeof(identity) - 1);
+    return sizeof(identity) - 1;
+  case DTLS_PSK_KEY:
+    if (result_length < sizeof(key) - 1)
+      break;
+    memcpy(result, key, sizeof(key) - 1);
+    return sizeof(key) - 1;
+  default:
+    break;
+  }
+  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+}
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static int
+get_ecdsa_key(struct dtls_context_t *ctx UNUSED_PARAM,
+	      const session_t *session UNUSED_PARAM,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx UNUSED_PARAM,
+		 const session_t *session UNUSED_PARAM,
+		 const unsigned char *other_pub_x UNUSED_PARAM,
+		 const unsigned char *other_pub_y UNUSED_PARAM,
+		 size_t key_size UNUSED_PARAM) {
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+static dtls_handler_t server_handler = {
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key
+#endif /* DTLS_ECC */
+};
+
+static dtls_handler_t client_handler;
+
+static double
+now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Runs one handshake from a new socket and returns 0 on success. */
+static int
+handshake(client_t *client) {
+  static __thread uint8_t buf[DTLS_MAX_BUF];
+  dtls_context_t *ctx;
+  session_t session;
+  struct pollfd pfd;
+  dtls_tick_t start, next, t;
+  int len, timeout;
+
+  if ((client->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    dtls_warn("socket: %s\n", strerror(errno));
+    return -1;
+  }
+  if (!(ctx = dtls_new_context(client))) {
+    close(client->fd);
+    return -1;
+  }
+  dtls_set_handler(ctx, &client_handler);
+
+  client->connected = 0;
+  dtls_ticks(&start);
+  dtls_connect(ctx, &server_session);
+
+  pfd.fd = client->fd;
+  pfd.events = POLLIN;
+  while (!client->connected) {
+    dtls_check_retransmit(ctx, &next, 1);
+    dtls_ticks(&t);
+    if (t - start > HANDSHAKE_TIMEOUT * DTLS_TICKS_PER_SECOND)
+      break;
+    timeout = next > t ? (int)((next - t) * 1000 / DTLS_TICKS_PER_SECOND) : 100;
+    if (poll(&pfd, 1, timeout) <= 0)
+      continue;
+
+    dtls_session_init(&session);
+    session.size = sizeof(session.addr);
+    len = recvfrom(client->fd, buf, sizeof(buf), 0,
+		   &session.addr.sa, &session.size);
+    if (len > 0)
+      dtls_handle_message(ctx, &session, buf, len);
+  }
+
+  /* sends the close_notify that releases the server's peer */
+  dtls_free_context(ctx);
+  close(client->fd);
+  return client->connected ? 0 : -1;
+}
+
+static void *
+run_client(void *arg) {
+  client_t *client = arg;
+  int i;
+
+  for (i = 0; i < handshakes_per_client; i++) {
+    if (handshake(client) == 0)
+      client->handshakes++;
+    else
+      client->failed++;
+  }
+  return NULL;
+}
+
+static int
+bench(unsigned int workers) {
+  struct sockaddr_in addr;
+  dtls_shards_config_t config;
+  dtls_shard_stats_t stats;
+  client_t clients[CLIENTS_PER_SHARD * DTLS_SHARDS_MAX];
+  unsigned int i, nclients = CLIENTS_PER_SHARD * workers;
+  unsigned long datagrams = 0, forwarded = 0, handovers = 0, verifies = 0;
+  int handshakes = 0, failed = 0;
+  double start, elapsed;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(SERVER_PORT);
+
+  memset(&config, 0, sizeof(config));
+  config.addr = (struct sockaddr *)&addr;
+  config.addrlen = sizeof(addr);
+  config.workers = workers;
+  config.pin_cpus = 1;
+  config.handler = &server_handler;
+
+  if (dtls_shards_start(&config) != (int)workers) {
+    dtls_emerg("cannot start %u shards\n", workers);
+    dtls_shards_stop();
+    return -1;
+  }
+
+  memset(clients, 0, sizeof(clients));
+  start = now();
+  for (i = 0; i < nclients; i++) {
+    if (pthread_create(&clients[i].thread, NULL, run_client, &clients[i])) {
+      dtls_emerg("cannot start client thread\n");
+      nclients = i;
+      break;
+    }
+  }
+  for (i = 0; i < nclients; i++) {
+    pthread_join(clients[i].thread, NULL);
+    handshakes += clients[i].handshakes;
+    failed += clients[i].failed;
+  }
+  elapsed = now() - start;
+
+  dtls_shards_stop();
+  for (i = 0; i < workers; i++) {
+    if (dtls_shards_stats(i, &stats) == 0) {
+      datagrams += stats.datagrams;
+      forwarded += stats.forwarded;
+      handovers += stats.handovers;
+      verifies += stats.hello_verifies;
+    }
+  }
+
+  printf("%2u shards %5d handshakes, %8.1f handshakes/s", workers,
+	 handshakes, handshakes / elapsed);
+  if (failed)
+    printf(" (%d failed)", failed);
+  printf(", %lu datagrams, %lu forwarded, %lu handovers, "
+	 "%lu hello verifies\n", datagrams, forwarded, handovers, verifies);
+  return handshakes ? 0 : -1;
+}
+
+int
+main(int argc, char **argv) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int workers, max_workers;
+  int result = 0;
+
+  max_workers = argc > 1 ? atoi(argv[1]) : (cpus > 1 ? cpus : 1);
+  handshakes_per_client = argc > 2 ? atoi(argv[2]) : 20;
+  if (max_workers < 1)
+    max_workers = 1;
+  if (max_workers > DTLS_SHARDS_MAX)
+    max_workers = DTLS_SHARDS_MAX;
+
+  dtls_init();
+
+  dtls_session_init(&server_session);
+  server_session.addr.sin.sin_family = AF_INET;
+  server_session.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server_session.addr.sin.sin_port = htons(SERVER_PORT);
+  server_session.size = sizeof(server_session.addr.sin);
+
+  client_handler = server_handler;
+  client_handler.write = send_to_peer;
+#ifdef DTLS_PSK
+  if (argc > 3 && strcmp(argv[3], "psk") == 0) {
+    /* without ECDSA keys the client offers only the PSK cipher suite */
+    client_handler.get_ecdsa_key = NULL;
+    client_handler.verify_ecdsa_key = NULL;
+  }
+#endif /* DTLS_PSK */
+
+  printf("%ld CPUs online\n", cpus);
+  for (workers = 1; workers <= max_workers; workers++) {
+    result |= bench(workers);
+  }
+
+  return result ? 1 : 0;
+}
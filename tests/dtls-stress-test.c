@@ -0,0 +1,408 @@
+/*
+ * Runs DTLS connections on several threads at once to check that the
+ * crypto and record layer code has no shared working state. Every
+ * thread has its own client and server context that exchange records
+ * through a memory queue. The threads run PSK handshakes, echo
+ * records of varying sizes and encrypt test vectors with
+ * dtls_encrypt() and dtls_decrypt(), comparing the results with those
+ * computed on the main thread before. The Client Hello messages are
+ * answered by dtls_cookie_check() before they reach the server. Every
+ * other handshake resumes the session of the one before, with a
+ * session ticket if these are enabled. The clients of odd threads do
+ * not use tickets, so that their sessions are resumed from the
+ * server's session cache. With session tickets, some resumptions get
+ * a tampered ticket or a server whose ticket keys have expired, and
+ * must fall back to a full handshake.
+ *
+ * Usage: dtls-stress-test [threads [rounds]]
+ */
+
+#include "tinydtls.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dtls.h"
+#include "dtls-crypto.h"
+
+/* Log configuration */
+#define LOG_MODULE "dtls-stress-test"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+#ifdef __GNUC__
+#define UNUSED_PARAM __attribute__((unused))
+#else
+#define UNUSED_PARAM
+#endif /* __GNUC__ */
+
+#define MAX_THREADS 64
+#define QUEUE_SIZE 32
+
+/* The number of records echoed in each round. */
+#define RECORDS 8
+
+/* The number of CCM test vectors. */
+#define VECTORS 16
+#define VECTOR_LENGTH 200
+
+typedef struct {
+  dtls_context_t *to;
+  size_t length;
+  uint8_t data[DTLS_MAX_BUF];
+} datagram_t;
+
+typedef struct {
+  pthread_t thread;
+  unsigned int id;
+  int rounds;
+
+  dtls_context_t *client, *server;
+  session_t client_session, server_session;
+  datagram_t queue[QUEUE_SIZE];
+  unsigned int queue_head, queue_tail;
+
+  int connected;
+  int resumed;
+  int hello_verifies;
+  int stored;
+  dtls_resumption_t resumption;
+  int echoed;
+  uint8_t expected[DTLS_MAX_BUF];
+  size_t expected_length;
+  int errors;
+} worker_t;
+
+typedef struct {
+  uint8_t key[16];
+  uint8_t nonce[DTLS_CCM_BLOCKSIZE];
+  uint8_t aad[13];
+  uint8_t plain[VECTOR_LENGTH];
+  uint8_t cipher[VECTOR_LENGTH + 8];
+  int length;
+} vector_t;
+
+static vector_t vectors[VECTORS];
+
+static void
+fill(uint8_t *buf, size_t len) {
+  while (len--)
+    *buf++ = rand();
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session UNUSED_PARAM,
+	     uint8_t *data, size_t len) {
+  worker_t *w = dtls_get_app_data(ctx);
+  datagram_t *d;
+
+  if (w->queue_tail - w->queue_head == QUEUE_SIZE || len > DTLS_MAX_BUF)
+    return -1;
+
+  d = &w->queue[w->queue_tail++ % QUEUE_SIZE];
+  d->to = ctx == w->client ? w->server : w->client;
+  d->length = len;
+  memcpy(d->data, data, len);
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8_t *data, size_t len) {
+  worker_t *w = dtls_get_app_data(ctx);
+
+  if (ctx == w->server)
+    return dtls_write(ctx, session, data, len);
+
+  if (len != w->expected_length || memcmp(data, w->expected, len) != 0) {
+    dtls_warn("thread %u: echo does not match\n", w->id);
+    w->errors++;
+  }
+  w->echoed++;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level UNUSED_PARAM, unsigned short code) {
+  worker_t *w = dtls_get_app_data(ctx);
+  dtls_peer_t *peer;
+
+  if (code == DTLS_EVENT_CONNECTED) {
+    w->connected++;
+    peer = dtls_get_peer(ctx, session);
+    if (peer && dtls_peer_is_resumed(peer))
+      w->resumed++;
+  }
+  return 0;
+}
+
+static int
+store_resumption(struct dtls_context_t *ctx,
+		 const session_t *session UNUSED_PARAM,
+		 const dtls_resumption_t *state) {
+  worker_t *w = dtls_get_app_data(ctx);
+
+  w->resumption = *state;
+  w->stored++;
+  return 0;
+}
+
+#ifdef DTLS_PSK
+static int
+get_psk_info(struct dtls_context_t *ctx UNUSED_PARAM,
+	     const session_t *session UNUSED_PARAM,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id UNUSED_PARAM, size_t id_len UNUSED_PARAM,
+	     unsigned char *result, size_t result_length) {
+  static const char identity[] = "Client_identity";
+  static const char key[] = "secretPSK";
+
+  switch (type) {
+  case DTLS_PSK_HINT:
+    return 0;
+  case DTLS_PSK_IDENTITY:
+    if (result_length < sizeof(identity) - 1)
+      break;
+    memcpy(result, identity, sizeof(identity) - 1);
+    return sizeof(identity) - 1;
+  case DTLS_PSK_KEY:
+    if (result_length < sizeof(key) - 1)
+      break;
+    memcpy(result, key, sizeof(key) - 1);
+    return sizeof(key) - 1;
+  default:
+    break;
+  }
+  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+}
+#endif /* DTLS_PSK */
+
+static dtls_handler_t handler = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .store_resumption = store_resumption,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+};
+
+static void
+deliver(worker_t *w) {
+  uint8_t reply[DTLS_HELLO_VERIFY_LENGTH];
+  size_t reply_length;
+
+  while (w->queue_head != w->queue_tail) {
+    datagram_t *d = &w->queue[w->queue_head++ % QUEUE_SIZE];
+
+    if (d->to == w->server) {
+      reply_length = sizeof(reply);
+      switch (dtls_cookie_check(w->server, &w->server_session,
+				d->data, d->length, reply, &reply_length)) {
+      case DTLS_COOKIE_PASS:
+      case DTLS_COOKIE_VALID:
+	break;
+      case DTLS_COOKIE_HELLO_VERIFY:
+	w->hello_verifies++;
+	send_to_peer(w->server, &w->server_session, reply, reply_length);
+	continue;
+      default:
+	dtls_warn("thread %u: dtls_cookie_check() failed\n", w->id);
+	w->errors++;
+	continue;
+      }
+    }
+
+    dtls_handle_message(d->to,
+			d->to == w->server ? &w->server_session
+					   : &w->client_session,
+			d->data, d->length);
+  }
+}
+
+static void
+check_vectors(worker_t *w) {
+  uint8_t buf[VECTOR_LENGTH + 8];
+  int i, len;
+
+  for (i = 0; i < VECTORS; i++) {
+    vector_t *v = &vectors[(i + w->id) % VECTORS];
+
+    len = dtls_encrypt(v->plain, v->length, buf, v->nonce,
+		       v->key, sizeof(v->key), v->aad, sizeof(v->aad));
+    if (len != v->length + 8 || memcmp(buf, v->cipher, len) != 0) {
+      dtls_warn("thread %u: dtls_encrypt() result differs\n", w->id);
+      w->errors++;
+      continue;
+    }
+
+    len = dtls_decrypt(buf, len, buf, v->nonce,
+		       v->key, sizeof(v->key), v->aad, sizeof(v->aad));
+    if (len != v->length || memcmp(buf, v->plain, len) != 0) {
+      dtls_warn("thread %u: dtls_decrypt() result differs\n", w->id);
+      w->errors++;
+    }
+  }
+}
+
+#if DTLS_SESSION_TICKETS
+/* Prepares the resumption in an odd round. Returns 0 if the ticket
+ * has been made invalid, so that a full handshake is expected. */
+static int
+prepare_resumption(worker_t *w, int round) {
+  unsigned char key[DTLS_TICKET_KEY_LENGTH];
+
+  switch (round % 8) {
+  case 3:
+    /* a tampered ticket fails to decrypt */
+    w->resumption.ticket[w->resumption.ticket_length - 1] ^= 1;
+    return 0;
+  case 7:
+    /* two new keys push out the one that issued the ticket, as if
+     * two ticket lifetimes had passed */
+    fill(key, sizeof(key));
+    dtls_set_ticket_key(w->server, key);
+    fill(key, sizeof(key));
+    dtls_set_ticket_key(w->server, key);
+    return 0;
+  default:
+    return 1;
+  }
+}
+#endif /* DTLS_SESSION_TICKETS */
+
+static void *
+run_worker(void *arg) {
+  worker_t *w = arg;
+  dtls_peer_t *peer;
+  int round, i, expect_stored, expect_resumed;
+
+  w->client = dtls_new_context(w);
+  w->server = dtls_new_context(w);
+  if (!w->client || !w->server) {
+    w->errors++;
+    goto out;
+  }
+  dtls_set_handler(w->client, &handler);
+  dtls_set_handler(w->server, &handler);
+#if DTLS_SESSION_TICKETS
+  if (w->id % 2)
+    dtls_disable_session_tickets(w->client);
+#endif /* DTLS_SESSION_TICKETS */
+
+  dtls_session_init(&w->client_session);
+  w->client_session.addr.sin.sin_family = AF_INET;
+  w->client_session.addr.sin.sin_port = htons(20220);
+  w->client_session.size = sizeof(w->client_session.addr.sin);
+
+  dtls_session_init(&w->server_session);
+  w->server_session.addr.sin.sin_family = AF_INET;
+  w->server_session.addr.sin.sin_port = htons(20221);
+  w->server_session.size = sizeof(w->server_session.addr.sin);
+
+  for (round = 0; round < w->rounds; round++) {
+    w->connected = 0;
+    w->resumed = 0;
+    w->hello_verifies = 0;
+    w->stored = 0;
+    expect_resumed = round % 2;
+#if DTLS_SESSION_TICKETS
+    if (expect_resumed && !w->client->tickets_disabled)
+      expect_resumed = prepare_resumption(w, round);
+    /* each handshake with tickets issues a new ticket */
+    expect_stored = !w->client->tickets_disabled || !expect_resumed;
+#else /* DTLS_SESSION_TICKETS */
+    /* a resumed session is not passed to store_resumption() again */
+    expect_stored = !expect_resumed;
+#endif /* DTLS_SESSION_TICKETS */
+    dtls_connect_resume(w->client, &w->client_session,
+			round % 2 ? &w->resumption : NULL);
+    deliver(w);
+    if (w->connected != 2 || w->resumed != 2 * expect_resumed ||
+	w->hello_verifies != 1 || w->stored != expect_stored) {
+      dtls_warn("thread %u: handshake %d failed\n", w->id, round);
+      w->errors++;
+    }
+
+    for (i = 0; i < RECORDS; i++) {
+      w->expected_length = 1 + (w->id * 131 + round * 37 + i * 97) % 1000;
+      memset(w->expected, 'a' + (w->id + round + i) % 26, w->expected_length);
+      w->echoed = 0;
+      dtls_write(w->client, &w->client_session,
+		 w->expected, w->expected_length);
+      deliver(w);
+      if (w->echoed != 1) {
+	dtls_warn("thread %u: record %d not echoed\n", w->id, i);
+	w->errors++;
+      }
+    }
+
+    if ((peer = dtls_get_peer(w->client, &w->client_session)))
+      dtls_reset_peer(w->client, peer);
+    if ((peer = dtls_get_peer(w->server, &w->server_session)))
+      dtls_reset_peer(w->server, peer);
+    /* discard the alerts sent while resetting the peers */
+    w->queue_head = w->queue_tail;
+
+    check_vectors(w);
+  }
+
+ out:
+  dtls_free_context(w->client);
+  dtls_free_context(w->server);
+  return NULL;
+}
+
+int
+main(int argc, char **argv) {
+  static worker_t workers[MAX_THREADS];
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  int rounds = argc > 2 ? atoi(argv[2]) : 500;
+  int i, errors = 0;
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  dtls_init();
+
+  /* reference results, computed before any other thread runs */
+  for (i = 0; i < VECTORS; i++) {
+    vector_t *v = &vectors[i];
+
+    fill(v->key, sizeof(v->key));
+    fill(v->nonce, 12);
+    fill(v->aad, sizeof(v->aad));
+    v->length = 1 + i * (VECTOR_LENGTH - 1) / (VECTORS - 1);
+    fill(v->plain, v->length);
+    if (dtls_encrypt(v->plain, v->length, v->cipher, v->nonce, v->key,
+		     sizeof(v->key), v->aad, sizeof(v->aad)) != v->length + 8) {
+      printf("cannot compute test vector %d\n", i);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < threads; i++) {
+    workers[i].id = i;
+    workers[i].rounds = rounds;
+    if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+      printf("cannot start thread %d\n", i);
+      threads = i;
+      errors++;
+      break;
+    }
+  }
+
+  for (i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    errors += workers[i].errors;
+  }
+
+  printf("%d threads, %d rounds: %s (%d errors)\n", threads, rounds,
+	 errors ? "FAILED" : "OK", errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Checks the limits of dtls_write_inplace() and dtls_write_batch(). A
+ * client and a server context run a PSK handshake through a memory
+ * queue. Then the client writes the largest payload that fits into a
+ * record, which must arrive at the server, and one byte more, which
+ * must be rejected without anything being sent. A batch must skip an
+ * oversize message but send the others, and must report how many
+ * messages it has handled when the transport fails.
+ */
+
+#include "tinydtls.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dtls.h"
+
+/* Log configuration */
+#define LOG_MODULE "write-test"
+#define LOG_LEVEL  LOG_LEVEL_DTLS
+#include "dtls-log.h"
+
+#ifdef __GNUC__
+#define UNUSED_PARAM __attribute__((unused))
+#else
+#define UNUSED_PARAM
+#endif /* __GNUC__ */
+
+#define QUEUE_SIZE 16
+
+/* Datagrams larger than DTLS_MAX_BUF are queued as well, so that an
+ * oversize record shows up in the queue. */
+#define DATAGRAM_SIZE (2 * DTLS_MAX_BUF)
+
+typedef struct {
+  dtls_context_t *to;
+  size_t length;
+  uint8_t data[DATAGRAM_SIZE];
+} datagram_t;
+
+static dtls_context_t *client, *server;
+static session_t client_session, server_session;
+static datagram_t queue[QUEUE_SIZE];
+static unsigned int queue_head, queue_tail;
+static int connected;
+static uint8_t received[DTLS_MAX_BUF];
+static size_t received_length;
+static int records;
+static int write_limit = -1;
+static int errors;
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session UNUSED_PARAM,
+	     uint8_t *data, size_t len) {
+  datagram_t *d;
+
+  if (queue_tail - queue_head == QUEUE_SIZE || len > DATAGRAM_SIZE ||
+      write_limit == 0)
+    return -1;
+  if (write_limit > 0)
+    write_limit--;
+
+  d = &queue[queue_tail++ % QUEUE_SIZE];
+  d->to = ctx == client ? server : client;
+  d->length = len;
+  memcpy(d->data, data, len);
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx UNUSED_PARAM,
+	       session_t *session UNUSED_PARAM, uint8_t *data, size_t len) {
+  memcpy(received, data, len);
+  received_length = len;
+  records++;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx UNUSED_PARAM,
+	     session_t *session UNUSED_PARAM,
+	     dtls_alert_level_t level UNUSED_PARAM, unsigned short code) {
+  if (code == DTLS_EVENT_CONNECTED)
+    connected++;
+  return 0;
+}
+
+static int
+get_psk_info(struct dtls_context_t *ctx UNUSED_PARAM,
+	     const session_t *session UNUSED_PARAM,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id UNUSED_PARAM, size_t id_len UNUSED_PARAM,
+	     unsigned char *result, size_t result_length) {
+  static const char identity[] = "Client_identity";
+  static const char key[] = "secretPSK";
+
+  switch (type) {
+  case DTLS_PSK_HINT:
+    return 0;
+  case DTLS_PSK_IDENTITY:
+    if (result_length < sizeof(identity) - 1)
+      break;
+    memcpy(result, identity, sizeof(identity) - 1);
+    return sizeof(identity) - 1;
+  case DTLS_PSK_KEY:
+    if (result_length < sizeof(key) - 1)
+      break;
+    memcpy(result, key, sizeof(key) - 1);
+    return sizeof(key) - 1;
+  default:
+    break;
+  }
+  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+}
+
+static dtls_handler_t handler = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_psk_info = get_psk_info,
+};
+
+static void
+deliver(void) {
+  while (queue_head != queue_tail) {
+    datagram_t *d = &queue[queue_head++ % QUEUE_SIZE];
+
+    dtls_handle_message(d->to,
+			d->to == server ? &server_session : &client_session,
+			d->data, d->length);
+  }
+}
+
+static int
+expect(const char *what, int result, int expected) {
+  if (result != expected) {
+    printf("%s: FAILED (%d instead of %d)\n", what, result, expected);
+    errors++;
+    return 0;
+  }
+  printf("%s: OK\n", what);
+  return 1;
+}
+
+int
+main(void) {
+  uint8_t buf[DTLS_WRITE_HEADROOM + DTLS_MAX_BUF + DTLS_WRITE_TAILROOM];
+  dtls_message_t msgs[3];
+  size_t len, i;
+  int res;
+
+  dtls_init();
+
+  client = dtls_new_context(NULL);
+  server = dtls_new_context(NULL);
+  if (!client || !server) {
+    printf("cannot create contexts\n");
+    return 1;
+  }
+  dtls_set_handler(client, &handler);
+  dtls_set_handler(server, &handler);
+
+  dtls_session_init(&client_session);
+  client_session.addr.sin.sin_family = AF_INET;
+  client_session.addr.sin.sin_port = htons(20220);
+  client_session.size = sizeof(client_session.addr.sin);
+
+  dtls_session_init(&server_session);
+  server_session.addr.sin.sin_family = AF_INET;
+  server_session.addr.sin.sin_port = htons(20221);
+  server_session.size = sizeof(server_session.addr.sin);
+
+  dtls_connect(client, &client_session);
+  deliver();
+  if (!expect("handshake", connected, 2))
+    return 1;
+
+  /* the largest payload fits into DTLS_MAX_BUF */
+  len = DTLS_WRITE_MAX_PAYLOAD;
+  memset(buf + DTLS_WRITE_HEADROOM, 'a', len);
+  res = dtls_write_inplace(client, &client_session, buf, sizeof(buf), len);
+  expect("largest in-place write", res, (int)len);
+  deliver();
+  expect("largest in-place write received",
+	 records == 1 && received_length == len && received[len - 1] == 'a',
+	 1);
+
+  /* one byte more is rejected, although buf is large enough */
+  len = DTLS_WRITE_MAX_PAYLOAD + 1;
+  memset(buf + DTLS_WRITE_HEADROOM, 'b', len);
+  res = dtls_write_inplace(client, &client_session, buf, sizeof(buf), len);
+  expect("oversize in-place write", res < 0, 1);
+  expect("oversize in-place write not sent", queue_tail - queue_head, 0);
+
+  /* the oversize message in the middle of a batch is skipped */
+  for (i = 0; i < 3; i++) {
+    msgs[i].session = &client_session;
+    msgs[i].data = buf + DTLS_WRITE_HEADROOM;
+    msgs[i].length = 10;
+  }
+  msgs[1].length = DTLS_WRITE_MAX_PAYLOAD + 1;
+  records = 0;
+  res = dtls_write_batch(client, msgs, 3);
+  expect("batch with oversize message", res, 3);
+  expect("batch with oversize message, records sent",
+	 queue_tail - queue_head, 2);
+  deliver();
+  expect("batch with oversize message, records received", records, 2);
+  expect("batch messages unchanged",
+	 msgs[0].length == 10 && msgs[2].length == 10, 1);
+
+  /* the transport takes one record only */
+  msgs[1].length = 10;
+  write_limit = 1;
+  records = 0;
+  res = dtls_write_batch(client, msgs, 3);
+  write_limit = -1;
+  expect("batch with failing transport", res, 1);
+  deliver();
+  expect("batch with failing transport, records received", records, 1);
+
+  dtls_free_context(client);
+  dtls_free_context(server);
+
+  printf("%s\n", errors ? "FAILED" : "All tests successful.");
+  return errors ? 1 : 0;
+}